@@ -0,0 +1,134 @@
+//=============================================================================
+// FILE:
+//      bench.c
+//
+// DESCRIPTION:
+//      Harness of the coverage_modes benchmark: a minimal in-process
+//      mutational fuzzer. Every run mutates an input of the corpus, runs the
+//      target on it, and keeps it if __mcw_has_new_bits says it found
+//      something new. The random generator has a fixed seed, so the variants
+//      differ only by what their coverage lets into the corpus.
+//
+// USAGE:
+//      bench [execs]
+//
+//      Prints "<ns per exec> <ns in the target per exec> <corpus size>
+//      <map entries hit> <max depth> <execs to max depth>". A run also
+//      clears and scans the map, which costs more with a larger map.
+//
+// License: MIT
+//=============================================================================
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "target.h"
+#include "work/work4/runtime_lib.h"
+
+enum { kMaxInputSize = 32, kMaxCorpusSize = 1 << 14 };
+
+static uint8_t corpus[kMaxCorpusSize][kMaxInputSize];
+static size_t corpus_sizes[kMaxCorpusSize];
+static size_t corpus_size;
+static uint8_t virgin[MCW_MAX_MAP_SIZE];
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static double Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint32_t Random(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (uint32_t)rng_state;
+}
+
+static void AddToCorpus(const uint8_t *input, size_t size) {
+  if (corpus_size == kMaxCorpusSize) return;
+  memcpy(corpus[corpus_size], input, size);
+  corpus_sizes[corpus_size++] = size;
+}
+
+// A few random byte-level mutations, or a splice with another input
+static size_t Mutate(uint8_t *input, size_t size) {
+  static const uint8_t kInteresting[] = {0, 1, 2, 0x10, 0x20, ';', 0xff};
+  int num_mutations = 1 + Random() % 4;
+  for (int i = 0; i < num_mutations; ++i) {
+    size_t pos = Random() % size;
+    switch (Random() % 6) {
+      case 0:
+        input[pos] = Random();
+        break;
+      case 1:
+        input[pos] += 1;
+        break;
+      case 2:
+        input[pos] -= 1;
+        break;
+      case 3:
+        input[pos] = kInteresting[Random() % sizeof(kInteresting)];
+        break;
+      case 4:
+        if (size < kMaxInputSize) input[size++] = Random();
+        break;
+      default: {
+        // The tail of another input, from the same position
+        size_t other = Random() % corpus_size;
+        if (corpus_sizes[other] <= pos) break;
+        size_t len = corpus_sizes[other] - pos;
+        memcpy(input + pos, corpus[other] + pos,
+               len < size - pos ? len : size - pos);
+        break;
+      }
+    }
+  }
+  return size;
+}
+
+int main(int argc, char *argv[]) {
+  long execs = argc > 1 ? atol(argv[1]) : 200000;
+  if (execs < 1) {
+    fprintf(stderr, "usage: %s [execs >= 1]\n", argv[0]);
+    return 1;
+  }
+
+  memset(virgin, 0xff, sizeof(virgin));
+  const uint8_t seed[8] = {0};
+  AddToCorpus(seed, sizeof(seed));
+
+  uint8_t *map = (uint8_t *)__mcw_area_ptr;
+  int max_depth = -1;
+  long execs_to_max_depth = 0;
+  double start = Now();
+  double in_target = 0.0;
+  for (long exec = 0; exec < execs; ++exec) {
+    uint8_t input[kMaxInputSize];
+    size_t parent = Random() % corpus_size;
+    memcpy(input, corpus[parent], corpus_sizes[parent]);
+    size_t size = Mutate(input, corpus_sizes[parent]);
+
+    __mcw_reset();
+    double target_start = Now();
+    int depth = target(input, size);
+    in_target += Now() - target_start;
+    if (depth > max_depth) {
+      max_depth = depth;
+      execs_to_max_depth = exec + 1;
+    }
+    __mcw_classify_counts(map, __mcw_map_size);
+    if (__mcw_has_new_bits(virgin, map, __mcw_map_size) != 0)
+      AddToCorpus(input, size);
+  }
+  double elapsed = Now() - start;
+
+  size_t num_entries = 0;
+  for (uint32_t i = 0; i < __mcw_map_size; ++i) num_entries += virgin[i] != 0xff;
+  printf("%.1f %.1f %zu %zu %d %ld\n", elapsed / execs, in_target / execs,
+         corpus_size, num_entries, max_depth, execs_to_max_depth);
+  return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+#=============================================================================
+# FILE:
+#      report.sh
+#
+# DESCRIPTION:
+#      Runs the coverage_modes benchmark of every variant and prints what its
+#      coverage costs per run (in all, and in the target alone, over the
+#      uninstrumented build) against what it finds: the inputs kept, the map
+#      entries hit, the deepest stage of the target reached and how many runs
+#      that took.
+#
+# USAGE:
+#      report.sh <bin dir> <execs> <variant>...
+#
+# License: MIT
+#=============================================================================
+set -e
+
+bin=$1
+execs=$2
+shift 2
+
+printf "%-11s %9s %9s %9s %7s %8s %6s %12s\n" \
+  variant ns/exec target_ns overhead corpus entries depth execs_to_max
+for variant in "$@"; do
+  echo "$variant $("$bin/bench_$variant" "$execs")"
+done | awk '
+  # Assumes the plain variant comes first, as in the Makefile
+  $1 == "plain" { base = $3 }
+  {
+    overhead = base > 0 ? sprintf("%.2fx", $3 / base) : "-"
+    printf "%-11s %9.1f %9.1f %9s %7d %8d %6d %12d\n", $1, $2, $3, overhead, \
+      $4, $5, $6, $7
+  }
+'
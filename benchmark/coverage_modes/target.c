@@ -0,0 +1,90 @@
+//=============================================================================
+// FILE:
+//      target.c
+//
+// DESCRIPTION:
+//      A command interpreter whose deeper stages need what plain edge
+//      coverage can't tell apart:
+//        * the same blocks in a different order (the opcode sequences of
+//          `run`), which N-gram coverage sees;
+//        * the same helpers called from different places (`expect`, `step`),
+//          which context-sensitive coverage sees.
+//
+// License: MIT
+//=============================================================================
+#include "target.h"
+
+// Shared by every stage, so its edges alone don't tell which stage passed
+static int expect(const uint8_t *data, size_t size, size_t pos, uint8_t want) {
+  return pos < size && data[pos] == want;
+}
+
+// One instruction of a tiny stack machine. Returns 0 on error.
+static int step(uint8_t op, int *stack, int *depth) {
+  switch (op & 7) {
+    case 0:  // push 1
+      if (*depth == 8) return 0;
+      stack[(*depth)++] = 1;
+      return 1;
+    case 1:  // dup
+      if (*depth == 0 || *depth == 8) return 0;
+      stack[*depth] = stack[*depth - 1];
+      ++*depth;
+      return 1;
+    case 2:  // add
+      if (*depth < 2) return 0;
+      --*depth;
+      stack[*depth - 1] += stack[*depth];
+      return 1;
+    case 3:  // mul
+      if (*depth < 2) return 0;
+      --*depth;
+      stack[*depth - 1] *= stack[*depth];
+      return 1;
+    case 4:  // swap
+      if (*depth < 2) return 0;
+      {
+        int tmp = stack[*depth - 1];
+        stack[*depth - 1] = stack[*depth - 2];
+        stack[*depth - 2] = tmp;
+      }
+      return 1;
+    default:  // nop
+      return 1;
+  }
+}
+
+// Runs the program in data[pos..], and returns the depth its result earns
+static int run(const uint8_t *data, size_t size, size_t pos) {
+  int stack[8];
+  int depth = 0;
+  int level = 0;
+  for (; pos < size && data[pos] != 0xff; ++pos) {
+    if (step(data[pos], stack, &depth) == 0) return level;
+    // Every new value reached on top of the stack is a stage
+    if (depth > 0 && stack[depth - 1] == level + 2 && level < 6) ++level;
+  }
+  return level;
+}
+
+int target(const uint8_t *data, size_t size) {
+  // A 4-byte magic, checked one byte at a time
+  if (!expect(data, size, 0, 'C')) return 0;
+  if (!expect(data, size, 1, 'O')) return 1;
+  if (!expect(data, size, 2, 'V')) return 2;
+  if (!expect(data, size, 3, '!')) return 3;
+
+  // A version byte picks one of two dialects, which then check the same
+  // trailer through the same helper
+  int depth = 4;
+  if (expect(data, size, 4, 1)) {
+    depth += expect(data, size, 5, 0x10) ? 1 : 0;
+  } else if (expect(data, size, 4, 2)) {
+    depth += expect(data, size, 5, 0x20) ? 1 : 0;
+  }
+  if (depth == 4) return depth;
+
+  depth += expect(data, size, 6, ';');
+  if (depth < 6) return depth;
+  return depth + run(data, size, 7);
+}
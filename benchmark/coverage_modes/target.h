@@ -0,0 +1,23 @@
+//=============================================================================
+// FILE:
+//      target.h
+//
+// DESCRIPTION:
+//      Program fuzzed by the coverage_modes benchmark. Only target.c is
+//      instrumented by my_clang_wrapper, the harness is compiled as is.
+//
+// License: MIT
+//=============================================================================
+#ifndef BENCHMARK_COVERAGE_MODES_TARGET_H_
+#define BENCHMARK_COVERAGE_MODES_TARGET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Parses `data` as a small command stream. Returns how deep the parse got,
+// from 0 (bad header) to kTargetMaxDepth (every stage passed).
+int target(const uint8_t *data, size_t size);
+
+enum { kTargetMaxDepth = 12 };
+
+#endif  // BENCHMARK_COVERAGE_MODES_TARGET_H_
@@ -0,0 +1,98 @@
+//=============================================================================
+// FILE:
+//      bench.c
+//
+// DESCRIPTION:
+//      Timing harness of the fp_kernels benchmark. Every kernel runs `reps`
+//      times over `n` elements; the fastest repetition is reported in
+//      nanoseconds per element, which filters out most of the noise.
+//
+// USAGE:
+//      bench [n] [reps]
+//
+// License: MIT
+//=============================================================================
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "kernels.h"
+
+static double *x, *y, *out;
+static double checksum;
+
+static double Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void RunAxpy(int n) {
+  axpy(1e-3, x, out, n);
+  checksum += out[n / 2];
+}
+
+static void RunStencil3(int n) {
+  stencil3(x, out, n);
+  checksum += out[n / 2];
+}
+
+static void RunDot(int n) { checksum += dot(x, y, n); }
+
+static void RunSum(int n) { checksum += sum(x, n); }
+
+static void RunCountEqual(int n) { checksum += count_equal(x, y, n); }
+
+static const struct {
+  const char *name;
+  void (*run)(int n);
+} kBenchmarks[] = {
+    {"axpy", RunAxpy},
+    {"stencil3", RunStencil3},
+    {"dot", RunDot},
+    {"sum", RunSum},
+    {"count_equal", RunCountEqual},
+};
+
+int main(int argc, char *argv[]) {
+  // 3 arrays of 64K doubles stay in L2, so that the loops are compute bound
+  int n = argc > 1 ? atoi(argv[1]) : 1 << 16;
+  int reps = argc > 2 ? atoi(argv[2]) : 200;
+  if (n < 3 || reps < 1) {
+    fprintf(stderr, "usage: %s [n >= 3] [reps >= 1]\n", argv[0]);
+    return 1;
+  }
+
+  x = malloc(n * sizeof(double));
+  y = malloc(n * sizeof(double));
+  out = malloc(n * sizeof(double));
+  // Small values: the sums stay below the clamp threshold of work2/work3 for
+  // a while, as they would in most real code. One element in 8 is equal.
+  srand(1234);
+  for (int i = 0; i < n; ++i) {
+    x[i] = (double)rand() / RAND_MAX;
+    y[i] = i % 8 == 0 ? x[i] : (double)rand() / RAND_MAX;
+    out[i] = 0.0;
+  }
+
+  for (size_t b = 0; b < sizeof(kBenchmarks) / sizeof(kBenchmarks[0]); ++b) {
+    // Warm up the caches and the branch predictor
+    kBenchmarks[b].run(n);
+    double best = 0.0;
+    for (int rep = 0; rep < reps; ++rep) {
+      double start = Now();
+      kBenchmarks[b].run(n);
+      double elapsed = Now() - start;
+      if (rep == 0 || elapsed < best) best = elapsed;
+    }
+    printf("%s %.3f\n", kBenchmarks[b].name, best / n);
+  }
+
+  // Keeps the results alive
+  fprintf(stderr, "checksum %g\n", checksum);
+  free(x);
+  free(y);
+  free(out);
+  return 0;
+}
@@ -0,0 +1,42 @@
+//=============================================================================
+// FILE:
+//      kernels.c
+//
+// DESCRIPTION:
+//      Representative floating-point loops. All of them are vectorized when
+//      compiled clean at -O2: the reductions carry a vectorize(enable) hint,
+//      which allows reordering the additions without -ffast-math (that would
+//      also change the fcmp the conversion looks for).
+//
+// License: MIT
+//=============================================================================
+#include "kernels.h"
+
+void axpy(double a, const double *restrict x, double *restrict y, int n) {
+  for (int i = 0; i < n; ++i) y[i] = a * x[i] + y[i];
+}
+
+void stencil3(const double *restrict in, double *restrict out, int n) {
+  for (int i = 1; i < n - 1; ++i)
+    out[i] = (in[i - 1] + in[i] + in[i + 1]) * (1.0 / 3.0);
+}
+
+double dot(const double *restrict x, const double *restrict y, int n) {
+  double res = 0.0;
+#pragma clang loop vectorize(enable)
+  for (int i = 0; i < n; ++i) res += x[i] * y[i];
+  return res;
+}
+
+double sum(const double *restrict x, int n) {
+  double res = 0.0;
+#pragma clang loop vectorize(enable)
+  for (int i = 0; i < n; ++i) res += x[i];
+  return res;
+}
+
+int count_equal(const double *restrict x, const double *restrict y, int n) {
+  int count = 0;
+  for (int i = 0; i < n; ++i) count += x[i] == y[i];
+  return count;
+}
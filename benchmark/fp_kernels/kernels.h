@@ -0,0 +1,25 @@
+//=============================================================================
+// FILE:
+//      kernels.h
+//
+// DESCRIPTION:
+//      Floating-point kernels measured by the fp_kernels benchmark. Only
+//      kernels.c goes through the transforms, the harness is compiled as is.
+//
+// License: MIT
+//=============================================================================
+#ifndef BENCHMARK_FP_KERNELS_KERNELS_H_
+#define BENCHMARK_FP_KERNELS_KERNELS_H_
+
+// y[i] = a * x[i] + y[i]
+void axpy(double a, const double *x, double *y, int n);
+// out[i] = (in[i - 1] + in[i] + in[i + 1]) / 3, for 0 < i < n - 1
+void stencil3(const double *in, double *out, int n);
+// Sum of x[i] * y[i]
+double dot(const double *x, const double *y, int n);
+// Sum of x[i]
+double sum(const double *x, int n);
+// Number of i with x[i] == y[i]
+int count_equal(const double *x, const double *y, int n);
+
+#endif  // BENCHMARK_FP_KERNELS_KERNELS_H_
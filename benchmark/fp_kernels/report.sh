@@ -0,0 +1,54 @@
+#!/bin/sh
+#=============================================================================
+# FILE:
+#      report.sh
+#
+# DESCRIPTION:
+#      Runs the fp_kernels benchmark of every variant and prints, per kernel,
+#      the time per element, the slowdown over the clean build and whether the
+#      loop vectorizer (or the SLP vectorizer) kicked in.
+#
+# USAGE:
+#      report.sh <bin dir> <n> <reps> <variant>...
+#
+# License: MIT
+#=============================================================================
+set -e
+
+bin=$1
+n=$2
+reps=$3
+shift 3
+
+# Prints the functions in which `pass` vectorized something, according to the
+# optimization record of a variant
+vectorized() {
+  awk -v pass="$2" '
+    /^--- /      { kind = $2; cur_pass = "" }
+    /^Pass:/     { cur_pass = $2 }
+    /^Function:/ { if (kind == "!Passed" && cur_pass == pass) print $2 }
+  ' "$1" | sort -u
+}
+
+printf "%-10s %-12s %10s %9s  %s\n" variant kernel ns/elem slowdown vectorized
+for variant in "$@"; do
+  record=$bin/kernels_$variant.opt.yaml
+  loops=$(vectorized "$record" loop-vectorize)
+  slp=$(vectorized "$record" slp-vectorizer)
+  "$bin/bench_$variant" "$n" "$reps" 2>/dev/null | while read -r kernel ns; do
+    status=no
+    if echo "$loops" | grep -qx "$kernel"; then
+      status=loop
+    elif echo "$slp" | grep -qx "$kernel"; then
+      status=slp
+    fi
+    echo "$variant $kernel $ns $status"
+  done
+done | awk '
+  # Assumes the clean variant comes first, as in the Makefile
+  $1 == "clean" { base[$2] = $3 }
+  {
+    slowdown = base[$2] > 0 ? sprintf("%.2fx", $3 / base[$2]) : "-"
+    printf "%-10s %-12s %10.3f %9s  %s\n", $1, $2, $3, slowdown, $4
+  }
+'
@@ -0,0 +1,279 @@
+//=============================================================================
+// FILE:
+//      gen_ir.c
+//
+// DESCRIPTION:
+//      Writes a synthetic module of textual IR for the scaling benchmark.
+//      Every function has an acyclic CFG of forward branches, conditional
+//      branches and switches, so every block is reachable and blocks with
+//      several predecessors start with PHIs. Blocks compute on integers and
+//      doubles, compare them (icmp, fcmp oeq/une) and call earlier functions.
+//
+// USAGE:
+//      gen_ir [-f functions] [-b blocks per function] [-i instructions per
+//             block] [-s switch cases] [-p PHIs per join block]
+//             [-x % of FP instructions] [-r seed] > module.ll
+//
+//      The output only depends on the options, so a size always gives the
+//      same module.
+//
+// License: MIT
+//=============================================================================
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+  int num_functions;
+  int num_blocks;
+  int num_insts;
+  int num_cases;
+  int num_phis;
+  int fp_percent;
+  uint64_t seed;
+} Options;
+
+// What a block leaves to its successors: its last integer and FP values
+typedef struct {
+  int last_int;
+  int last_fp;
+} BlockValues;
+
+static uint64_t rng_state;
+
+static uint32_t Random(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (uint32_t)rng_state;
+}
+
+static int Chance(int percent) { return (int)(Random() % 100) < percent; }
+
+// Values are numbered per function; %a, %b, %x and %y are the arguments
+static int next_value;
+
+static void PrintInt(int value) {
+  if (value < 0)
+    printf("%%a");
+  else
+    printf("%%v%d", value);
+}
+
+static void PrintFp(int value) {
+  if (value < 0)
+    printf("%%x");
+  else
+    printf("%%v%d", value);
+}
+
+// Picks the successors of block `bb` out of `num_blocks`, all distinct and
+// later, the first one always bb + 1. Returns how many.
+static int PickSuccessors(const Options *options, int bb, int num_blocks,
+                          int *succs) {
+  if (bb + 1 == num_blocks) return 0;
+  succs[0] = bb + 1;
+  int left = num_blocks - bb - 2;
+  int num_succs = 1;
+  uint32_t kind = Random() % 8;
+  if (kind < 2 || left == 0) return num_succs;
+  int wanted = kind < 6 ? 2 : 1 + options->num_cases;
+  if (wanted > left + 1) wanted = left + 1;
+  while (num_succs < wanted) {
+    int succ = bb + 2 + (int)(Random() % left);
+    int is_new = 1;
+    for (int i = 0; i < num_succs; ++i) is_new &= succs[i] != succ;
+    if (is_new) succs[num_succs++] = succ;
+  }
+  return num_succs;
+}
+
+static void GenerateFunction(const Options *options, int func) {
+  int num_blocks = options->num_blocks;
+  int max_succs = options->num_cases + 1;
+  int *succs = malloc(sizeof(int) * num_blocks * max_succs);
+  int *num_succs = calloc(num_blocks, sizeof(int));
+  // The predecessors of bb are preds[first_pred[bb]..first_pred[bb + 1])
+  int *first_pred = calloc(num_blocks + 1, sizeof(int));
+  int *preds = malloc(sizeof(int) * num_blocks * max_succs);
+  int *num_preds = calloc(num_blocks, sizeof(int));
+  BlockValues *values = malloc(sizeof(BlockValues) * num_blocks);
+  for (int bb = 0; bb < num_blocks; ++bb) {
+    num_succs[bb] =
+        PickSuccessors(options, bb, num_blocks, &succs[bb * max_succs]);
+    for (int i = 0; i < num_succs[bb]; ++i)
+      ++first_pred[succs[bb * max_succs + i] + 1];
+  }
+  for (int bb = 0; bb < num_blocks; ++bb)
+    first_pred[bb + 1] += first_pred[bb];
+  for (int bb = 0; bb < num_blocks; ++bb) {
+    for (int i = 0; i < num_succs[bb]; ++i) {
+      int succ = succs[bb * max_succs + i];
+      preds[first_pred[succ] + num_preds[succ]++] = bb;
+    }
+  }
+
+  printf("define i32 @f%d(i32 %%a, i32 %%b, double %%x, double %%y) {\n",
+         func);
+  printf("entry:\n  br label %%bb0\n");
+  next_value = 0;
+  for (int bb = 0; bb < num_blocks; ++bb) {
+    printf("\nbb%d:\n", bb);
+    // The values this block computes on: the arguments, its PHIs and what it
+    // computed itself
+    int last_int = -1;
+    int last_fp = -1;
+    if (num_preds[bb] > 1) {
+      for (int i = 0; i < options->num_phis; ++i) {
+        int is_fp = Chance(options->fp_percent);
+        int phi = next_value++;
+        printf("  %%v%d = phi %s ", phi, is_fp ? "double" : "i32");
+        for (int p = 0; p < num_preds[bb]; ++p) {
+          int pred = preds[first_pred[bb] + p];
+          printf("%s[ ", p == 0 ? "" : ", ");
+          if (is_fp)
+            PrintFp(values[pred].last_fp);
+          else
+            PrintInt(values[pred].last_int);
+          printf(", %%bb%d ]", pred);
+        }
+        printf("\n");
+        if (is_fp)
+          last_fp = phi;
+        else
+          last_int = phi;
+      }
+    }
+
+    for (int i = 0; i < options->num_insts; ++i) {
+      int value = next_value++;
+      if (Chance(options->fp_percent)) {
+        static const char *kFpOps[] = {"fadd", "fsub", "fmul"};
+        printf("  %%v%d = %s double ", value, kFpOps[Random() % 3]);
+        PrintFp(last_fp);
+        printf(", %s\n", Random() % 2 ? "%y" : "1.5");
+        last_fp = value;
+      } else {
+        static const char *kIntOps[] = {"add", "sub", "xor", "and", "or",
+                                        "mul"};
+        printf("  %%v%d = %s i32 ", value, kIntOps[Random() % 6]);
+        PrintInt(last_int);
+        printf(", %s\n", Random() % 2 ? "%b" : "7");
+        last_int = value;
+      }
+    }
+    // Calls to earlier functions keep the call graph acyclic
+    if (func > 0 && Random() % 8 == 0) {
+      int value = next_value++;
+      printf("  %%v%d = call i32 @f%d(i32 ", value, (int)(Random() % func));
+      PrintInt(last_int);
+      printf(", i32 %%b, double ");
+      PrintFp(last_fp);
+      printf(", double %%y)\n");
+      last_int = value;
+    }
+    values[bb].last_int = last_int;
+    values[bb].last_fp = last_fp;
+
+    const int *bb_succs = &succs[bb * max_succs];
+    if (num_succs[bb] == 0) {
+      printf("  ret i32 ");
+      PrintInt(last_int);
+      printf("\n");
+    } else if (num_succs[bb] == 1) {
+      printf("  br label %%bb%d\n", bb_succs[0]);
+    } else if (num_succs[bb] == 2) {
+      int cond = next_value++;
+      if (Chance(options->fp_percent)) {
+        printf("  %%v%d = fcmp %s double ", cond,
+               Random() % 2 ? "oeq" : "une");
+        PrintFp(last_fp);
+        printf(", %%y\n");
+      } else {
+        printf("  %%v%d = icmp slt i32 ", cond);
+        PrintInt(last_int);
+        printf(", %%b\n");
+      }
+      printf("  br i1 %%v%d, label %%bb%d, label %%bb%d\n", cond,
+             bb_succs[1], bb_succs[0]);
+    } else {
+      int selector = next_value++;
+      printf("  %%v%d = and i32 ", selector);
+      PrintInt(last_int);
+      printf(", 255\n  switch i32 %%v%d, label %%bb%d [", selector,
+             bb_succs[0]);
+      for (int i = 1; i < num_succs[bb]; ++i)
+        printf(" i32 %d, label %%bb%d", i, bb_succs[i]);
+      printf(" ]\n");
+    }
+  }
+  printf("}\n\n");
+
+  free(values);
+  free(num_preds);
+  free(preds);
+  free(first_pred);
+  free(num_succs);
+  free(succs);
+}
+
+static int Usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [-f functions] [-b blocks] [-i instructions] "
+          "[-s switch cases] [-p phis] [-x fp percent] [-r seed]\n",
+          argv0);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  Options options = {.num_functions = 16,
+                     .num_blocks = 16,
+                     .num_insts = 8,
+                     .num_cases = 4,
+                     .num_phis = 2,
+                     .fp_percent = 25,
+                     .seed = 1};
+  int opt;
+  while ((opt = getopt(argc, argv, "f:b:i:s:p:x:r:")) != -1) {
+    switch (opt) {
+      case 'f':
+        options.num_functions = atoi(optarg);
+        break;
+      case 'b':
+        options.num_blocks = atoi(optarg);
+        break;
+      case 'i':
+        options.num_insts = atoi(optarg);
+        break;
+      case 's':
+        options.num_cases = atoi(optarg);
+        break;
+      case 'p':
+        options.num_phis = atoi(optarg);
+        break;
+      case 'x':
+        options.fp_percent = atoi(optarg);
+        break;
+      case 'r':
+        options.seed = strtoull(optarg, NULL, 0);
+        break;
+      default:
+        return Usage(argv[0]);
+    }
+  }
+  if (options.num_functions < 1 || options.num_blocks < 1 ||
+      options.num_insts < 1 || options.num_cases < 2 || options.num_phis < 0 ||
+      options.fp_percent < 0 || options.fp_percent > 100 || optind != argc)
+    return Usage(argv[0]);
+
+  rng_state = options.seed * 0x9e3779b97f4a7c15ull + 1;
+  printf("; gen_ir -f %d -b %d -i %d -s %d -p %d -x %d -r %llu\n",
+         options.num_functions, options.num_blocks, options.num_insts,
+         options.num_cases, options.num_phis, options.fp_percent,
+         (unsigned long long)options.seed);
+  printf("source_filename = \"gen_ir\"\n\n");
+  for (int func = 0; func < options.num_functions; ++func)
+    GenerateFunction(&options, func);
+  return 0;
+}
@@ -0,0 +1,77 @@
+#!/bin/sh
+#=============================================================================
+# FILE:
+#      report.sh
+#
+# DESCRIPTION:
+#      Runs every tool on the module of every size with -profile-json, and
+#      prints the time (in all, and in the tool's own phases), the time per
+#      block, its growth over the first size, the peak RSS and the size of
+#      the output. Fails if the growth of a tool exceeds <max growth> in a run
+#      of its phases long enough to measure (<min ms>).
+#
+# USAGE:
+#      report.sh <bin dir> <max growth> <min ms> "<size>..." <tool>...
+#
+#      A size is <functions>x<blocks per function>, with its module in
+#      <bin dir>/module_<size>.ll.
+#
+# License: MIT
+#=============================================================================
+set -e
+
+bin=$1
+max_growth=$2
+min_ms=$3
+sizes=$4
+shift 4
+
+# Prints "<total us> <us in the tool's phases> <peak RSS KiB>" from the
+# profile of a run
+read_profile() {
+  awk '
+    { gsub(/[",]/, "") }
+    $1 == "peak_rss_kb:" && rss == "" { rss = $2 }
+    $1 == "functions:" { done = 1 }
+    done { next }
+    $1 == "name:" { name = $2 }
+    $1 == "time_us:" {
+      total += $2
+      if (name != "load" && name != "verify" && name != "write") run += $2
+    }
+    END { print total + 0, run + 0, rss + 0 }
+  ' "$1"
+}
+
+printf "%-21s %-8s %7s %10s %10s %9s %7s %9s %9s\n" tool size blocks \
+  total_ms run_ms us/block growth rss_MiB out_KiB
+for tool in "$@"; do
+  for size in $sizes; do
+    module=$bin/module_$size.ll
+    out=$bin/out_${tool}_$size.ll
+    profile=$bin/profile_${tool}_$size.json
+    if "$bin/$tool" -profile-json="$profile" -o "$out" "$module" \
+        >/dev/null 2>&1; then
+      echo "$tool $size $(read_profile "$profile") $(wc -c < "$out")"
+    else
+      echo "$tool $size failed"
+    fi
+    rm -f "$out"
+  done
+done | awk -v max_growth="$max_growth" -v min_ms="$min_ms" '
+  $3 == "failed" { printf "%-21s %-8s failed\n", $1, $2; failed = 1; next }
+  {
+    split($2, dims, "x")
+    blocks = dims[1] * dims[2]
+    per_block = $4 / blocks
+    # The first size of every tool is its baseline
+    if (!($1 in base)) base[$1] = per_block
+    growth = base[$1] > 0 ? per_block / base[$1] : 1
+    cliff = growth > max_growth && $4 / 1000 >= min_ms ? "  <- cliff" : ""
+    if (cliff != "") failed = 1
+    printf "%-21s %-8s %7d %10.1f %10.1f %9.2f %6.1fx %9.1f %9.1f%s\n", $1, $2,
+           blocks, $3 / 1000, $4 / 1000, per_block, growth, $5 / 1024,
+           $6 / 1024, cliff
+  }
+  END { exit failed }
+'
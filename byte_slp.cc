@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"    // parseIRFile
+#include "llvm/Support/CommandLine.h"  // cl::opt
+#include "llvm/Support/MathExtras.h"   // isPowerOf2_32
+#include "llvm/Support/SourceMgr.h"    // SMDiagnostic
+
+#include "byte_update.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
+#include "common/function_filter.h"
+
+using namespace llvm;
+
+static cl::opt<std::string> filter(
+    "filter", cl::desc("Only vectorize the functions matching this regex"),
+    cl::value_desc("regex"));
+static cl::opt<std::string> filter_list(
+    "filter-list",
+    cl::desc("Only vectorize the functions listed in this file"),
+    cl::value_desc("file"));
+static cl::opt<unsigned> vector_width(
+    "vector-width", cl::desc("Widest vector, in bytes (a power of two)"),
+    cl::init(16));
+static cl::opt<unsigned> min_run_length(
+    "min-run", cl::desc("Shortest run of consecutive bytes worth vectorizing"),
+    cl::init(4));
+
+struct Stats {
+  unsigned num_updates = 0;
+  unsigned num_vectorized = 0;
+  unsigned num_chunks = 0;
+};
+
+void RunOnModule(Module& module, const common::FunctionFilter& filter);
+void RunOnFunction(Function& func);
+void RunOnBasicBlock(BasicBlock& basic_block, Stats& stats);
+// Replaces the runs of consecutive bytes of `group` (updates of distinct
+// bytes of one buffer) with vector code, right after its last store
+void VectorizeGroup(std::vector<byte_update::ByteUpdate>& group,
+                    Stats& stats);
+
+int main(int argc, char** argv) {
+  common::Driver driver(argc, argv,
+                        "Vectorizes straight-line updates of consecutive bytes\n");
+  if (isPowerOf2_32(vector_width) == false) {
+    errs() << "-vector-width must be a power of two\n";
+    return 1;
+  }
+  common::FunctionFilter function_filter;
+  if (function_filter.Init(filter, filter_list) == false) return 1;
+
+  return driver.Run("byte_slp", [&](Module& module) {
+    RunOnModule(module, function_filter);
+    return true;
+  });
+}
+
+void RunOnModule(Module& module, const common::FunctionFilter& filter) {
+  for (auto& func : module) {
+    if (filter.Matches(func) == false) continue;
+    common::ScopedEvent event("byte_slp", func);
+    RunOnFunction(func);
+  }
+}
+
+void RunOnFunction(Function& func) {
+  Stats stats;
+  for (auto& basic_block : func) RunOnBasicBlock(basic_block, stats);
+
+  if (stats.num_updates != 0) {
+    errs() << "byte_slp '" << func.getName() << "': vectorized "
+           << stats.num_vectorized << " of " << stats.num_updates
+           << " byte updates into " << stats.num_chunks << " chunks\n";
+  }
+}
+
+void RunOnBasicBlock(BasicBlock& basic_block, Stats& stats) {
+  const auto& data_layout = basic_block.getModule()->getDataLayout();
+
+  // STEP 1: Collect the updates that can be moved, in program order
+  std::vector<byte_update::ByteUpdate> updates;
+  for (auto& inst : basic_block) {
+    auto* store = dyn_cast<StoreInst>(&inst);
+    byte_update::ByteUpdate update;
+    if (store != nullptr &&
+        byte_update::MatchByteUpdate(store, data_layout, update) &&
+        byte_update::IsSelfContained(update))
+      updates.push_back(std::move(update));
+  }
+  stats.num_updates += updates.size();
+
+  // STEP 2: Split them into groups of updates of distinct bytes of a buffer
+  // that can all be done at the end of the group. That holds if nothing but
+  // the group's own loads and stores accesses memory from the first load of
+  // the group to the last store, which is checked one update at a time:
+  // updates that interleave end the group.
+  std::vector<std::vector<byte_update::ByteUpdate>> groups;
+  for (auto& update : updates) {
+    bool extends = groups.empty() == false;
+    if (extends) {
+      const auto& group = groups.back();
+      extends = update.base == group.front().base &&
+                std::none_of(group.begin(), group.end(),
+                             [&](const byte_update::ByteUpdate& other) {
+                               return other.offset == update.offset;
+                             });
+    }
+    if (extends) {
+      bool seen_load = false;
+      for (auto* inst = groups.back().back().store->getNextNode();
+           inst != update.store; inst = inst->getNextNode()) {
+        if (inst == update.load) {
+          seen_load = true;
+        } else if (inst->mayReadOrWriteMemory()) {
+          extends = false;
+          break;
+        }
+      }
+      extends &= seen_load;
+    }
+
+    if (extends == false) groups.emplace_back();
+    groups.back().push_back(std::move(update));
+  }
+
+  // STEP 3: Vectorize every group
+  for (auto& group : groups) VectorizeGroup(group, stats);
+}
+
+void VectorizeGroup(std::vector<byte_update::ByteUpdate>& group,
+                    Stats& stats) {
+  auto* insert_point = group.back().store->getNextNode();
+  std::sort(group.begin(), group.end(),
+            [](const byte_update::ByteUpdate& lhs,
+               const byte_update::ByteUpdate& rhs) {
+              return lhs.offset < rhs.offset;
+            });
+
+  IRBuilder<> builder(insert_point);
+  Value* base = nullptr;
+  std::vector<byte_update::ByteUpdate> vectorized;
+  for (size_t begin = 0, end = 0; begin < group.size(); begin = end) {
+    // The run of consecutive bytes starting at `begin`
+    for (end = begin + 1; end < group.size() &&
+                          group[end].offset == group[end - 1].offset + 1;
+         ++end) {
+    }
+    if (end - begin < min_run_length) continue;
+
+    std::vector<byte_update::ByteOps> lanes;
+    for (size_t i = begin; i < end; ++i) lanes.push_back(group[i].ops);
+    if (base == nullptr) {
+      base = builder.CreatePointerCast(group.front().base,
+                                       builder.getInt8PtrTy());
+    }
+    auto* ptr = builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), base,
+                                                   group[begin].offset);
+    stats.num_chunks += byte_update::CreateChunks(
+        builder, ptr, byte_update::BuildStages(lanes), vector_width);
+    vectorized.insert(vectorized.end(), group.begin() + begin,
+                      group.begin() + end);
+  }
+
+  stats.num_vectorized += vectorized.size();
+  byte_update::Erase(vectorized);
+}
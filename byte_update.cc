@@ -0,0 +1,401 @@
+#include "byte_update.h"
+
+#include <algorithm>
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/ValueTracking.h"  // GetPointerBaseWithConstantOffset
+#include "llvm/IR/ValueHandle.h"          // WeakTrackingVH
+#include "llvm/Transforms/Utils/Local.h"  // RecursivelyDeleteTriviallyDead...
+
+using namespace llvm;
+using namespace byte_update;
+
+// Matches `(a << c) | (a >> (8 - c))` on an i8 `a`, or on `a` zero-extended
+// from an i8 `src`: the low 8 bits of both are `src` rotated left by `c`.
+static bool MatchRotate(BinaryOperator* or_op, Value*& src, uint8_t& amount,
+                        SmallVectorImpl<Instruction*>& nodes) {
+  for (unsigned i = 0; i < 2; ++i) {
+    auto* shl = dyn_cast<BinaryOperator>(or_op->getOperand(i));
+    auto* lshr = dyn_cast<BinaryOperator>(or_op->getOperand(1 - i));
+    if (shl == nullptr || lshr == nullptr ||
+        shl->getOpcode() != Instruction::Shl ||
+        lshr->getOpcode() != Instruction::LShr ||
+        shl->getOperand(0) != lshr->getOperand(0))
+      continue;
+
+    auto* shl_amount = dyn_cast<ConstantInt>(shl->getOperand(1));
+    auto* lshr_amount = dyn_cast<ConstantInt>(lshr->getOperand(1));
+    if (shl_amount == nullptr || lshr_amount == nullptr ||
+        shl_amount->getValue().ult(8) == false ||
+        lshr_amount->getValue().ult(8) == false ||
+        shl_amount->getZExtValue() + lshr_amount->getZExtValue() != 8)
+      continue;
+
+    Value* a = shl->getOperand(0);
+    if (a->getType()->isIntegerTy(8)) {
+      src = a;
+    } else if (auto* zext = dyn_cast<ZExtInst>(a)) {
+      if (zext->getSrcTy()->isIntegerTy(8) == false) continue;
+      src = zext->getOperand(0);
+      nodes.push_back(zext);
+    } else {
+      continue;
+    }
+    amount = shl_amount->getZExtValue();
+    nodes.push_back(shl);
+    nodes.push_back(lshr);
+    return true;
+  }
+  return false;
+}
+
+bool byte_update::MatchByteOps(Value* value, LoadInst*& load, ByteOps& ops,
+                               SmallVectorImpl<Instruction*>& nodes) {
+  auto* inst = dyn_cast<Instruction>(value);
+  if (inst == nullptr || inst->getType()->isIntegerTy() == false ||
+      inst->getType()->getIntegerBitWidth() < 8)
+    return false;
+
+  if (auto* li = dyn_cast<LoadInst>(inst)) {
+    if (li->isSimple() == false || li->getType()->isIntegerTy(8) == false)
+      return false;
+    load = li;
+    nodes.push_back(li);
+    return true;
+  }
+
+  // Only the low 8 bits are ever stored, and none of the operations below
+  // depends on higher bits
+  if (isa<TruncInst>(inst) || isa<ZExtInst>(inst) || isa<SExtInst>(inst)) {
+    if (MatchByteOps(inst->getOperand(0), load, ops, nodes) == false)
+      return false;
+    nodes.push_back(inst);
+    return true;
+  }
+
+  if (auto* ii = dyn_cast<IntrinsicInst>(inst)) {
+    auto id = ii->getIntrinsicID();
+    auto* amount = dyn_cast<ConstantInt>(ii->getArgOperand(2));
+    if ((id != Intrinsic::fshl && id != Intrinsic::fshr) ||
+        ii->getType()->isIntegerTy(8) == false ||
+        ii->getArgOperand(0) != ii->getArgOperand(1) || amount == nullptr)
+      return false;
+    if (MatchByteOps(ii->getArgOperand(0), load, ops, nodes) == false)
+      return false;
+    uint8_t rotl = amount->getZExtValue() % 8;
+    ops.push_back({OpKind::kRotl, uint8_t(id == Intrinsic::fshl
+                                              ? rotl
+                                              : (8 - rotl) % 8)});
+    nodes.push_back(ii);
+    return true;
+  }
+
+  auto* bin_op = dyn_cast<BinaryOperator>(inst);
+  if (bin_op == nullptr) return false;
+
+  if (bin_op->getOpcode() == Instruction::Or) {
+    Value* src = nullptr;
+    uint8_t amount = 0;
+    SmallVector<Instruction*, 4> rotate_nodes;
+    if (MatchRotate(bin_op, src, amount, rotate_nodes) == false ||
+        MatchByteOps(src, load, ops, nodes) == false)
+      return false;
+    ops.push_back({OpKind::kRotl, amount});
+    nodes.append(rotate_nodes.begin(), rotate_nodes.end());
+    nodes.push_back(bin_op);
+    return true;
+  }
+
+  // Everything else is add/sub/xor with a constant
+  unsigned var_idx = isa<ConstantInt>(bin_op->getOperand(0)) ? 1 : 0;
+  auto* constant = dyn_cast<ConstantInt>(bin_op->getOperand(1 - var_idx));
+  if (constant == nullptr) return false;
+  auto imm = uint8_t(constant->getValue().trunc(8).getZExtValue());
+
+  switch (bin_op->getOpcode()) {
+    case Instruction::Add: {
+      if (MatchByteOps(bin_op->getOperand(var_idx), load, ops, nodes) == false)
+        return false;
+      ops.push_back({OpKind::kAdd, imm});
+      break;
+    }
+    case Instruction::Sub: {
+      if (MatchByteOps(bin_op->getOperand(var_idx), load, ops, nodes) == false)
+        return false;
+      if (var_idx == 0) {
+        // b - k
+        ops.push_back({OpKind::kAdd, uint8_t(-imm)});
+      } else {
+        // k - b = ~b + 1 + k
+        ops.push_back({OpKind::kXor, 0xff});
+        ops.push_back({OpKind::kAdd, uint8_t(imm + 1)});
+      }
+      break;
+    }
+    case Instruction::Xor: {
+      if (MatchByteOps(bin_op->getOperand(var_idx), load, ops, nodes) == false)
+        return false;
+      ops.push_back({OpKind::kXor, imm});
+      break;
+    }
+    default: {
+      return false;
+    }
+  }
+  nodes.push_back(bin_op);
+  return true;
+}
+
+bool byte_update::MatchByteUpdate(StoreInst* store,
+                                  const DataLayout& data_layout,
+                                  ByteUpdate& update) {
+  update = ByteUpdate();
+  update.store = store;
+  if (store->isSimple() == false ||
+      store->getValueOperand()->getType()->isIntegerTy(8) == false ||
+      MatchByteOps(store->getValueOperand(), update.load, update.ops,
+                   update.nodes) == false)
+    return false;
+
+  // The load must reach the store without any write in between
+  auto* load = update.load;
+  if (load->getParent() != store->getParent()) return false;
+  auto iter = std::next(load->getIterator());
+  for (; iter != load->getParent()->end() && &*iter != store; ++iter) {
+    if (iter->mayWriteToMemory()) return false;
+  }
+  if (iter == load->getParent()->end()) return false;
+
+  int64_t load_offset = 0;
+  auto* load_base = GetPointerBaseWithConstantOffset(
+      load->getPointerOperand(), load_offset, data_layout);
+  update.base = GetPointerBaseWithConstantOffset(store->getPointerOperand(),
+                                                 update.offset, data_layout);
+  if (load_base != update.base || load_offset != update.offset) return false;
+
+  Simplify(update.ops);
+  return true;
+}
+
+bool byte_update::IsSelfContained(const ByteUpdate& update) {
+  SmallPtrSet<Instruction*, 8> nodes(update.nodes.begin(), update.nodes.end());
+  nodes.insert(update.store);
+  for (auto* node : update.nodes) {
+    for (auto* user : node->users()) {
+      if (nodes.count(cast<Instruction>(user)) == 0) return false;
+    }
+  }
+  return true;
+}
+
+void byte_update::Erase(ArrayRef<ByteUpdate> updates) {
+  // Updates may share address computations, hence the handles
+  std::vector<WeakTrackingVH> dead_values;
+  for (const auto& update : updates) {
+    dead_values.emplace_back(update.store->getValueOperand());
+    dead_values.emplace_back(update.store->getPointerOperand());
+    update.store->eraseFromParent();
+  }
+  for (auto& value : dead_values) {
+    if (value != nullptr) RecursivelyDeleteTriviallyDeadInstructions(value);
+  }
+}
+
+void byte_update::Simplify(ByteOps& ops) {
+  ByteOps simplified;
+  for (auto op : ops) {
+    if (op.kind == OpKind::kRotl) op.imm %= 8;
+    if (simplified.empty() == false && simplified.back().kind == op.kind) {
+      auto& last = simplified.back();
+      switch (op.kind) {
+        case OpKind::kAdd: {
+          last.imm += op.imm;
+          break;
+        }
+        case OpKind::kXor: {
+          last.imm ^= op.imm;
+          break;
+        }
+        case OpKind::kRotl: {
+          last.imm = (last.imm + op.imm) % 8;
+          break;
+        }
+      }
+      if (last.imm == 0) simplified.pop_back();
+    } else if (op.imm != 0) {
+      simplified.push_back(op);
+    }
+  }
+  ops = std::move(simplified);
+}
+
+ByteOps byte_update::Invert(ArrayRef<ByteOp> ops) {
+  ByteOps inverse;
+  for (auto op : reverse(ops)) {
+    switch (op.kind) {
+      case OpKind::kAdd: {
+        inverse.push_back({OpKind::kAdd, uint8_t(-op.imm)});
+        break;
+      }
+      case OpKind::kXor: {
+        inverse.push_back(op);
+        break;
+      }
+      case OpKind::kRotl: {
+        inverse.push_back({OpKind::kRotl, uint8_t((8 - op.imm % 8) % 8)});
+        break;
+      }
+    }
+  }
+  return inverse;
+}
+
+uint8_t byte_update::Apply(ArrayRef<ByteOp> ops, uint8_t byte) {
+  for (auto op : ops) {
+    switch (op.kind) {
+      case OpKind::kAdd: {
+        byte += op.imm;
+        break;
+      }
+      case OpKind::kXor: {
+        byte ^= op.imm;
+        break;
+      }
+      case OpKind::kRotl: {
+        unsigned amount = op.imm % 8;
+        if (amount != 0) byte = (byte << amount) | (byte >> (8 - amount));
+        break;
+      }
+    }
+  }
+  return byte;
+}
+
+// Returns the shortest sequence having both `a` and `b` as subsequences
+static SmallVector<OpKind, 4> MergeKinds(ArrayRef<OpKind> a,
+                                         ArrayRef<OpKind> b) {
+  // len[i][j]: length of the shortest merge of a[i:] and b[j:]
+  std::vector<std::vector<unsigned>> len(a.size() + 1,
+                                         std::vector<unsigned>(b.size() + 1));
+  for (size_t i = a.size() + 1; i-- > 0;) {
+    for (size_t j = b.size() + 1; j-- > 0;) {
+      if (i == a.size() || j == b.size())
+        len[i][j] = (a.size() - i) + (b.size() - j);
+      else if (a[i] == b[j])
+        len[i][j] = 1 + len[i + 1][j + 1];
+      else
+        len[i][j] = 1 + std::min(len[i + 1][j], len[i][j + 1]);
+    }
+  }
+
+  SmallVector<OpKind, 4> merged;
+  size_t i = 0, j = 0;
+  while (i < a.size() || j < b.size()) {
+    if (i == a.size()) {
+      merged.push_back(b[j++]);
+    } else if (j == b.size()) {
+      merged.push_back(a[i++]);
+    } else if (a[i] == b[j]) {
+      merged.push_back(a[i++]);
+      ++j;
+    } else if (len[i + 1][j] <= len[i][j + 1]) {
+      merged.push_back(a[i++]);
+    } else {
+      merged.push_back(b[j++]);
+    }
+  }
+  return merged;
+}
+
+Stages byte_update::BuildStages(ArrayRef<ByteOps> lanes) {
+  Stages stages;
+  stages.num_lanes = lanes.size();
+  for (const auto& lane : lanes) {
+    SmallVector<OpKind, 4> kinds;
+    for (auto op : lane) kinds.push_back(op.kind);
+    stages.kinds = MergeKinds(stages.kinds, kinds);
+  }
+
+  stages.imms.assign(stages.kinds.size(), std::vector<uint8_t>(lanes.size()));
+  for (size_t lane = 0; lane < lanes.size(); ++lane) {
+    // Every lane is a subsequence of the stages, so the leftmost embedding
+    // always succeeds
+    size_t stage = 0;
+    for (auto op : lanes[lane]) {
+      while (stages.kinds[stage] != op.kind) ++stage;
+      stages.imms[stage++][lane] = op.imm;
+    }
+  }
+  return stages;
+}
+
+bool byte_update::IsIdentity(const Stages& stages, unsigned first_lane,
+                             unsigned num_lanes) {
+  for (const auto& imms : stages.imms) {
+    if (std::any_of(imms.begin() + first_lane,
+                    imms.begin() + first_lane + num_lanes,
+                    [](uint8_t imm) { return imm != 0; }))
+      return false;
+  }
+  return true;
+}
+
+Value* byte_update::CreateStages(IRBuilder<>& builder, Value* value,
+                                 const Stages& stages, unsigned first_lane,
+                                 unsigned num_lanes) {
+  for (size_t i = 0; i < stages.kinds.size(); ++i) {
+    auto imms = makeArrayRef(stages.imms[i]).slice(first_lane, num_lanes);
+    if (std::all_of(imms.begin(), imms.end(),
+                    [](uint8_t imm) { return imm == 0; }))
+      continue;
+
+    Value* imm = num_lanes == 1
+                     ? static_cast<Value*>(builder.getInt8(imms[0]))
+                     : ConstantDataVector::get(builder.getContext(), imms);
+    switch (stages.kinds[i]) {
+      case OpKind::kAdd: {
+        value = builder.CreateAdd(value, imm);
+        break;
+      }
+      case OpKind::kXor: {
+        value = builder.CreateXor(value, imm);
+        break;
+      }
+      case OpKind::kRotl: {
+        // A funnel shift of a value with itself is a rotation, with a
+        // per-lane amount for vectors
+        auto* fshl = Intrinsic::getDeclaration(
+            builder.GetInsertBlock()->getModule(), Intrinsic::fshl,
+            {value->getType()});
+        value = builder.CreateCall(fshl, {value, value, imm});
+        break;
+      }
+    }
+  }
+  return value;
+}
+
+unsigned byte_update::CreateChunks(IRBuilder<>& builder, Value* ptr,
+                                   const Stages& stages, unsigned max_width) {
+  unsigned num_chunks = 0;
+  for (unsigned lane = 0; lane < stages.num_lanes;) {
+    // The widest chunk that fits, so that the tail takes a few narrower ones
+    unsigned width = max_width;
+    while (width > stages.num_lanes - lane) width /= 2;
+
+    if (IsIdentity(stages, lane, width) == false) {
+      Type* ty = builder.getInt8Ty();
+      if (width > 1) ty = VectorType::get(ty, width, /*Scalable=*/false);
+      auto* chunk_ptr = lane == 0 ? ptr
+                                  : builder.CreateConstInBoundsGEP1_64(
+                                        builder.getInt8Ty(), ptr, lane);
+      chunk_ptr = builder.CreatePointerCast(chunk_ptr, ty->getPointerTo());
+      Value* value = builder.CreateAlignedLoad(ty, chunk_ptr, MaybeAlign(1));
+      value = CreateStages(builder, value, stages, lane, width);
+      builder.CreateAlignedStore(value, chunk_ptr, MaybeAlign(1));
+      ++num_chunks;
+    }
+    lane += width;
+  }
+  return num_chunks;
+}
@@ -0,0 +1,98 @@
+#ifndef BYTE_UPDATE_H_
+#define BYTE_UPDATE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"     // ConstantInt, ConstantDataVector
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/IRBuilder.h"     // IRBuilder
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"  // IntrinsicInst
+
+// Recognizes statements such as `buf[3] = buf[3] + 7` that update a single
+// byte in place with a bijection built from constant add/sub/xor/rotate, and
+// builds lane-wise vector code applying such bijections to runs of bytes.
+namespace byte_update {
+
+enum class OpKind : uint8_t {
+  kAdd,   // b + imm (mod 256), which also covers sub
+  kXor,   // b ^ imm
+  kRotl,  // b rotated left by imm (mod 8)
+};
+
+// An operation of kind `kind` on a byte. `imm` == 0 is the identity for every
+// kind.
+struct ByteOp {
+  OpKind kind;
+  uint8_t imm;
+};
+
+using ByteOps = llvm::SmallVector<ByteOp, 4>;
+
+// `store i8 f(load i8 ptr), ptr` where `ptr` is `base + offset`
+struct ByteUpdate {
+  llvm::LoadInst* load = nullptr;
+  llvm::StoreInst* store = nullptr;
+  llvm::Value* base = nullptr;
+  int64_t offset = 0;
+  // f, as operations applied in order
+  ByteOps ops;
+  // The instructions computing the stored value, `load` first
+  llvm::SmallVector<llvm::Instruction*, 8> nodes;
+};
+
+// Matches `store` against an in-place byte update. Both the load and the store
+// must be simple, in the same basic block, and nothing in between may write to
+// memory.
+bool MatchByteUpdate(llvm::StoreInst* store, const llvm::DataLayout& data_layout,
+                     ByteUpdate& update);
+
+// Whether the nodes of `update` are only used by the update itself, so that
+// it can be moved or deleted as a whole.
+bool IsSelfContained(const ByteUpdate& update);
+// Erases the stores of `updates` and the instructions left dead.
+void Erase(llvm::ArrayRef<ByteUpdate> updates);
+
+// Matches `value` against `ops` applied to a loaded i8 (`load`). The value may
+// be computed in wider types: add/sub/xor never carry from high bits to low
+// ones, and rotations are recognized on a zero-extended byte.
+bool MatchByteOps(llvm::Value* value, llvm::LoadInst*& load, ByteOps& ops,
+                  llvm::SmallVectorImpl<llvm::Instruction*>& nodes);
+
+// Folds adjacent operations of the same kind and drops identities.
+void Simplify(ByteOps& ops);
+// Returns the operations undoing `ops`.
+ByteOps Invert(llvm::ArrayRef<ByteOp> ops);
+uint8_t Apply(llvm::ArrayRef<ByteOp> ops, uint8_t byte);
+
+// Operations on consecutive bytes (lanes), aligned so that every stage can be
+// done by a single vector instruction: stage `i` applies `kinds[i]` with
+// `imms[i][lane]` to every lane. Lanes that lack a stage get its identity.
+struct Stages {
+  unsigned num_lanes = 0;
+  llvm::SmallVector<OpKind, 4> kinds;
+  std::vector<std::vector<uint8_t>> imms;
+};
+
+Stages BuildStages(llvm::ArrayRef<ByteOps> lanes);
+
+// Whether lanes [first_lane, first_lane + num_lanes) are left unchanged
+bool IsIdentity(const Stages& stages, unsigned first_lane, unsigned num_lanes);
+// Applies lanes [first_lane, first_lane + num_lanes) of `stages` to `value`,
+// an i8 if `num_lanes` is 1, a <num_lanes x i8> otherwise.
+llvm::Value* CreateStages(llvm::IRBuilder<>& builder, llvm::Value* value,
+                          const Stages& stages, unsigned first_lane,
+                          unsigned num_lanes);
+
+// Loads, applies `stages` to and stores back the bytes starting at `ptr` (an
+// i8*), in chunks of at most `max_width` bytes (a power of two). Chunks left
+// unchanged are skipped. Returns the number of chunks created.
+unsigned CreateChunks(llvm::IRBuilder<>& builder, llvm::Value* ptr,
+                      const Stages& stages, unsigned max_width);
+
+}  // namespace byte_update
+
+#endif  // BYTE_UPDATE_H_
@@ -0,0 +1,201 @@
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/ValueTracking.h"  // GetPointerBaseWithConstantOffset
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"       // parseIRFile
+#include "llvm/Support/CommandLine.h"     // cl::opt
+#include "llvm/Support/MathExtras.h"      // isPowerOf2_32
+#include "llvm/Support/SourceMgr.h"       // SMDiagnostic
+
+#include "byte_update.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
+#include "common/function_filter.h"
+
+using namespace llvm;
+
+static cl::opt<std::string> filter(
+    "filter", cl::desc("Only invert the functions matching this regex"),
+    cl::value_desc("regex"));
+static cl::opt<std::string> filter_list(
+    "filter-list", cl::desc("Only invert the functions listed in this file"),
+    cl::value_desc("file"));
+static cl::opt<unsigned> vector_width(
+    "vector-width",
+    cl::desc("Bytes processed per instruction by the inverse (a power of two)"),
+    cl::init(16));
+static cl::opt<bool> decode_in_place(
+    "in-place",
+    cl::desc("Also turn every inverted function into its own decoder, by "
+             "replacing its byte updates with a call to the inverse"),
+    cl::init(false));
+
+// Derives the inverse of the byte transformation done by `func` and emits it
+// as `void <func>_inverse(i8* base)`. Returns false if `func` transforms no
+// bytes or can't be inverted.
+bool RunOnFunction(Function& func);
+void RunOnModule(Module& module, const common::FunctionFilter& filter);
+
+int main(int argc, char** argv) {
+  common::Driver driver(argc, argv,
+                        "Emits the inverse of byte-stream transformations\n");
+  if (isPowerOf2_32(vector_width) == false) {
+    errs() << "-vector-width must be a power of two\n";
+    return 1;
+  }
+  common::FunctionFilter function_filter;
+  if (function_filter.Init(filter, filter_list) == false) return 1;
+
+  return driver.Run("codec_inverse", [&](Module& module) {
+    RunOnModule(module, function_filter);
+    return true;
+  });
+}
+
+void RunOnModule(Module& module, const common::FunctionFilter& filter) {
+  // Collect the functions first: every inverse adds a new one
+  std::vector<Function*> funcs;
+  for (auto& func : module) {
+    if (filter.Matches(func)) funcs.push_back(&func);
+  }
+  for (auto* func : funcs) {
+    common::ScopedEvent event("codec_inverse", *func);
+    RunOnFunction(*func);
+  }
+}
+
+bool RunOnFunction(Function& func) {
+  auto& module = *func.getParent();
+  const auto& data_layout = module.getDataLayout();
+
+  // STEP 1: Collect the byte updates, in program order
+  std::vector<byte_update::ByteUpdate> updates;
+  for (auto& basic_block : func) {
+    for (auto& inst : basic_block) {
+      auto* store = dyn_cast<StoreInst>(&inst);
+      byte_update::ByteUpdate update;
+      if (store != nullptr &&
+          byte_update::MatchByteUpdate(store, data_layout, update))
+        updates.push_back(std::move(update));
+    }
+  }
+  if (updates.empty()) return false;
+
+  // STEP 2: Make sure they form a single transformation of a buffer: one
+  // base, one basic block, and no other writes to memory from the first
+  // update to the last one
+  auto* base = updates.front().base;
+  auto* basic_block = updates.front().store->getParent();
+  for (const auto& update : updates) {
+    if (update.base != base || update.store->getParent() != basic_block) {
+      errs() << "codec_inverse '" << func.getName()
+             << "': byte updates span several buffers or basic blocks\n";
+      return false;
+    }
+  }
+
+  SmallPtrSet<Instruction*, 32> update_nodes;
+  for (const auto& update : updates) {
+    update_nodes.insert(update.nodes.begin(), update.nodes.end());
+    update_nodes.insert(update.store);
+  }
+  // Every load precedes its store, so the first update starts with a load
+  auto iter = basic_block->begin();
+  while (isa<LoadInst>(*iter) == false || update_nodes.count(&*iter) == 0)
+    ++iter;
+  for (auto end = std::next(updates.back().store->getIterator()); iter != end;
+       ++iter) {
+    if (isa<StoreInst>(*iter) && update_nodes.count(&*iter) != 0) continue;
+    if (iter->mayWriteToMemory()) {
+      errs() << "codec_inverse '" << func.getName()
+             << "': memory is written in between byte updates: " << *iter
+             << "\n";
+      return false;
+    }
+    // The decoder runs in place of the last update, so the bytes must not
+    // be read in between either
+    auto* load = dyn_cast<LoadInst>(&*iter);
+    int64_t offset = 0;
+    if (decode_in_place && load != nullptr && update_nodes.count(load) == 0 &&
+        GetPointerBaseWithConstantOffset(load->getPointerOperand(), offset,
+                                         data_layout) == base) {
+      errs() << "codec_inverse '" << func.getName()
+             << "': the buffer is read in between byte updates: " << *iter
+             << "\n";
+      return false;
+    }
+  }
+
+  // STEP 3: Compose the updates of every byte and invert them
+  int64_t min_offset = updates.front().offset, max_offset = min_offset;
+  for (const auto& update : updates) {
+    min_offset = std::min(min_offset, update.offset);
+    max_offset = std::max(max_offset, update.offset);
+  }
+  std::vector<byte_update::ByteOps> lanes(max_offset - min_offset + 1);
+  for (const auto& update : updates) {
+    auto& lane = lanes[update.offset - min_offset];
+    lane.append(update.ops.begin(), update.ops.end());
+  }
+  for (auto& lane : lanes) {
+    byte_update::Simplify(lane);
+    lane = byte_update::Invert(lane);
+  }
+  auto stages = byte_update::BuildStages(lanes);
+
+  // STEP 4: Emit the inverse, a few vector instructions per `vector_width`
+  // bytes
+  // Callers may already declare it
+  std::string name = (func.getName() + "_inverse").str();
+  auto& ctx = module.getContext();
+  auto* inverse_type = FunctionType::get(
+      Type::getVoidTy(ctx), {Type::getInt8PtrTy(ctx)}, /*isVarArg=*/false);
+  auto* inverse = module.getFunction(name);
+  if (inverse == nullptr) {
+    inverse = Function::Create(inverse_type, GlobalValue::ExternalLinkage, name,
+                               &module);
+  } else if (inverse->isDeclaration() == false ||
+             inverse->getFunctionType() != inverse_type) {
+    errs() << "codec_inverse '" << func.getName() << "': " << name
+           << " already exists\n";
+    return false;
+  }
+  inverse->addFnAttr(Attribute::NoUnwind);
+  auto* arg = &*inverse->arg_begin();
+  arg->setName("base");
+
+  IRBuilder<> builder(BasicBlock::Create(ctx, "entry", inverse));
+  Value* ptr = arg;
+  if (min_offset != 0)
+    ptr = builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), arg,
+                                             min_offset);
+  unsigned num_chunks =
+      byte_update::CreateChunks(builder, ptr, stages, vector_width);
+  builder.CreateRetVoid();
+
+  errs() << "codec_inverse '" << func.getName() << "': inverted "
+         << updates.size() << " byte updates of bytes [" << min_offset << ", "
+         << max_offset << "] in " << stages.kinds.size() << " stages, "
+         << num_chunks << " chunks -> " << name << "\n";
+  if (decode_in_place == false) return true;
+
+  // STEP 5: Turn `func` into the decoder: the nodes of the updates must not
+  // be used elsewhere, since they're deleted
+  for (const auto& update : updates) {
+    if (byte_update::IsSelfContained(update) == false) {
+      errs() << "codec_inverse '" << func.getName()
+             << "': cannot decode in place, " << *update.store
+             << " depends on values used elsewhere\n";
+      return true;
+    }
+  }
+
+  builder.SetInsertPoint(updates.back().store);
+  builder.CreateCall(inverse,
+                     {builder.CreatePointerCast(base, builder.getInt8PtrTy())});
+  byte_update::Erase(updates);
+  return true;
+}
@@ -0,0 +1,395 @@
+#include "common/analysis_cache.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Statistic.h"         // AreStatisticsEnabled
+#include "llvm/ADT/StringExtras.h"      // toHex
+#include "llvm/IR/DebugInfoMetadata.h"  // DILocation
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"           // GEPOperator
+#include "llvm/Support/CommandLine.h"   // cl::opt
+#include "llvm/Support/FileSystem.h"    // createUniqueFile, rename
+#include "llvm/Support/LEB128.h"        // encodeULEB128
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"          // sys::path::parent_path
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace {
+
+cl::opt<std::string> analysis_cache(
+    "analysis-cache",
+    cl::desc("Keep the results of every function in this index, and only "
+             "analyze the functions that changed since"),
+    cl::value_desc("file"));
+
+constexpr char kMagic[] = "llvm-tutor-analysis-cache";
+// Entries unused for more runs than this are dropped
+constexpr uint64_t kMaxUnusedRuns = 16;
+
+// Writes what the analyses can see of a function, in a compact binary form
+// that only depends on the function: its values are numbered within it,
+// types and constants are written in full where they first appear and by
+// number after that. Metadata attached to instructions is left out, except
+// for the contents of their debug location.
+class FunctionEncoder {
+ public:
+  FunctionEncoder(raw_ostream& out,
+                  function_ref<unsigned(const GlobalValue&)> unnamed_number)
+      : out_(out), unnamed_number_(unnamed_number) {}
+
+  void Encode(const Function& func);
+
+ private:
+  enum Tag : uint8_t {
+    kNull,
+    kLocal,
+    kConstant,
+    kMetadata,
+    kInlineAsm,
+    kNew,
+    kSeen,
+  };
+
+  void Write(uint64_t number) { encodeULEB128(number, out_); }
+  void Write(StringRef text) {
+    Write(text.size());
+    out_ << text;
+  }
+  void Write(const APInt& value) {
+    Write(value.getBitWidth());
+    for (unsigned i = 0; i < value.getNumWords(); ++i)
+      Write(value.getRawData()[i]);
+  }
+  void Write(Type* type);
+  void Write(const Constant* constant);
+  void Write(const Value* value);
+  void Write(const Metadata* metadata);
+  void Write(const DILocation* location);
+  void Write(const Instruction& inst);
+
+  raw_ostream& out_;
+  function_ref<unsigned(const GlobalValue&)> unnamed_number_;
+  // Arguments, basic blocks and instructions
+  DenseMap<const Value*, unsigned> locals_;
+  DenseMap<Type*, unsigned> types_;
+  DenseMap<const Constant*, unsigned> constants_;
+};
+
+void FunctionEncoder::Encode(const Function& func) {
+  for (const auto& arg : func.args()) locals_.try_emplace(&arg, locals_.size());
+  for (const auto& basic_block : func) {
+    locals_.try_emplace(&basic_block, locals_.size());
+    for (const auto& inst : basic_block)
+      locals_.try_emplace(&inst, locals_.size());
+  }
+
+  Write(func.getName());
+  Write(func.getFunctionType());
+  Write(func.getCallingConv());
+  for (const auto& arg : func.args()) Write(arg.getName());
+  for (const auto& basic_block : func) {
+    Write(basic_block.getName());
+    Write(basic_block.size());
+    for (const auto& inst : basic_block) Write(inst);
+  }
+}
+
+void FunctionEncoder::Write(Type* type) {
+  auto it = types_.find(type);
+  if (it != types_.end()) {
+    Write(kSeen);
+    Write(it->second);
+    return;
+  }
+  types_.try_emplace(type, types_.size());
+  Write(kNew);
+  // As printed: a handful of types per function, and named structs by name
+  std::string text;
+  raw_string_ostream type_out(text);
+  type->print(type_out);
+  Write(type_out.str());
+}
+
+void FunctionEncoder::Write(const Constant* constant) {
+  auto it = constants_.find(constant);
+  if (it != constants_.end()) {
+    Write(kSeen);
+    Write(it->second);
+    return;
+  }
+  constants_.try_emplace(constant, constants_.size());
+  Write(kNew);
+  Write(constant->getValueID());
+  Write(constant->getType());
+  Write(constant->getRawSubclassOptionalData());
+  if (auto* global = dyn_cast<GlobalValue>(constant)) {
+    Write(global->getName());
+    if (global->hasName() == false) Write(unnamed_number_(*global));
+  } else if (auto* constant_int = dyn_cast<ConstantInt>(constant)) {
+    Write(constant_int->getValue());
+  } else if (auto* constant_fp = dyn_cast<ConstantFP>(constant)) {
+    Write(constant_fp->getValueAPF().bitcastToAPInt());
+  } else if (auto* data = dyn_cast<ConstantDataSequential>(constant)) {
+    Write(data->getRawDataValues());
+  } else if (auto* address = dyn_cast<BlockAddress>(constant)) {
+    Write(address->getFunction());
+    unsigned index = 0;
+    for (const auto& basic_block : *address->getFunction()) {
+      if (&basic_block == address->getBasicBlock()) break;
+      ++index;
+    }
+    Write(index);
+  } else {
+    if (auto* expr = dyn_cast<ConstantExpr>(constant)) {
+      Write(expr->getOpcode());
+      if (expr->isCompare()) Write(expr->getPredicate());
+      if (auto* gep = dyn_cast<GEPOperator>(expr))
+        Write(gep->getSourceElementType());
+      if (expr->hasIndices()) {
+        for (auto index : expr->getIndices()) Write(index);
+      }
+    }
+    Write(constant->getNumOperands());
+    for (const auto& operand : constant->operands())
+      Write(cast<Constant>(operand));
+  }
+}
+
+void FunctionEncoder::Write(const Value* value) {
+  if (value == nullptr) {
+    Write(kNull);
+  } else if (auto* constant = dyn_cast<Constant>(value)) {
+    Write(kConstant);
+    Write(constant);
+  } else if (auto* as_metadata = dyn_cast<MetadataAsValue>(value)) {
+    Write(kMetadata);
+    Write(as_metadata->getMetadata());
+  } else if (auto* inline_asm = dyn_cast<InlineAsm>(value)) {
+    Write(kInlineAsm);
+    Write(inline_asm->getFunctionType());
+    Write(inline_asm->getAsmString());
+    Write(inline_asm->getConstraintString());
+    Write(inline_asm->hasSideEffects() | inline_asm->isAlignStack() << 1 |
+          inline_asm->getDialect() << 2);
+  } else {
+    Write(kLocal);
+    Write(locals_.lookup(value));
+  }
+}
+
+void FunctionEncoder::Write(const Metadata* metadata) {
+  // Operands of intrinsics such as llvm.dbg.value. Nodes are numbered
+  // module-wide, so only their kind is written.
+  Write(metadata->getMetadataID());
+  if (auto* local = dyn_cast<LocalAsMetadata>(metadata))
+    Write(local->getValue());
+  else if (auto* constant = dyn_cast<ConstantAsMetadata>(metadata))
+    Write(constant->getValue());
+  else if (auto* text = dyn_cast<MDString>(metadata))
+    Write(text->getString());
+}
+
+void FunctionEncoder::Write(const DILocation* location) {
+  for (; location != nullptr; location = location->getInlinedAt()) {
+    Write(location->getLine());
+    Write(location->getColumn());
+    Write(location->getScope()->getName());
+  }
+  Write(uint64_t(0));
+}
+
+void FunctionEncoder::Write(const Instruction& inst) {
+  Write(inst.getOpcode());
+  Write(inst.getType());
+  Write(inst.getName());
+  Write(inst.getRawSubclassOptionalData());
+  Write(inst.getNumOperands());
+  for (const auto& operand : inst.operands()) Write(operand.get());
+
+  if (auto* cmp = dyn_cast<CmpInst>(&inst)) {
+    Write(cmp->getPredicate());
+  } else if (auto* gep = dyn_cast<GetElementPtrInst>(&inst)) {
+    Write(gep->getSourceElementType());
+  } else if (auto* alloca = dyn_cast<AllocaInst>(&inst)) {
+    Write(alloca->getAllocatedType());
+    Write(alloca->getAlignment());
+  } else if (auto* load = dyn_cast<LoadInst>(&inst)) {
+    Write(load->isVolatile());
+    Write(load->getAlignment());
+    Write(unsigned(load->getOrdering()));
+    Write(load->getSyncScopeID());
+  } else if (auto* store = dyn_cast<StoreInst>(&inst)) {
+    Write(store->isVolatile());
+    Write(store->getAlignment());
+    Write(unsigned(store->getOrdering()));
+    Write(store->getSyncScopeID());
+  } else if (auto* call = dyn_cast<CallBase>(&inst)) {
+    Write(call->getFunctionType());
+    Write(call->getCallingConv());
+    if (auto* call_inst = dyn_cast<CallInst>(call))
+      Write(call_inst->getTailCallKind());
+  } else if (auto* phi = dyn_cast<PHINode>(&inst)) {
+    for (const auto* basic_block : phi->blocks()) Write(basic_block);
+  } else if (auto* extract = dyn_cast<ExtractValueInst>(&inst)) {
+    for (auto index : extract->indices()) Write(index);
+  } else if (auto* insert = dyn_cast<InsertValueInst>(&inst)) {
+    for (auto index : insert->indices()) Write(index);
+  } else if (auto* shuffle = dyn_cast<ShuffleVectorInst>(&inst)) {
+    SmallVector<int, 16> mask;
+    shuffle->getShuffleMask(mask);
+    for (int element : mask) Write(uint32_t(element));
+  } else if (auto* rmw = dyn_cast<AtomicRMWInst>(&inst)) {
+    Write(rmw->getOperation());
+    Write(rmw->isVolatile());
+    Write(unsigned(rmw->getOrdering()));
+    Write(rmw->getSyncScopeID());
+  } else if (auto* cmpxchg = dyn_cast<AtomicCmpXchgInst>(&inst)) {
+    Write(cmpxchg->isVolatile() | cmpxchg->isWeak() << 1);
+    Write(unsigned(cmpxchg->getSuccessOrdering()));
+    Write(unsigned(cmpxchg->getFailureOrdering()));
+    Write(cmpxchg->getSyncScopeID());
+  } else if (auto* fence = dyn_cast<FenceInst>(&inst)) {
+    Write(unsigned(fence->getOrdering()));
+    Write(fence->getSyncScopeID());
+  } else if (auto* landing_pad = dyn_cast<LandingPadInst>(&inst)) {
+    Write(landing_pad->isCleanup());
+  }
+  Write(inst.getDebugLoc().get());
+}
+
+}  // namespace
+
+common::AnalysisCache::AnalysisCache(StringRef tool_name)
+    : tool_name_(tool_name), path_(analysis_cache) {
+  if (enabled()) Load();
+}
+
+common::AnalysisCache::~AnalysisCache() {
+  if (enabled() == false) return;
+  Save();
+  if (AreStatisticsEnabled())
+    errs() << "Analysis cache: " << num_hits_ << " hits, " << num_misses_
+           << " misses\n";
+}
+
+std::string common::AnalysisCache::GetOrCompute(
+    const Function& func, function_ref<std::string()> compute) {
+  if (enabled() == false || func.isDeclaration()) return compute();
+
+  auto key = Hash(func);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    ++num_hits_;
+    it->second.last_run = run_;
+    return it->second.result;
+  }
+  ++num_misses_;
+  auto result = compute();
+  entries_[key] = Entry{result, run_};
+  return result;
+}
+
+std::string common::AnalysisCache::Hash(const Function& func) {
+  SmallString<4096> encoding;
+  raw_svector_ostream out(encoding);
+  FunctionEncoder(out, [&](const GlobalValue& global) {
+    return GetUnnamedGlobalNumber(global);
+  }).Encode(func);
+  SHA1 hasher;
+  hasher.update(encoding.str());
+  return toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+unsigned common::AnalysisCache::GetUnnamedGlobalNumber(
+    const GlobalValue& global) {
+  // In the order of the slots of the printer, which names them @<number>
+  if (unnamed_globals_module_ != global.getParent()) {
+    unnamed_globals_.clear();
+    unnamed_globals_module_ = global.getParent();
+    auto number = [&](const GlobalValue& value) {
+      if (value.hasName() == false)
+        unnamed_globals_.try_emplace(&value, unnamed_globals_.size());
+    };
+    for (const auto& value : unnamed_globals_module_->globals()) number(value);
+    for (const auto& value : unnamed_globals_module_->aliases()) number(value);
+    for (const auto& value : unnamed_globals_module_->ifuncs()) number(value);
+    for (const auto& value : *unnamed_globals_module_) number(value);
+  }
+  return unnamed_globals_.lookup(&global);
+}
+
+void common::AnalysisCache::Load() {
+  // A missing index is an empty one
+  auto buffer = MemoryBuffer::getFile(path_);
+  if (!buffer) return;
+
+  // "<magic> <tool> <run>", then per entry "<key> <last run> <size>" and the
+  // result on the next <size> bytes
+  StringRef contents = (*buffer)->getBuffer();
+  StringRef header;
+  std::tie(header, contents) = contents.split('\n');
+  SmallVector<StringRef, 3> fields;
+  header.split(fields, ' ');
+  uint64_t last_run = 0;
+  if (fields.size() != 3 || fields[0] != kMagic ||
+      fields[2].getAsInteger(10, last_run)) {
+    errs() << path_ << " is not an analysis cache, ignored\n";
+    return;
+  }
+  if (fields[1] != tool_name_) {
+    errs() << path_ << " holds results of " << fields[1] << ", not "
+           << tool_name_ << ", ignored\n";
+    return;
+  }
+  run_ = last_run + 1;
+
+  while (contents.empty() == false) {
+    StringRef line;
+    std::tie(line, contents) = contents.split('\n');
+    fields.clear();
+    line.split(fields, ' ');
+    uint64_t entry_run = 0;
+    size_t size = 0;
+    if (fields.size() != 3 || fields[1].getAsInteger(10, entry_run) ||
+        fields[2].getAsInteger(10, size) || size > contents.size()) {
+      errs() << path_ << " is truncated, the rest is ignored\n";
+      return;
+    }
+    if (run_ - entry_run <= kMaxUnusedRuns)
+      entries_[fields[0]] = Entry{contents.substr(0, size).str(), entry_run};
+    contents = contents.drop_front(size).drop_front(1);
+  }
+}
+
+bool common::AnalysisCache::Save() const {
+  // Written next to the index, then renamed over it, so that a reader never
+  // sees half an index
+  SmallString<128> temp_path;
+  int fd;
+  auto dir = sys::path::parent_path(path_);
+  if (std::error_code ec = sys::fs::createUniqueFile(
+          (dir.empty() ? "." : dir) + "/.analysis-cache-%%%%%%", fd,
+          temp_path)) {
+    errs() << "Cannot write the analysis cache: " << ec.message() << "\n";
+    return false;
+  }
+  {
+    raw_fd_ostream out(fd, /*shouldClose=*/true);
+    out << kMagic << " " << tool_name_ << " " << run_ << "\n";
+    for (const auto& entry : entries_) {
+      out << entry.getKey() << " " << entry.second.last_run << " "
+          << entry.second.result.size() << "\n"
+          << entry.second.result << "\n";
+    }
+  }
+  if (std::error_code ec = sys::fs::rename(temp_path, path_)) {
+    errs() << "Cannot write " << path_ << ": " << ec.message() << "\n";
+    sys::fs::remove(temp_path);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,75 @@
+#ifndef COMMON_ANALYSIS_CACHE_H_
+#define COMMON_ANALYSIS_CACHE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"  // function_ref
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+
+namespace common {
+
+// The results of an analysis per function, kept across runs in the index
+// file given with -analysis-cache. A result is keyed by a hash of the
+// structure of its function (names, types, opcodes, operands and constants,
+// not the metadata attached to instructions), so a function that didn't
+// change since a run that analyzed it isn't analyzed again:
+//
+//   void RunOnModule(llvm::Module& module) {
+//     common::AnalysisCache cache("something");
+//     for (auto& func : module)
+//       llvm::errs() << cache.GetOrCompute(func, [&] { return Analyze(func); });
+//   }
+//
+// Results are text, usually what the tool prints for the function, and only
+// depend on the function. Metadata numbers they print, e.g. those of !dbg, are
+// those of the run that computed them. Entries that no run used for a while are dropped.
+// Without -analysis-cache, everything is computed.
+class AnalysisCache {
+ public:
+  // Loads the index, if its results are those of `tool_name`
+  explicit AnalysisCache(llvm::StringRef tool_name);
+  // Writes the index back
+  ~AnalysisCache();
+
+  AnalysisCache(const AnalysisCache&) = delete;
+  AnalysisCache& operator=(const AnalysisCache&) = delete;
+
+  bool enabled() const { return path_.empty() == false; }
+  // The result of `func`, cached or computed (and then cached). Declarations
+  // are always computed.
+  std::string GetOrCompute(const llvm::Function& func,
+                           llvm::function_ref<std::string()> compute);
+  // The number of an unnamed global value in its module, as keys include
+  // it: results can refer to the value by it.
+  unsigned GetUnnamedGlobalNumber(const llvm::GlobalValue& global);
+
+ private:
+  struct Entry {
+    std::string result;
+    // The run that last used it
+    uint64_t last_run;
+  };
+
+  std::string Hash(const llvm::Function& func);
+  void Load();
+  // Returns false (after printing why) on failure.
+  bool Save() const;
+
+  std::string tool_name_;
+  std::string path_;
+  // Runs so far, this one included
+  uint64_t run_ = 1;
+  llvm::StringMap<Entry> entries_;
+  llvm::DenseMap<const llvm::GlobalValue*, unsigned> unnamed_globals_;
+  const llvm::Module* unnamed_globals_module_ = nullptr;
+  unsigned num_hits_ = 0;
+  unsigned num_misses_ = 0;
+};
+
+}  // namespace common
+
+#endif  // COMMON_ANALYSIS_CACHE_H_
@@ -0,0 +1,79 @@
+# Compiler and linker settings of every tool, included by their Makefiles
+# after they set PREFIX, BIN_PATH, LLVM_CONFIG and TOOLS_ROOT (the root of the
+# repository):
+#
+#   make                         debug build, -O0 -g
+#   make BUILD=release           -O3 and ThinLTO, without assertions or debug
+#                                info, unused sections dropped
+#   make BUILD=release PGO=gen   the same, instrumented to collect a profile
+#   make BUILD=release PGO=use   the same, optimized with PGO_PROFILE
+#   make LLVM_SHARED=1           linked with libLLVM rather than the static
+#                                components
+#
+# `make release` and `make pgo` at the top of the repository build every tool
+# that way.
+#
+# The sources of common/ are built once per BIN_PATH and settings, into
+# $(COMMON_LIB), which the tools list as a prerequisite and link.
+
+CXX              =   clang++
+BUILD           ?=   debug
+# Of the tools that need a faster debug build
+DEBUG_FLAGS     ?=   -O0 -g
+# What the tools use, and what it needs. Tools using more add to it before
+# the include.
+LLVM_COMPONENTS +=   analysis bitreader bitwriter core irreader support \
+                     transformutils
+
+ifeq ($(BUILD),debug)
+OPT_FLAGS        =   $(DEBUG_FLAGS)
+else ifeq ($(BUILD),release)
+OPT_FLAGS        =   -O3 -DNDEBUG -flto=thin -ffunction-sections -fdata-sections
+OPT_LDFLAGS      =   -flto=thin -fuse-ld=lld -Wl,--gc-sections -Wl,-O2 -s \
+                     -Wl,--thinlto-cache-dir=$(BIN_PATH)/.thinlto-cache
+else
+$(error BUILD must be debug or release, not $(BUILD))
+endif
+
+PGO_PROFILE     ?=   $(abspath $(TOOLS_ROOT))/bin/pgo/tools.profdata
+ifeq ($(PGO),gen)
+OPT_FLAGS       +=   -fprofile-instr-generate
+OPT_LDFLAGS     +=   -fprofile-instr-generate
+else ifeq ($(PGO),use)
+OPT_FLAGS       +=   -fprofile-instr-use=$(PGO_PROFILE)
+else ifneq ($(PGO),)
+$(error PGO must be gen or use, not $(PGO))
+endif
+
+ifeq ($(LLVM_SHARED),1)
+LLVM_LIBS        =   `$(LLVM_CONFIG) --link-shared --libs` \
+                     -Wl,-rpath,`$(LLVM_CONFIG) --libdir`
+else
+LLVM_LIBS        =   `$(LLVM_CONFIG) --libs $(LLVM_COMPONENTS)` \
+                     `$(LLVM_CONFIG) --system-libs`
+endif
+
+CXXFLAGS        +=   $(OPT_FLAGS) -Wall `$(LLVM_CONFIG) --cxxflags` -fno-rtti \
+                     -fpic -I$(TOOLS_ROOT)
+LDFLAGS         +=   $(OPT_LDFLAGS) `$(LLVM_CONFIG) --ldflags` $(LLVM_LIBS)
+
+# Per settings, as they change the objects
+COMMON_DIR       =   $(BIN_PATH)/.common-$(BUILD)$(if $(PGO),-pgo-$(PGO))
+COMMON_SRCS      =   $(wildcard $(TOOLS_ROOT)/common/*.cc)
+COMMON_OBJS      =   $(patsubst $(TOOLS_ROOT)/common/%.cc,$(COMMON_DIR)/%.o,\
+                       $(COMMON_SRCS))
+COMMON_LIB       =   $(COMMON_DIR)/libcommon.a
+# Reads the bitcode of ThinLTO objects for the index of the archive
+AR               =   `$(LLVM_CONFIG) --bindir`/llvm-ar
+
+$(COMMON_OBJS): $(COMMON_DIR)/%.o: $(TOOLS_ROOT)/common/%.cc \
+                $(wildcard $(TOOLS_ROOT)/common/*.h)
+	mkdir -p $(COMMON_DIR)
+	$(CXX) $(CXXFLAGS) -c $< -o $@
+
+$(COMMON_LIB): $(COMMON_OBJS)
+	rm -f $@
+	$(AR) rcs $@ $^
+
+# The first target of the including Makefile stays its default goal
+.DEFAULT_GOAL :=
@@ -0,0 +1,222 @@
+#include "common/driver.h"
+
+#include "common/instrumentation.h"
+
+#include "llvm/ADT/Statistic.h"             // AreStatisticsEnabled
+#include "llvm/Bitcode/BitcodeWriter.h"     // WriteBitcodeToFile
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"         // parseIRFile, getLazyIRFileModule
+#include "llvm/Pass.h"                      // TimePassesIsEnabled
+#include "llvm/Support/CommandLine.h"       // cl::opt
+#include "llvm/Support/Error.h"             // logAllUnhandledErrors
+#include "llvm/Support/FileSystem.h"        // sys::fs::F_None
+#include "llvm/Support/Path.h"              // sys::path::filename
+#include "llvm/Support/SourceMgr.h"         // SMDiagnostic
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace {
+
+enum class VerifyMode { kNone, kEnd, kEach };
+
+cl::OptionCategory driver_category("Driver options");
+
+cl::opt<std::string> input_filename(cl::Positional,
+                                    cl::desc("<input IR file>"), cl::Required,
+                                    cl::cat(driver_category));
+cl::opt<std::string> output_filename(
+    "o",
+    cl::desc("Output file, `-` for stdout (default: the input file, or "
+             "none for analyses)"),
+    cl::value_desc("file"), cl::cat(driver_category));
+cl::opt<VerifyMode> verify_mode(
+    "verify", cl::desc("When to verify the module"),
+    cl::values(clEnumValN(VerifyMode::kNone, "none", "never"),
+               clEnumValN(VerifyMode::kEnd, "end", "before writing it"),
+               clEnumValN(VerifyMode::kEach, "each", "after every phase")),
+    cl::init(VerifyMode::kEnd), cl::cat(driver_category));
+cl::opt<bool> emit_bc("emit-bc", cl::desc("Write bitcode instead of text"),
+                      cl::init(false), cl::cat(driver_category));
+cl::opt<bool> stream(
+    "stream",
+    cl::desc("Analyze one function at a time, read from bitcode right before "
+             "and freed right after, and write nothing"),
+    cl::init(false), cl::cat(driver_category));
+cl::opt<std::string> profile_json(
+    "profile-json",
+    cl::desc("Write the time and memory used by every phase and function"),
+    cl::value_desc("file"), cl::cat(driver_category));
+cl::opt<std::string> profile_trace(
+    "profile-trace",
+    cl::desc("Write the same as a Chrome trace (chrome://tracing, Perfetto)"),
+    cl::value_desc("file"), cl::cat(driver_category));
+
+void PrintModuleSize(const Module& module, StringRef when) {
+  unsigned num_funcs = 0, num_blocks = 0, num_insts = 0;
+  for (const auto& func : module) {
+    if (func.isDeclaration()) continue;
+    ++num_funcs;
+    for (const auto& basic_block : func) {
+      ++num_blocks;
+      num_insts += basic_block.size();
+    }
+  }
+  errs() << "Module " << when << ": " << num_funcs << " functions, "
+         << num_blocks << " basic blocks, " << num_insts << " instructions\n";
+}
+
+}  // namespace
+
+std::unique_ptr<Module> common::LoadModule(StringRef filename,
+                                           LLVMContext& context) {
+  SMDiagnostic err;
+  auto module = parseIRFile(filename, err, context);
+  if (module == nullptr)
+    errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
+  return module;
+}
+
+bool common::WriteModule(const Module& module, StringRef filename,
+                         bool emit_bc) {
+  std::error_code ec;
+  raw_fd_ostream out(filename, ec, sys::fs::F_None);
+  if (ec) {
+    errs() << "Cannot write " << filename << ": " << ec.message() << "\n";
+    return false;
+  }
+  if (emit_bc)
+    WriteBitcodeToFile(module, out);
+  else
+    module.print(out, nullptr);
+  return true;
+}
+
+bool common::VerifyModule(const Module& module) {
+  if (verifyModule(module, &errs())) {
+    errs() << "Generated module is not correct!\n";
+    return false;
+  }
+  return true;
+}
+
+common::Driver::Driver(int argc, char** argv, const char* overview)
+    : timer_group_("driver", "Tool phases") {
+  cl::ParseCommandLineOptions(argc, argv, overview);
+  if (profile_json.empty() == false || profile_trace.empty() == false)
+    Profiler::Get().Enable(sys::path::filename(argv[0]));
+}
+
+common::Driver::~Driver() {
+  const auto& profiler = Profiler::Get();
+  if (profile_json.empty() == false) profiler.WriteJson(profile_json);
+  if (profile_trace.empty() == false) profiler.WriteTrace(profile_trace);
+}
+
+Module* common::Driver::Load() {
+  {
+    TimeRegion timer(GetTimer("load"));
+    ScopedEvent event("load");
+    module_ = LoadModule(input_filename, context_);
+  }
+  if (module_ != nullptr && AreStatisticsEnabled())
+    PrintModuleSize(*module_, "before");
+  return module_.get();
+}
+
+bool common::Driver::RunPhase(StringRef name,
+                              function_ref<bool(Module&)> phase) {
+  {
+    TimeRegion timer(GetTimer(name));
+    ScopedEvent event(name);
+    if (phase(*module_) == false) return false;
+  }
+  if (verify_mode != VerifyMode::kEach) return true;
+  TimeRegion timer(GetTimer("verify"));
+  ScopedEvent event("verify");
+  return VerifyModule(*module_);
+}
+
+int common::Driver::Finish() {
+  // An analysis leaves the module as it read it
+  bool verify = verify_mode == VerifyMode::kEnd &&
+                (analysis_ == false || verify_mode.getNumOccurrences() > 0);
+  bool write = analysis_ == false || output_filename.getNumOccurrences() > 0;
+
+  if (verify) {
+    TimeRegion timer(GetTimer("verify"));
+    ScopedEvent event("verify");
+    if (VerifyModule(*module_) == false) return 1;
+  }
+
+  if (AreStatisticsEnabled()) {
+    PrintModuleSize(*module_, "after");
+    PrintStatistics(errs());
+  }
+
+  if (write == false) return 0;
+  TimeRegion timer(GetTimer("write"));
+  ScopedEvent event("write");
+  auto filename =
+      output_filename.empty() ? input_filename.getValue() : output_filename;
+  return WriteModule(*module_, filename, emit_bc) ? 0 : 1;
+}
+
+int common::Driver::Run(StringRef name, function_ref<bool(Module&)> phase) {
+  if (Load() == nullptr || RunPhase(name, phase) == false) return 1;
+  return Finish();
+}
+
+int common::Driver::Analyze(StringRef name,
+                            function_ref<void(Module&)> analyze) {
+  analysis_ = true;
+  return Run(name, [&](Module& module) {
+    analyze(module);
+    return true;
+  });
+}
+
+int common::Driver::RunOnFunctions(StringRef name,
+                                   function_ref<void(Function&)> analyze) {
+  if (stream == false) {
+    return Analyze(name, [&](Module& module) {
+      for (auto& func : module) analyze(func);
+    });
+  }
+
+  {
+    TimeRegion timer(GetTimer("load"));
+    ScopedEvent event("load");
+    // Only the globals and the declarations: the bodies stay in the file
+    SMDiagnostic err;
+    module_ = getLazyIRFileModule(input_filename, err, context_);
+    if (module_ == nullptr) {
+      errs() << "getLazyIRFileModule failed\n" << err.getMessage() << "\n";
+      return 1;
+    }
+  }
+
+  TimeRegion timer(GetTimer(name));
+  ScopedEvent event(name);
+  for (auto& func : *module_) {
+    if (Error err = func.materialize()) {
+      logAllUnhandledErrors(std::move(err), errs(),
+                            "Cannot read " + func.getName() + ": ");
+      return 1;
+    }
+    analyze(func);
+    // LLVM can't put a body back into the file, but it can drop it; the
+    // calls of the functions after still point to the declaration left
+    if (func.isDeclaration() == false) func.deleteBody();
+  }
+  return 0;
+}
+
+Timer* common::Driver::GetTimer(StringRef name) {
+  if (TimePassesIsEnabled == false) return nullptr;
+  for (auto& timer : timers_) {
+    if (timer->getName() == name) return timer.get();
+  }
+  timers_.push_back(std::make_unique<Timer>(name, name, timer_group_));
+  return timers_.back().get();
+}
@@ -0,0 +1,91 @@
+#ifndef COMMON_DRIVER_H_
+#define COMMON_DRIVER_H_
+
+#include <memory>
+#include <vector>
+
+#include "llvm/ADT/STLExtras.h"  // function_ref
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Timer.h"  // Timer, TimerGroup
+
+namespace common {
+
+// Reads a textual or bitcode IR file. Returns nullptr (after printing why) on
+// failure.
+std::unique_ptr<llvm::Module> LoadModule(llvm::StringRef filename,
+                                         llvm::LLVMContext& context);
+// Writes `module` to `filename` (`-` for stdout), as bitcode if `emit_bc`.
+// Returns false (after printing why) on failure.
+bool WriteModule(const llvm::Module& module, llvm::StringRef filename,
+                 bool emit_bc);
+// Returns false (after printing the problems) if `module` is broken.
+bool VerifyModule(const llvm::Module& module);
+
+// The main() of the tools that rewrite a module:
+//
+//   int main(int argc, char** argv) {
+//     common::Driver driver(argc, argv, "Does something\n");
+//     return driver.Run("something", [](llvm::Module& module) {
+//       RunOnModule(module);
+//       return true;
+//     });
+//   }
+//
+// It reads the positional input file and writes the result to -o (the input
+// itself by default), as bitcode with -emit-bc. Analyses (see Analyze()) write
+// nothing unless asked to. -verify=none|end|each says
+// when the module gets verified. With LLVM's own -time-passes, the time spent
+// loading, in every phase, verifying and writing is reported on exit; with
+// -stats, so are the size of the module before and after and LLVM's
+// statistics. -profile-json and -profile-trace record the time and memory of
+// the same phases, and of the scopes of the tool (see instrumentation.h), and
+// write them on exit. -stream makes analyses go one function at a time (see
+// RunOnFunctions()).
+class Driver {
+ public:
+  // Parses the command line, with the tool's own options
+  Driver(int argc, char** argv, const char* overview);
+  // Writes the profiles asked for
+  ~Driver();
+
+  // Loads the input module. Returns nullptr (after printing why) on failure.
+  llvm::Module* Load();
+  // Runs a phase of the tool on the loaded module. Returns false if `phase`
+  // does, or if it leaves a broken module behind with -verify=each.
+  bool RunPhase(llvm::StringRef name,
+                llvm::function_ref<bool(llvm::Module&)> phase);
+  // Verifies and writes the module. Returns the exit code of the tool.
+  int Finish();
+  // Load(), RunPhase() and Finish() in one go
+  int Run(llvm::StringRef name, llvm::function_ref<bool(llvm::Module&)> phase);
+  // The same for the tools that only read the module, which only verify it
+  // with an explicit -verify and only write it with an explicit -o
+  int Analyze(llvm::StringRef name,
+              llvm::function_ref<void(llvm::Module&)> analyze);
+  // Analyze() on every function, in order. With -stream, the module is read
+  // lazily (from bitcode), a function body is only read right before
+  // `analyze` and freed right after, so memory follows the largest function
+  // rather than the module; nothing is verified or written then.
+  int RunOnFunctions(llvm::StringRef name,
+                     llvm::function_ref<void(llvm::Function&)> analyze);
+
+  llvm::Module* module() { return module_.get(); }
+
+ private:
+  // A timer for `name`, which only runs with -time-passes
+  llvm::Timer* GetTimer(llvm::StringRef name);
+
+  llvm::LLVMContext context_;
+  std::unique_ptr<llvm::Module> module_;
+  // Declared before the timers: the group reports them as they go away
+  llvm::TimerGroup timer_group_;
+  std::vector<std::unique_ptr<llvm::Timer>> timers_;
+  // Whether the tool only reads the module
+  bool analysis_ = false;
+};
+
+}  // namespace common
+
+#endif  // COMMON_DRIVER_H_
@@ -0,0 +1,69 @@
+#ifndef COMMON_FUNCTION_FILTER_H_
+#define COMMON_FUNCTION_FILTER_H_
+
+#include <memory>
+#include <string>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace common {
+
+// Selects the functions a tool rewrites, by a regular expression on their
+// names and/or a file listing them (one name per line, '#' starts a
+// comment). A function is selected if it matches either; everything is
+// selected if neither is given. Declarations are never selected.
+class FunctionFilter {
+ public:
+  // Returns false (after printing why) if `regex` or `list_path` is invalid.
+  bool Init(llvm::StringRef regex, llvm::StringRef list_path) {
+    if (regex.empty() == false) {
+      // The whole name must match, as with a list
+      regex_ = std::make_unique<llvm::Regex>(("^(" + regex + ")$").str());
+      std::string error;
+      if (regex_->isValid(error) == false) {
+        llvm::errs() << "Invalid function filter '" << regex << "': " << error
+                     << "\n";
+        return false;
+      }
+    }
+
+    if (list_path.empty() == false) {
+      auto buffer = llvm::MemoryBuffer::getFile(list_path);
+      if (std::error_code ec = buffer.getError()) {
+        llvm::errs() << "Cannot read " << list_path << ": " << ec.message()
+                     << "\n";
+        return false;
+      }
+      llvm::SmallVector<llvm::StringRef, 64> lines;
+      (*buffer)->getBuffer().split(lines, '\n');
+      for (auto line : lines) {
+        auto name = line.split('#').first.trim();
+        if (name.empty() == false) names_.insert(name);
+      }
+      has_list_ = true;
+    }
+    return true;
+  }
+
+  bool Matches(const llvm::Function& fn) const {
+    if (fn.isDeclaration()) return false;
+    if (regex_ == nullptr && has_list_ == false) return true;
+    return (regex_ != nullptr && regex_->match(fn.getName())) ||
+           names_.count(fn.getName()) != 0;
+  }
+
+ private:
+  std::unique_ptr<llvm::Regex> regex_;
+  llvm::StringSet<> names_;
+  bool has_list_ = false;
+};
+
+}  // namespace common
+
+#endif  // COMMON_FUNCTION_FILTER_H_
@@ -0,0 +1,232 @@
+#include "common/instrumentation.h"
+
+#include <sys/resource.h>  // getrusage
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <utility>
+
+#include "llvm/Support/ErrorHandling.h"  // report_bad_alloc_error
+#include "llvm/Support/FileSystem.h"     // sys::fs::F_None
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Process.h"        // sys::Process
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace {
+
+// Set by Profiler::Enable, so that new costs no more than malloc otherwise
+std::atomic<bool> count_allocs{false};
+std::atomic<uint64_t> num_allocs{0};
+std::atomic<uint64_t> alloc_bytes{0};
+
+std::unique_ptr<raw_fd_ostream> OpenOutput(StringRef filename) {
+  std::error_code ec;
+  auto out = std::make_unique<raw_fd_ostream>(filename, ec, sys::fs::F_None);
+  if (ec) {
+    errs() << "Cannot write " << filename << ": " << ec.message() << "\n";
+    return nullptr;
+  }
+  return out;
+}
+
+}  // namespace
+
+// Counts the allocations of the whole process, LLVM included, once the
+// profiler is enabled. The other forms of new, and the default delete, end up
+// here or in free().
+void* operator new(size_t size) {
+  if (count_allocs.load(std::memory_order_relaxed)) {
+    num_allocs.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+  void* ptr = std::malloc(size != 0 ? size : 1);
+  if (ptr == nullptr) report_bad_alloc_error("operator new failed");
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+common::ResourceUsage common::GetResourceUsage() {
+  ResourceUsage usage;
+  usage.num_allocs = num_allocs.load(std::memory_order_relaxed);
+  usage.alloc_bytes = alloc_bytes.load(std::memory_order_relaxed);
+  usage.heap_bytes = sys::Process::GetMallocUsage();
+  struct rusage rusage;
+  // ru_maxrss is in KiB on Linux
+  if (getrusage(RUSAGE_SELF, &rusage) == 0)
+    usage.peak_rss_kb = rusage.ru_maxrss;
+  return usage;
+}
+
+common::Profiler& common::Profiler::Get() {
+  static Profiler profiler;
+  return profiler;
+}
+
+void common::Profiler::Enable(StringRef tool_name) {
+  enabled_ = true;
+  count_allocs.store(true, std::memory_order_relaxed);
+  tool_name_ = tool_name.str();
+  start_ = std::chrono::steady_clock::now();
+}
+
+std::chrono::microseconds common::Profiler::Now() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start_);
+}
+
+bool common::Profiler::WriteJson(StringRef filename) const {
+  auto out = OpenOutput(filename);
+  if (out == nullptr) return false;
+
+  // The scopes of a function may run several times, e.g. once per phase
+  std::map<std::pair<StringRef, StringRef>, Event> costs;
+  for (const auto& event : events_) {
+    if (event.detail.empty()) continue;
+    auto inserted = costs.insert({{event.name, event.detail}, event});
+    if (inserted.second) continue;
+    auto& cost = inserted.first->second;
+    cost.duration += event.duration;
+    cost.num_allocs += event.num_allocs;
+    cost.alloc_bytes += event.alloc_bytes;
+    cost.heap_delta += event.heap_delta;
+    cost.peak_rss_growth_kb += event.peak_rss_growth_kb;
+  }
+  std::vector<const Event*> sorted_costs;
+  for (const auto& cost : costs) sorted_costs.push_back(&cost.second);
+  std::stable_sort(sorted_costs.begin(), sorted_costs.end(),
+                   [](const Event* lhs, const Event* rhs) {
+                     return lhs->duration > rhs->duration;
+                   });
+
+  auto write_usage = [](json::OStream& json, const Event& event) {
+    json.attribute("time_us", int64_t(event.duration.count()));
+    json.attribute("allocs", int64_t(event.num_allocs));
+    json.attribute("alloc_bytes", int64_t(event.alloc_bytes));
+    json.attribute("heap_delta_bytes", event.heap_delta);
+    json.attribute("peak_rss_growth_kb", int64_t(event.peak_rss_growth_kb));
+  };
+
+  json::OStream json(*out, 2);
+  json.object([&] {
+    json.attribute("tool", tool_name_);
+    json.attribute("peak_rss_kb", int64_t(GetResourceUsage().peak_rss_kb));
+    json.attributeArray("phases", [&] {
+      for (const auto& event : events_) {
+        if (event.detail.empty() == false) continue;
+        json.object([&] {
+          json.attribute("name", event.name);
+          json.attribute("start_us", int64_t(event.start.count()));
+          write_usage(json, event);
+          json.attribute("peak_rss_kb", int64_t(event.peak_rss_kb));
+        });
+      }
+    });
+    json.attributeArray("functions", [&] {
+      for (const auto* cost : sorted_costs) {
+        json.object([&] {
+          json.attribute("scope", cost->name);
+          json.attribute("function", cost->detail);
+          write_usage(json, *cost);
+        });
+      }
+    });
+  });
+  *out << "\n";
+  return true;
+}
+
+bool common::Profiler::WriteTrace(StringRef filename) const {
+  auto out = OpenOutput(filename);
+  if (out == nullptr) return false;
+
+  int64_t pid = sys::Process::getProcessId();
+  json::OStream json(*out);
+  json.object([&] {
+    json.attributeArray("traceEvents", [&] {
+      json.object([&] {
+        json.attribute("name", "process_name");
+        json.attribute("ph", "M");
+        json.attribute("pid", pid);
+        json.attribute("tid", 0);
+        json.attributeObject("args",
+                             [&] { json.attribute("name", tool_name_); });
+      });
+      for (const auto& event : events_) {
+        // A complete event, with its cost in the details...
+        json.object([&] {
+          json.attribute("name", event.detail.empty()
+                                     ? event.name
+                                     : event.name + " " + event.detail);
+          json.attribute("cat", event.detail.empty() ? "phase" : "function");
+          json.attribute("ph", "X");
+          json.attribute("ts", int64_t(event.start.count()));
+          json.attribute("dur", int64_t(event.duration.count()));
+          json.attribute("pid", pid);
+          json.attribute("tid", 0);
+          json.attributeObject("args", [&] {
+            if (event.detail.empty() == false)
+              json.attribute("function", event.detail);
+            json.attribute("allocs", int64_t(event.num_allocs));
+            json.attribute("alloc_bytes", int64_t(event.alloc_bytes));
+            json.attribute("heap_delta_bytes", event.heap_delta);
+            json.attribute("peak_rss_growth_kb",
+                           int64_t(event.peak_rss_growth_kb));
+          });
+        });
+        // ... and a counter, which draws the peak RSS over time
+        json.object([&] {
+          json.attribute("name", "peak RSS (KiB)");
+          json.attribute("ph", "C");
+          json.attribute("ts", int64_t((event.start + event.duration).count()));
+          json.attribute("pid", pid);
+          json.attribute("tid", 0);
+          json.attributeObject("args", [&] {
+            json.attribute("peak_rss_kb", int64_t(event.peak_rss_kb));
+          });
+        });
+      }
+    });
+    json.attribute("displayTimeUnit", "ms");
+  });
+  *out << "\n";
+  return true;
+}
+
+common::ScopedEvent::ScopedEvent(StringRef name, StringRef detail) {
+  Start(name, detail);
+}
+
+common::ScopedEvent::ScopedEvent(StringRef name, const Function& func) {
+  if (func.isDeclaration() == false) Start(name, func.getName());
+}
+
+common::ScopedEvent::~ScopedEvent() {
+  if (active_ == false) return;
+  auto& profiler = Profiler::Get();
+  event_.duration = profiler.Now() - event_.start;
+  auto usage = GetResourceUsage();
+  event_.num_allocs = usage.num_allocs - usage_.num_allocs;
+  event_.alloc_bytes = usage.alloc_bytes - usage_.alloc_bytes;
+  event_.heap_delta = int64_t(usage.heap_bytes) - int64_t(usage_.heap_bytes);
+  event_.peak_rss_growth_kb = usage.peak_rss_kb - usage_.peak_rss_kb;
+  event_.peak_rss_kb = usage.peak_rss_kb;
+  profiler.Record(std::move(event_));
+}
+
+void common::ScopedEvent::Start(StringRef name, StringRef detail) {
+  auto& profiler = Profiler::Get();
+  if (profiler.enabled() == false) return;
+  active_ = true;
+  event_.name = name.str();
+  event_.detail = detail.str();
+  usage_ = GetResourceUsage();
+  // Last, so that the bookkeeping above isn't part of the scope
+  event_.start = profiler.Now();
+}
@@ -0,0 +1,100 @@
+#ifndef COMMON_INSTRUMENTATION_H_
+#define COMMON_INSTRUMENTATION_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+
+namespace common {
+
+// What the process has used so far
+struct ResourceUsage {
+  // Calls to, and bytes requested from, the global operator new since the
+  // profiler was enabled (0 before)
+  uint64_t num_allocs = 0;
+  uint64_t alloc_bytes = 0;
+  // Bytes in use by malloc, which also covers LLVM's own allocators
+  uint64_t heap_bytes = 0;
+  // Peak resident set size, in KiB
+  uint64_t peak_rss_kb = 0;
+};
+ResourceUsage GetResourceUsage();
+
+// A scope recorded by the profiler. `detail` names the function a scope of a
+// tool works on, and is empty for the phases of the driver.
+struct Event {
+  std::string name;
+  std::string detail;
+  // Since the profiler was enabled
+  std::chrono::microseconds start;
+  std::chrono::microseconds duration;
+  // Used by the scope, including the scopes nested in it
+  uint64_t num_allocs;
+  uint64_t alloc_bytes;
+  int64_t heap_delta;
+  uint64_t peak_rss_growth_kb;
+  // At the end of the scope
+  uint64_t peak_rss_kb;
+};
+
+// Collects the events of the process. It's off unless the driver is asked
+// for -profile-json or -profile-trace, and then records the phases of the
+// driver and the scopes of the tool:
+//
+//   void RunOnModule(llvm::Module& module) {
+//     for (auto& func : module) {
+//       common::ScopedEvent event("something", func);
+//       RunOnFunction(func);
+//     }
+//   }
+class Profiler {
+ public:
+  static Profiler& Get();
+
+  void Enable(llvm::StringRef tool_name);
+  bool enabled() const { return enabled_; }
+  std::chrono::microseconds Now() const;
+  void Record(Event event) { events_.push_back(std::move(event)); }
+
+  // Writes a summary: the phases in order, then the cost of every scope of
+  // every function, most expensive first. Returns false (after printing why)
+  // on failure.
+  bool WriteJson(llvm::StringRef filename) const;
+  // Writes the events in the Chrome trace-event format, for chrome://tracing
+  // or Perfetto. Returns false (after printing why) on failure.
+  bool WriteTrace(llvm::StringRef filename) const;
+
+ private:
+  bool enabled_ = false;
+  std::string tool_name_;
+  std::chrono::steady_clock::time_point start_;
+  std::vector<Event> events_;
+};
+
+// Records the time and memory spent until the end of the scope, if the
+// profiler is enabled
+class ScopedEvent {
+ public:
+  explicit ScopedEvent(llvm::StringRef name, llvm::StringRef detail = "");
+  // Attributes the scope to `func`. Declarations aren't recorded.
+  ScopedEvent(llvm::StringRef name, const llvm::Function& func);
+  ~ScopedEvent();
+
+  ScopedEvent(const ScopedEvent&) = delete;
+  ScopedEvent& operator=(const ScopedEvent&) = delete;
+
+ private:
+  void Start(llvm::StringRef name, llvm::StringRef detail);
+
+  bool active_ = false;
+  Event event_;
+  ResourceUsage usage_;
+};
+
+}  // namespace common
+
+#endif  // COMMON_INSTRUMENTATION_H_
@@ -0,0 +1,90 @@
+#include "common/mba_metadata.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"  // ConstantInt
+#include "llvm/IR/Metadata.h"   // MDNode, MDString
+#include "llvm/IR/Type.h"
+
+using namespace llvm;
+
+// Appends to `path` the operand numbers leading from `node` to a use of `val`
+// through internal nodes. Returns false if there is none.
+static bool FindUse(const Instruction* node, const Value* val,
+                    SmallVectorImpl<unsigned>& path) {
+  for (unsigned i = 0; i < node->getNumOperands(); ++i) {
+    const Value* operand = node->getOperand(i);
+    path.push_back(i);
+    if (operand == val) return true;
+    if (common::IsRewriteNode(operand) &&
+        FindUse(cast<Instruction>(operand), val, path))
+      return true;
+    path.pop_back();
+  }
+  return false;
+}
+
+void common::TagRewrite(Instruction* prev, Instruction* original,
+                        Instruction* root) {
+  auto& ctx = original->getContext();
+  auto* internal_md = MDNode::get(ctx, {});
+  auto inst_iter = prev == nullptr ? original->getParent()->begin()
+                                   : ++prev->getIterator();
+  for (; &*inst_iter != original; ++inst_iter)
+    inst_iter->setMetadata(kMbaMetadataKind, internal_md);
+
+  SmallVector<Metadata*, 3> root_md = {
+      MDString::get(ctx, original->getOpcodeName())};
+  auto* int32_ty = Type::getInt32Ty(ctx);
+  for (unsigned idx = 0; idx < 2; ++idx) {
+    Value* operand = original->getOperand(idx);
+    if (auto* constant = dyn_cast<Constant>(operand)) {
+      root_md.push_back(ConstantAsMetadata::get(constant));
+      continue;
+    }
+    SmallVector<unsigned, 8> path;
+    // The builder of the rewrite may have folded it away
+    if (FindUse(root, operand, path) == false) break;
+    SmallVector<Metadata*, 8> path_md;
+    for (unsigned i : path)
+      path_md.push_back(ConstantAsMetadata::get(ConstantInt::get(int32_ty, i)));
+    root_md.push_back(MDNode::get(ctx, path_md));
+  }
+  // Without both operands, only the opcode
+  if (root_md.size() != 3) root_md.resize(1);
+  root->setMetadata(kMbaMetadataKind, MDNode::get(ctx, root_md));
+}
+
+StringRef common::GetRewrittenOpcode(const Instruction& inst) {
+  const auto* md = inst.getMetadata(kMbaMetadataKind);
+  if (md == nullptr || md->getNumOperands() == 0) return "";
+  const auto* opcode = dyn_cast<MDString>(md->getOperand(0));
+  return opcode == nullptr ? "" : opcode->getString();
+}
+
+Value* common::GetRewrittenOperand(Instruction& root, unsigned idx) {
+  const auto* md = root.getMetadata(kMbaMetadataKind);
+  if (md == nullptr || md->getNumOperands() != 3) return nullptr;
+  const auto& operand_md = md->getOperand(1 + idx);
+  if (auto* constant = dyn_cast<ConstantAsMetadata>(operand_md))
+    return constant->getValue();
+  const auto* path = dyn_cast<MDNode>(operand_md);
+  if (path == nullptr) return nullptr;
+  Value* val = &root;
+  for (const auto& step_md : path->operands()) {
+    auto* inst = dyn_cast<Instruction>(val);
+    auto* step = mdconst::dyn_extract<ConstantInt>(step_md);
+    if (inst == nullptr || step == nullptr ||
+        step->getZExtValue() >= inst->getNumOperands())
+      return nullptr;
+    val = inst->getOperand(step->getZExtValue());
+  }
+  return val;
+}
+
+bool common::IsRewriteNode(const Value* val) {
+  const auto* inst = dyn_cast<Instruction>(val);
+  if (inst == nullptr) return false;
+  const auto* md = inst->getMetadata(kMbaMetadataKind);
+  return md != nullptr && md->getNumOperands() == 0;
+}
@@ -0,0 +1,42 @@
+#ifndef COMMON_MBA_METADATA_H_
+#define COMMON_MBA_METADATA_H_
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Instruction.h"
+
+namespace common {
+
+// Metadata kind tagging the instructions of every rewrite of mba, mba_add and
+// mba_sub, so that mba_verify can recover the expression trees. Internal nodes
+// carry an empty node. Roots carry the name of the original opcode and its
+// two operands, each either the constant it was or the operand numbers that
+// lead from the root to a use of it through internal nodes:
+//
+//   %1 = xor i32 %b, -1, !mba !0
+//   %2 = add i32 %a, %1, !mba !0
+//   %3 = add i32 %2, 1, !mba !1
+//   !0 = !{}
+//   !1 = !{!"sub", !2, !3}   ; %a - %b
+//   !2 = !{i32 0, i32 0}
+//   !3 = !{i32 0, i32 1, i32 0}
+constexpr const char* kMbaMetadataKind = "mba";
+
+// Tags the rewrite of `original`, a binary operation, into `root`: the
+// instructions after `prev` (from the start of the block if it's null) and
+// before `original` are the internal nodes, `root` (inserted or not yet) the
+// root.
+void TagRewrite(llvm::Instruction* prev, llvm::Instruction* original,
+                llvm::Instruction* root);
+
+// The name of the original opcode if `inst` is the root of a rewrite, or an
+// empty string otherwise
+llvm::StringRef GetRewrittenOpcode(const llvm::Instruction& inst);
+// Operand `idx` (0 or 1) of the operation `root` rewrites, or null if the
+// rewrite didn't record it
+llvm::Value* GetRewrittenOperand(llvm::Instruction& root, unsigned idx);
+// Whether `val` is an internal node of a rewrite
+bool IsRewriteNode(const llvm::Value* val);
+
+}  // namespace common
+
+#endif  // COMMON_MBA_METADATA_H_
@@ -0,0 +1,104 @@
+#include "common/results.h"
+
+#include <string>
+
+#include "llvm/Support/CommandLine.h"  // cl::opt
+#include "llvm/Support/FileSystem.h"   // sys::fs::F_None
+#include "llvm/Support/Format.h"
+#include "llvm/Support/LEB128.h"
+
+using namespace llvm;
+
+namespace {
+
+cl::opt<std::string> results_filename(
+    "results",
+    cl::desc("Write the results as records to this file instead of the "
+             "report"),
+    cl::value_desc("file"));
+cl::opt<common::ResultWriter::Format> results_format(
+    "results-format", cl::desc("Format of -results"),
+    cl::values(clEnumValN(common::ResultWriter::Format::kJsonLines, "jsonl",
+                          "a JSON object per line"),
+               clEnumValN(common::ResultWriter::Format::kBinary, "binary",
+                          "compact, with every string written once")),
+    cl::init(common::ResultWriter::Format::kJsonLines));
+
+constexpr char kMagic[] = "LTRESULT";
+constexpr uint8_t kVersion = 1;
+
+}  // namespace
+
+common::ResultWriter& common::ResultWriter::Get() {
+  static ResultWriter writer;
+  return writer;
+}
+
+common::ResultWriter::ResultWriter() : format_(results_format) {
+  if (results_filename.empty()) return;
+  std::error_code ec;
+  out_ = std::make_unique<raw_fd_ostream>(results_filename, ec,
+                                          sys::fs::F_None);
+  if (ec) {
+    errs() << "Cannot write " << results_filename << ": " << ec.message()
+           << "\n";
+    out_ = nullptr;
+    return;
+  }
+  if (format_ == Format::kBinary) *out_ << kMagic << char(kVersion);
+}
+
+void common::ResultWriter::Write(const Record& record) {
+  auto& out = *out_;
+  if (format_ == Format::kBinary) {
+    // Strings first, as their definitions can't go inside the record
+    uint64_t kind = Intern(record.kind);
+    uint64_t function = Intern(record.function);
+    uint64_t name = Intern(record.name);
+    out << 'R';
+    encodeULEB128(kind, out);
+    encodeULEB128(function, out);
+    encodeULEB128(record.block + 1, out);
+    encodeULEB128(record.inst + 1, out);
+    encodeULEB128(name, out);
+    encodeSLEB128(record.value, out);
+    return;
+  }
+
+  out << "{\"kind\":";
+  WriteJsonString(record.kind);
+  out << ",\"function\":";
+  WriteJsonString(record.function);
+  if (record.block >= 0) out << ",\"block\":" << record.block;
+  if (record.inst >= 0) out << ",\"inst\":" << record.inst;
+  if (record.name.empty() == false) {
+    out << ",\"name\":";
+    WriteJsonString(record.name);
+  }
+  out << ",\"value\":" << record.value << "}\n";
+}
+
+uint64_t common::ResultWriter::Intern(StringRef str) {
+  auto inserted = strings_.insert({str, strings_.size()});
+  if (inserted.second) {
+    *out_ << 'S';
+    encodeULEB128(str.size(), *out_);
+    *out_ << str;
+  }
+  return inserted.first->second;
+}
+
+void common::ResultWriter::WriteJsonString(StringRef str) {
+  auto& out = *out_;
+  out << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out << format("\\u%04x", c);
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
@@ -0,0 +1,71 @@
+#ifndef COMMON_RESULTS_H_
+#define COMMON_RESULTS_H_
+
+#include <cstdint>
+#include <memory>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace common {
+
+// A result of an analysis, for tools downstream rather than people. Values
+// are named by stable IDs: their function, and the index of their basic block
+// and instruction in it (in order, from 0), or -1 when they have none.
+//
+//   kind           function  block  inst   name          value
+//   opcode         counted   -1     -1     opcode        uses
+//   direct_calls   ""        -1     -1     callee        calls
+//   fcmp_eq        of fcmp   fcmp   fcmp   predicate     0
+//   riv            of block  block  value  ""            0
+//                                   -1     "arg"         argument number
+//                                   -1     global name   0
+struct Record {
+  llvm::StringRef kind;
+  llvm::StringRef function;
+  int64_t block = -1;
+  int64_t inst = -1;
+  llvm::StringRef name;
+  int64_t value = 0;
+};
+
+// Writes the records of the tool to the file given with -results, instead of
+// its text report, in the format of -results-format:
+//
+// * jsonl: a JSON object per line, with the fields of Record, where block and
+//   inst are left out when -1 and name when empty;
+//
+// * binary: "LTRESULT", a version byte (1), then entries starting with a tag
+//   byte. 'S' defines the next string (numbered from 0): its ULEB128 length
+//   and its bytes. 'R' is a record: the ULEB128 numbers of its kind and
+//   function, ULEB128 block + 1 and inst + 1, the number of its name and its
+//   SLEB128 value. Every string is defined once, before its first use.
+//
+//   auto& results = common::ResultWriter::Get();
+//   if (results.enabled())
+//     results.Write({"opcode", func.getName(), -1, -1, "add", 3});
+class ResultWriter {
+ public:
+  enum class Format { kJsonLines, kBinary };
+
+  // Opens -results on the first call
+  static ResultWriter& Get();
+
+  bool enabled() const { return out_ != nullptr; }
+  void Write(const Record& record);
+
+ private:
+  ResultWriter();
+  // Defines `str` if it's new. Returns its number.
+  uint64_t Intern(llvm::StringRef str);
+  void WriteJsonString(llvm::StringRef str);
+
+  std::unique_ptr<llvm::raw_fd_ostream> out_;
+  Format format_ = Format::kJsonLines;
+  llvm::StringMap<uint64_t> strings_;
+};
+
+}  // namespace common
+
+#endif  // COMMON_RESULTS_H_
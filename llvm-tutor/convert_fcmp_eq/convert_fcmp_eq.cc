@@ -1,13 +1,162 @@
 #include "convert_fcmp_eq.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
 
 using namespace llvm;
 
+
+// How "equal" is relaxed
+enum class Mode {
+  // |a - b| < epsilon
+  kAbs,
+  // a == b or |a - b| <= epsilon * max(|a|, |b|)
+  kRel,
+  // a and b are at most `max_ulps` representable values apart
+  kUlp,
+};
+
+static cl::opt<Mode> mode(
+    "fcmp-eq-mode", cl::desc("Equality that replaces exact comparisons"),
+    cl::values(clEnumValN(Mode::kAbs, "abs", "Absolute epsilon (default)"),
+               clEnumValN(Mode::kRel, "rel", "Epsilon relative to operands"),
+               clEnumValN(Mode::kUlp, "ulp", "Distance in units in the last "
+                                             "place")),
+    cl::init(Mode::kAbs));
+static cl::opt<unsigned> max_ulps(
+    "fcmp-eq-ulps", cl::desc("Largest ULP distance considered equal"),
+    cl::init(4));
+
 // Unnamed namespace for private function
 namespace {
 
-FCmpInst* ConvertFCmpEqInstruction(FCmpInst* fcmp) noexcept;
+// Every instruction below works on scalars as well as on vectors (and splat
+// constants), element-wise, so converting a compare in a vectorized loop
+// doesn't scalarize it.
+
+// Returns the machine epsilon of the (element) type of `ty` as a constant of
+// type `ty`.
+Constant* GetEpsilon(Type* ty) {
+  // The machine epsilon is (b / 2) * b ^ -(p - 1) with b (base) = 2 and p the
+  // precision, e.g. 2 ^ -52 for double and 2 ^ -23 for float. It is exact in
+  // a double for every FP type LLVM has.
+  const auto& semantics = ty->getScalarType()->getFltSemantics();
+  int precision = APFloat::semanticsPrecision(semantics);
+  return ConstantFP::get(ty, std::ldexp(1.0, 1 - precision));
+}
+
+Value* CreateFAbs(IRBuilder<>& builder, Value* val) {
+  return builder.CreateUnaryIntrinsic(Intrinsic::fabs, val);
+}
 
-FCmpInst* ConvertFCmpEqInstruction(FCmpInst* fcmp) noexcept {
+// %0 = fsub %a, %b
+// %1 = call @llvm.fabs(%0)
+// %2 = fcmp <olt/ult/oge/uge> %1, epsilon
+Value* ConvertToAbs(FCmpInst* fcmp, Value* lhs, Value* rhs,
+                    CmpInst::Predicate cmp_pred) {
+  auto builder = IRBuilder<>(fcmp);
+  auto* abs_value = CreateFAbs(builder, builder.CreateFSub(lhs, rhs));
+  // Rather than creating a new instruction, we'll just change the predicate and
+  // operands of the existing fcmp instruction to match what we want.
+  fcmp->setPredicate(cmp_pred);
+  fcmp->setOperand(0, abs_value);
+  fcmp->setOperand(1, GetEpsilon(lhs->getType()));
+  return fcmp;
+}
+
+// Exact equality is kept, so that infinities and zeros still compare equal:
+// %0 = fcmp <oeq/ueq> %a, %b
+// %1 = fsub %a, %b
+// %2 = call @llvm.fabs(%1)
+// %3 = call @llvm.maxnum(@llvm.fabs(%a), @llvm.fabs(%b))
+// %4 = fmul %3, epsilon
+// %5 = fcmp ole %2, %4
+// %6 = or %0, %5
+// The inequalities <one/une> are the negation of <ueq/oeq>.
+Value* ConvertToRel(FCmpInst* fcmp, Value* lhs, Value* rhs) {
+  auto builder = IRBuilder<>(fcmp);
+  builder.setFastMathFlags(fcmp->getFastMathFlags());
+  auto* exact = builder.CreateFCmp(fcmp->getPredicate(), lhs, rhs);
+  auto* abs_diff = CreateFAbs(builder, builder.CreateFSub(lhs, rhs));
+  auto* tolerance = builder.CreateFMul(
+      builder.CreateBinaryIntrinsic(Intrinsic::maxnum, CreateFAbs(builder, lhs),
+                                    CreateFAbs(builder, rhs)),
+      GetEpsilon(lhs->getType()));
+  if (fcmp->getPredicate() == CmpInst::Predicate::FCMP_OEQ ||
+      fcmp->getPredicate() == CmpInst::Predicate::FCMP_UEQ) {
+    return builder.CreateOr(exact, builder.CreateFCmpOLE(abs_diff, tolerance));
+  }
+  return builder.CreateAnd(exact, builder.CreateFCmpUGT(abs_diff, tolerance));
+}
+
+// The bits of an IEEE value, read as a sign-magnitude integer, are ordered
+// like the value itself. Turning them into two's complement makes the
+// difference of two such integers the number of values between them. The
+// magnitude is negated for negative values, so -0.0 and +0.0 are both 0:
+// %0 = bitcast %a to iN
+// %s = ashr %0, N - 1
+// %1 = sub (xor (and %0, INT_MAX), %s), %s
+// (same for %b, giving %1')
+// %2 = select (icmp sgt %1, %1'), (sub %1, %1'), (sub %1', %1)
+// %3 = icmp ule %2, max_ulps
+// %4 = and %3, (fcmp ord %a, %b)
+// NaNs are handled by the ordered/unordered compare rather than by their
+// bits. <ueq/une> are combined with 'fcmp uno' instead.
+Value* ConvertToUlp(FCmpInst* fcmp, Value* lhs, Value* rhs) {
+  auto* ty = lhs->getType();
+  auto* int_ty = ty->isVectorTy() ? static_cast<Type*>(VectorType::getInteger(
+                                        cast<VectorType>(ty)))
+                                  : static_cast<Type*>(IntegerType::get(
+                                        ty->getContext(),
+                                        ty->getScalarSizeInBits()));
+  const unsigned bit_width = int_ty->getScalarSizeInBits();
+
+  auto builder = IRBuilder<>(fcmp);
+  auto to_ordered_int = [&](Value* val) {
+    auto* bits = builder.CreateBitCast(val, int_ty);
+    auto* sign = builder.CreateAShr(bits, bit_width - 1);
+    auto* magnitude = builder.CreateAnd(
+        bits, ConstantInt::get(int_ty, APInt::getSignedMaxValue(bit_width)));
+    return builder.CreateSub(builder.CreateXor(magnitude, sign), sign);
+  };
+  auto* lhs_int = to_ordered_int(lhs);
+  auto* rhs_int = to_ordered_int(rhs);
+  // The difference can't be more than 2^N - 2, so it fits when read unsigned
+  auto* distance = builder.CreateSelect(builder.CreateICmpSGT(lhs_int, rhs_int),
+                                        builder.CreateSub(lhs_int, rhs_int),
+                                        builder.CreateSub(rhs_int, lhs_int));
+
+  switch (fcmp->getPredicate()) {
+    case CmpInst::Predicate::FCMP_OEQ: {
+      return builder.CreateAnd(
+          builder.CreateICmpULE(distance, ConstantInt::get(int_ty, max_ulps)),
+          builder.CreateFCmpORD(lhs, rhs));
+    }
+    case CmpInst::Predicate::FCMP_UEQ: {
+      return builder.CreateOr(
+          builder.CreateICmpULE(distance, ConstantInt::get(int_ty, max_ulps)),
+          builder.CreateFCmpUNO(lhs, rhs));
+    }
+    case CmpInst::Predicate::FCMP_ONE: {
+      return builder.CreateAnd(
+          builder.CreateICmpUGT(distance, ConstantInt::get(int_ty, max_ulps)),
+          builder.CreateFCmpORD(lhs, rhs));
+    }
+    case CmpInst::Predicate::FCMP_UNE: {
+      return builder.CreateOr(
+          builder.CreateICmpUGT(distance, ConstantInt::get(int_ty, max_ulps)),
+          builder.CreateFCmpUNO(lhs, rhs));
+    }
+    default: {
+      llvm_unreachable("Unsupported fcmp predicate");
+    }
+  }
+}
+
+// Returns the value that replaces `fcmp` (possibly `fcmp` itself), or null if
+// `fcmp` isn't an equality comparison.
+Value* ConvertFCmpEqInstruction(FCmpInst* fcmp) noexcept;
+
+Value* ConvertFCmpEqInstruction(FCmpInst* fcmp) noexcept {
   assert(fcmp != nullptr && "The given fcmp instruction is null");
 
   if (fcmp->isEquality() == false) {
@@ -41,65 +190,43 @@ FCmpInst* ConvertFCmpEqInstruction(FCmpInst* fcmp) noexcept {
   }
   ();
 
-  // Create the objects and values needed to perform the equality comparions
-  // conversion.
-  auto* module = fcmp->getModule();
-  assert(module != nullptr &&
-         "The given fcmp instruction does not belong to a module");
-  auto& ctx = module->getContext();
-  auto* i64_ty = IntegerType::get(ctx, 64);
-  auto* double_ty = Type::getDoubleTy(ctx);
-
-  // Define the sign-mask and double-precision machine epsilon constants.
-  ConstantInt* sign_mask = ConstantInt::get(i64_ty, ~(1L << 63));
-  // The machine epsilon value for IEEE 754 double-precision values is 2 ^ -52
-  // or (b / 2) * b ^ -(p - 1) where b (base) = 2 and p (precision) = 53.
-  auto epsilon_bits = APInt(64, 0x3cb0000000000000);
-  auto* epsilon_value = ConstantFP::get(double_ty, epsilon_bits.bitsToDouble());
-
-  // Create an IRBuilder with an insertion point set to the given fcmp
-  // instruction.
-  auto builder = IRBuilder<>(fcmp);
-  // Create the subtraction, casting, absolute value, and new comparison
-  // instructions one at a time.
-  // %0 = fsub double %a, %b
-  auto* fsub_inst = builder.CreateFSub(lhs, rhs);
-  // %1 = bitcast double %0 to i64
-  auto* cast_to_i64 = builder.CreateBitCast(fsub_inst, i64_ty);
-  // %2 = and i64 %1, 0x7fffffffffffffff
-  auto* abs_value = builder.CreateAnd(cast_to_i64, sign_mask);
-  // %3 = bitcast i64 %2 to double
-  auto* cast_to_double = builder.CreateBitCast(abs_value, double_ty);
-  // %4 = fcmp <olt/ult/oge/uge> double %3, 0x3cb0000000000000
-  // Rather than creating a new instruction, we'll just change the predicate and
-  // operands of the existing fcmp instruction to match what we want.
-  fcmp->setPredicate(cmp_pred);
-  fcmp->setOperand(0, cast_to_double);
-  fcmp->setOperand(1, epsilon_value);
-  return fcmp;
+  // The PowerPC double-double format isn't a sign-magnitude integer
+  auto current_mode = mode.getValue();
+  if (current_mode == Mode::kUlp &&
+      lhs->getType()->getScalarType()->isPPC_FP128Ty())
+    current_mode = Mode::kRel;
+
+  Value* new_val = nullptr;
+  switch (current_mode) {
+    case Mode::kAbs: {
+      return ConvertToAbs(fcmp, lhs, rhs, cmp_pred);
+    }
+    case Mode::kRel: {
+      new_val = ConvertToRel(fcmp, lhs, rhs);
+      break;
+    }
+    case Mode::kUlp: {
+      new_val = ConvertToUlp(fcmp, lhs, rhs);
+      break;
+    }
+  }
+
+  new_val->takeName(fcmp);
+  fcmp->replaceAllUsesWith(new_val);
+  fcmp->eraseFromParent();
+  return new_val;
 }
 
 }  // namespace
 
 int main(int argc, char** argv) {
-  LLVMContext context;
-  SMDiagnostic err;
-  auto owner = parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
-
-  convert_fcmp_eq::RunOnModule(*owner);
+  common::Driver driver(argc, argv,
+                        "Relaxes floating-point equality comparisons\n");
 
-  if (verifyModule(*owner, &errs())) {
-    errs() << "Generated module is not correct!\n";
-    return 1;
-  }
-  std::error_code ec;
-  raw_fd_ostream out(argv[1], ec, sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
+  return driver.Run("convert_fcmp_eq", [](Module& module) {
+    convert_fcmp_eq::RunOnModule(module);
+    return true;
+  });
 }
 
 find_fcmp_eq::Result find_fcmp_eq::RunOnFunction(Function& func) {
@@ -118,7 +245,10 @@ find_fcmp_eq::Result find_fcmp_eq::RunOnFunction(Function& func) {
 }
 
 void convert_fcmp_eq::RunOnModule(Module& module) {
-  for (auto& func : module) RunOnFunction(func);
+  for (auto& func : module) {
+    common::ScopedEvent event("convert_fcmp_eq", func);
+    RunOnFunction(func);
+  }
 }
 
 void convert_fcmp_eq::RunOnFunction(Function& func) {
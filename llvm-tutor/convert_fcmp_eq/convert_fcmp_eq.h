@@ -1,6 +1,7 @@
 #ifndef LLVM_TUTOR_FIND_FCMP_EQ_H_
 #define LLVM_TUTOR_FIND_FCMP_EQ_H_
 
+#include <cmath>  // ldexp
 #include <random>
 
 #include "llvm/ADT/ArrayRef.h"
@@ -11,6 +12,7 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"     // IRBuilder
 #include "llvm/IR/InstIterator.h"  // instructions()
+#include "llvm/IR/Intrinsics.h"    // Intrinsic::fabs
 #include "llvm/IR/Module.h"
 #include "llvm/IR/ModuleSlotTracker.h"
 #include "llvm/IR/Value.h"
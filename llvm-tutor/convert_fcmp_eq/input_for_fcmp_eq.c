@@ -25,12 +25,27 @@ double sqrt_impl(double x, double hi, double lo) {
 
 double sqrt(double x) { return sqrt_impl(x, 0, x / 2.0 + 1.0); }
 
+// In the -O2 build (see the Makefile), count_equal is vectorized and its
+// comparison becomes <N x float>
+int count_equal(const float *a, const float *b, int n) {
+  int count = 0;
+  for (int i = 0; i < n; ++i) count += a[i] == b[i];
+  return count;
+}
+
+// Converted, it must still find -0.0 equal to 0.0, 0 ULPs apart
+int is_zero(double x) { return x == 0.0; }
+
 int main() {
+  if (!is_zero(-0.0) || !is_zero(0.0)) return 2;
+
   double a = 0.2;
   double b = 1.0 / sqrt(5.0) / sqrt(5.0);
+  float c[4] = {0.1f, 0.2f, 0.3f, 0.4f};
+  float d[4] = {0.1f, 0.2f, 0.1f + 0.2f, 0.4f};
   // Second direct floating-point equality comparison
   if (b == 1.0)
-    return a == b ? 1 : 0;
+    return a == b ? count_equal(c, d, 4) : 0;
   else
     return a == b ? 0 : 1;
 }
@@ -1,26 +1,17 @@
 #include "duplicate_bb.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
 
 using namespace llvm;
 
 int main(int argc, char** argv) {
-  LLVMContext context;
-  SMDiagnostic err;
-  auto owner = parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
-
-  duplicate_bb::RunOnModule(*owner);
+  common::Driver driver(argc, argv,
+                        "Duplicates basic blocks behind an if-then-else\n");
 
-  if (verifyModule(*owner, &errs())) {
-    errs() << "Generated module is not correct!\n";
-    return 1;
-  }
-  std::error_code ec;
-  raw_fd_ostream out(argv[1], ec, sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
+  return driver.Run("duplicate_bb", [](Module& module) {
+    duplicate_bb::RunOnModule(module);
+    return true;
+  });
 }
 
 riv::RivResult riv::BuildRiv(Function& func, NodeType cfg_root) {
@@ -86,7 +77,10 @@ riv::RivResult riv::BuildRiv(Function& func, NodeType cfg_root) {
 }
 
 void duplicate_bb::RunOnModule(Module& module) {
-  for (auto& func : module) RunOnFunction(func);
+  for (auto& func : module) {
+    common::ScopedEvent event("duplicate_bb", func);
+    RunOnFunction(func);
+  }
 }
 
 void duplicate_bb::RunOnFunction(Function& func) {
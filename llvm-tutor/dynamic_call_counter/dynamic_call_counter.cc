@@ -1,24 +1,15 @@
 #include "dynamic_call_counter.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
 
 int main(int argc, char** argv) {
-  llvm::LLVMContext context;
-  llvm::SMDiagnostic err;
-  auto owner = llvm::parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    llvm::outs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
-
-  RunOnModule(*owner);
+  common::Driver driver(argc, argv,
+                        "Counts the function calls made at run time\n");
 
-  if (llvm::verifyModule(*owner, &llvm::outs())) {
-    llvm::outs() << "Generated module is not correct!\n";
-    return 1;
-  }
-  std::error_code ec;
-  llvm::raw_fd_ostream out(argv[1], ec, llvm::sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
+  return driver.Run("dynamic_call_counter", [](llvm::Module& module) {
+    RunOnModule(module);
+    return true;
+  });
 }
 
 llvm::Constant* CreateGlobalCounter(llvm::Module& module,
@@ -54,6 +45,7 @@ void RunOnModule(llvm::Module& module) {
   // --------------------------------------------------------------------
   for (auto& func : module) {
     if (func.isDeclaration()) continue;
+    common::ScopedEvent event("dynamic_call_counter", func);
 
     // Get an IR builder. Sets the insertion point to the top of the function
     IRBuilder<> builder(&*func.getEntryBlock().getFirstInsertionPt());
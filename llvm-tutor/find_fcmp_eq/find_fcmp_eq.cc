@@ -1,4 +1,8 @@
 #include "find_fcmp_eq.h"
+#include "common/analysis_cache.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
+#include "common/results.h"
 
 using namespace llvm;
 
@@ -27,34 +31,56 @@ static void PrintFCmpEqInstructions(
   }
 }
 
+// As in the IR. CmpInst::getPredicateName only came with LLVM 12.
+static StringRef GetPredicateName(CmpInst::Predicate predicate) {
+  switch (predicate) {
+    case CmpInst::FCMP_OEQ:
+      return "oeq";
+    case CmpInst::FCMP_ONE:
+      return "one";
+    case CmpInst::FCMP_UEQ:
+      return "ueq";
+    case CmpInst::FCMP_UNE:
+      return "une";
+    default:
+      return "";
+  }
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
-  LLVMContext context;
-  SMDiagnostic err;
-  auto owner = parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
+  common::Driver driver(argc, argv,
+                        "Finds floating-point equality comparisons\n");
 
-  find_fcmp_eq::RunOnModule(*owner);
-
-  if (verifyModule(*owner, &errs())) {
-    errs() << "Generated module is not correct!\n";
-    return 1;
-  }
-  std::error_code ec;
-  raw_fd_ostream out(argv[1], ec, sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
+  common::AnalysisCache cache("find_fcmp_eq");
+  return driver.RunOnFunctions("find_fcmp_eq", [&](Function& func) {
+    find_fcmp_eq::AnalyzeFunction(func, cache);
+  });
 }
 
 void find_fcmp_eq::RunOnModule(Module& module) {
-  for (auto& func : module) RunOnFunction(func);
+  common::AnalysisCache cache("find_fcmp_eq");
+  for (auto& func : module) AnalyzeFunction(func, cache);
 }
 
-void find_fcmp_eq::RunOnFunction(Function& func) {
+void find_fcmp_eq::AnalyzeFunction(Function& func,
+                                   common::AnalysisCache& cache) {
+  common::ScopedEvent event("find_fcmp_eq", func);
+  auto& results = common::ResultWriter::Get();
+  if (results.enabled()) {
+    WriteRecords(func, results);
+    return;
+  }
+  errs() << cache.GetOrCompute(func, [&] {
+    std::string result;
+    raw_string_ostream out(result);
+    RunOnFunction(func, out);
+    return out.str();
+  });
+}
+
+void find_fcmp_eq::RunOnFunction(Function& func, raw_ostream& out) {
   Result comparisons;
   for (auto& inst : instructions(func)) {
     // We're only looking for 'fcmp' instructions here.
@@ -66,5 +92,21 @@ void find_fcmp_eq::RunOnFunction(Function& func) {
     }
   }
 
-  PrintFCmpEqInstructions(errs(), func, comparisons);
+  PrintFCmpEqInstructions(out, func, comparisons);
+}
+
+void find_fcmp_eq::WriteRecords(Function& func, common::ResultWriter& results) {
+  int64_t block_index = 0;
+  int64_t inst_index = 0;
+  for (auto& basic_block : func) {
+    for (auto& inst : basic_block) {
+      auto* fcmp = dyn_cast<FCmpInst>(&inst);
+      if (fcmp != nullptr && fcmp->isEquality()) {
+        results.Write({"fcmp_eq", func.getName(), block_index, inst_index,
+                       GetPredicateName(fcmp->getPredicate()), 0});
+      }
+      ++inst_index;
+    }
+    ++block_index;
+  }
 }
@@ -22,12 +22,21 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"  // ReplaceInstWithInst
 #include "llvm/Transforms/Utils/ValueMapper.h"      // ValueToValueMapTy
 
+#include "common/analysis_cache.h"
+#include "common/results.h"
+
 namespace find_fcmp_eq {
 
 using Result = std::vector<llvm::FCmpInst*>;
 
 void RunOnModule(llvm::Module& module);
-void RunOnFunction(llvm::Function& func);
+// Prints the equality comparisons of `func`, found again or in `cache`, or
+// writes them to -results
+void AnalyzeFunction(llvm::Function& func, common::AnalysisCache& cache);
+// Prints the equality comparisons of `func` to `out`
+void RunOnFunction(llvm::Function& func, llvm::raw_ostream& out);
+// Writes a record per equality comparison of `func` to `results`
+void WriteRecords(llvm::Function& func, common::ResultWriter& results);
 
 }  // namespace find_fcmp_eq
 
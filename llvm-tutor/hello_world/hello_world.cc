@@ -2,27 +2,16 @@
 #include "llvm/IRReader/IRReader.h"    // parseIRFile
 #include "llvm/Support/CommandLine.h"  // SMDiagnostic
 
+#include "common/driver.h"
+
 void Visit(llvm::Module& module);
 
 int main(int argc, char** argv) {
-  llvm::LLVMContext context;
-  llvm::SMDiagnostic err;
-  auto owner = llvm::parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    llvm::errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
+  common::Driver driver(argc, argv,
+                        "Prints the name and arity of every function\n");
 
-  Visit(*owner);
-
-  if (llvm::verifyModule(*owner, &llvm::errs())) {
-    llvm::errs() << "Generated module is not correct!\n";
-    return 1;
-  }
-  std::error_code ec;
-  llvm::raw_fd_ostream out(argv[1], ec, llvm::sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
+  return driver.Analyze("hello_world",
+                        [](llvm::Module& module) { Visit(module); });
 }
 
 void Visit(llvm::Module& module) {
@@ -1,24 +1,14 @@
 #include "inject_func_call.h"
+#include "common/driver.h"
 
-int main(int argc, char **argv) {
-  llvm::LLVMContext context;
-  llvm::SMDiagnostic err;
-  auto owner = llvm::parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    llvm::errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
-
-  RunOnModule(*owner);
+int main(int argc, char** argv) {
+  common::Driver driver(argc, argv,
+                        "Injects a call to printf into every function\n");
 
-  if (llvm::verifyModule(*owner, &llvm::errs())) {
-    llvm::errs() << "Generated module is not correct!\n";
-    return 1;
-  }
-  std::error_code ec;
-  llvm::raw_fd_ostream out(argv[1], ec, llvm::sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
+  return driver.Run("inject_func_call", [](llvm::Module& module) {
+    RunOnModule(module);
+    return true;
+  });
 }
 
 void RunOnModule(llvm::Module &module) {
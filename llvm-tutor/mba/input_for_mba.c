@@ -0,0 +1,32 @@
+//=============================================================================
+// FILE:
+//      input_for_mba.c
+//
+// DESCRIPTION:
+//      Sample input file for the MBA pass. Every function mixes the supported
+//      operations (add, sub, xor, or, and) at a different width.
+//
+// License: MIT
+//=============================================================================
+#include <stdint.h>
+#include <stdlib.h>
+
+int8_t foo(int8_t a, int8_t b, int8_t c, int8_t d) {
+  int8_t e = (c + d) ^ a;
+  int8_t f = (a - b) | d;
+
+  return (e & f) + 1;
+}
+
+uint32_t bar(uint32_t a, uint32_t b) {
+  return ((a ^ b) - (a & b)) | (b - 7);
+}
+
+uint64_t baz(uint64_t a, uint64_t b) { return (a + a) & (b | 0x55); }
+
+int main(int argc, char *argv[]) {
+  int a = atoi(argv[1]), b = atoi(argv[2]), c = atoi(argv[3]),
+      d = atoi(argv[4]);
+
+  return foo(a, b, c, d) + bar(a, b) + baz(a, b);
+}
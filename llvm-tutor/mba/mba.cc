@@ -0,0 +1,263 @@
+#include "mba.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
+#include "common/mba_metadata.h"
+
+using namespace llvm;
+
+static cl::opt<double> ratio(
+    "mba-ratio", cl::desc("Probability of substituting a given instruction"),
+    cl::init(1.));
+static cl::opt<uint64_t> seed(
+    "mba-seed",
+    cl::desc("Seed of the generator that picks instructions and identities"),
+    cl::init(1234));
+static cl::list<std::string> enabled_opcodes(
+    "mba-ops", cl::desc("Opcodes to substitute (default: all supported)"),
+    cl::CommaSeparated);
+
+// Identities in reverse Polish notation: `x` and `y` are the operands of the
+// original instruction, `~` is bitwise not, other operators are binary. Every
+// identity holds modulo 2^n for any n, hence for any integer or vector type.
+static const struct {
+  Instruction::BinaryOps opcode;
+  const char* text;
+} kIdentities[] = {
+    // x + y
+    {Instruction::Add, "x y ^ x y & 2 * +"},      // (x ^ y) + 2 * (x & y)
+    {Instruction::Add, "x y | x y & +"},          // (x | y) + (x & y)
+    {Instruction::Add, "x y | 2 * x y ^ -"},      // 2 * (x | y) - (x ^ y)
+    {Instruction::Add, "x y ~ - 1 -"},            // x - ~y - 1
+    // (x ^ ~y) + 2 * (x | y) + 1
+    {Instruction::Add, "x y ~ ^ x y | 2 * + 1 +"},
+    // x - y
+    {Instruction::Sub, "x y ~ + 1 +"},            // x + ~y + 1
+    {Instruction::Sub, "x y ^ x ~ y & 2 * -"},    // (x ^ y) - 2 * (~x & y)
+    {Instruction::Sub, "x y ~ & x ~ y & -"},      // (x & ~y) - (~x & y)
+    {Instruction::Sub, "x y ~ & 2 * x y ^ -"},    // 2 * (x & ~y) - (x ^ y)
+    // x ^ y
+    {Instruction::Xor, "x y | x y & -"},          // (x | y) - (x & y)
+    {Instruction::Xor, "x y + x y & 2 * -"},      // x + y - 2 * (x & y)
+    {Instruction::Xor, "x y ~ & x ~ y & |"},      // (x & ~y) | (~x & y)
+    // x | y
+    {Instruction::Or, "x y ~ & y +"},             // (x & ~y) + y
+    {Instruction::Or, "x y + x y & -"},           // x + y - (x & y)
+    {Instruction::Or, "x y ^ x y & +"},           // (x ^ y) + (x & y)
+    // x & y
+    {Instruction::And, "x y | x y ^ -"},          // (x | y) - (x ^ y)
+    {Instruction::And, "x y + x y | -"},          // x + y - (x | y)
+    {Instruction::And, "x y ~ | y ~ -"},          // (x | ~y) - ~y
+    {Instruction::And, "x y ~ | y + 1 +"},        // (x | ~y) + y + 1
+};
+
+int main(int argc, char** argv) {
+  common::Driver driver(argc, argv,
+                        "Obfuscates add/sub/xor/or/and with MBA identities\n");
+
+  mba::Library library;
+  if (mba::BuildLibrary(library) == false) return 1;
+
+  return driver.Run("mba", [&](Module& module) {
+    mba::RunOnModule(module, library);
+    return true;
+  });
+}
+
+bool mba::ParseIdentity(StringRef text, Identity& identity) {
+  identity.text = text;
+  identity.tokens.clear();
+
+  SmallVector<StringRef, 16> words;
+  text.split(words, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+
+  unsigned depth = 0;
+  bool has_x = false, has_y = false;
+  for (auto word : words) {
+    Token token{StringSwitch<TokenKind>(word)
+                    .Case("x", TokenKind::kX)
+                    .Case("y", TokenKind::kY)
+                    .Case("~", TokenKind::kNot)
+                    .Case("+", TokenKind::kAdd)
+                    .Case("-", TokenKind::kSub)
+                    .Case("*", TokenKind::kMul)
+                    .Case("&", TokenKind::kAnd)
+                    .Case("|", TokenKind::kOr)
+                    .Case("^", TokenKind::kXor)
+                    .Default(TokenKind::kConst),
+                0};
+    if (token.kind == TokenKind::kConst && word.getAsInteger(10, token.imm))
+      return false;
+
+    switch (token.kind) {
+      case TokenKind::kX:
+      case TokenKind::kY:
+      case TokenKind::kConst: {
+        has_x |= token.kind == TokenKind::kX;
+        has_y |= token.kind == TokenKind::kY;
+        ++depth;
+        break;
+      }
+      case TokenKind::kNot: {
+        if (depth < 1) return false;
+        break;
+      }
+      default: {
+        if (depth < 2) return false;
+        --depth;
+        break;
+      }
+    }
+    identity.tokens.push_back(token);
+  }
+
+  // The root must be an operation on both `x` and `y`
+  return depth == 1 && has_x && has_y &&
+         identity.tokens.back().kind != TokenKind::kX &&
+         identity.tokens.back().kind != TokenKind::kY &&
+         identity.tokens.back().kind != TokenKind::kConst;
+}
+
+bool mba::BuildLibrary(Library& library) {
+  library.clear();
+  for (const auto& entry : kIdentities) {
+    StringRef name = Instruction::getOpcodeName(entry.opcode);
+    if (enabled_opcodes.empty() == false &&
+        std::find(enabled_opcodes.begin(), enabled_opcodes.end(), name) ==
+            enabled_opcodes.end())
+      continue;
+
+    Identity identity;
+    if (ParseIdentity(entry.text, identity) == false) {
+      errs() << "Malformed identity for '" << name << "': " << entry.text
+             << "\n";
+      return false;
+    }
+    library[entry.opcode].push_back(std::move(identity));
+  }
+
+  for (const auto& name : enabled_opcodes) {
+    bool found = false;
+    for (const auto& entry : kIdentities)
+      found |= name == Instruction::getOpcodeName(entry.opcode);
+    if (found == false) {
+      errs() << "No identities for '" << name << "'\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+Instruction* mba::Substitute(BinaryOperator* bin_op,
+                             const Identity& identity) {
+  auto* ty = bin_op->getType();
+  // Constant operands must not be folded into the identity's constants,
+  // otherwise the rewrite can't be verified
+  IRBuilder<NoFolder> builder(bin_op);
+  // Every instruction `builder` inserts lands between `prev` and `bin_op`
+  auto* prev = bin_op->getPrevNode();
+
+  SmallVector<Value*, 8> stack;
+  for (const auto& token : identity.tokens) {
+    Value* rhs = nullptr;
+    if (token.kind >= TokenKind::kAdd) rhs = stack.pop_back_val();
+    switch (token.kind) {
+      case TokenKind::kX: {
+        stack.push_back(bin_op->getOperand(0));
+        break;
+      }
+      case TokenKind::kY: {
+        stack.push_back(bin_op->getOperand(1));
+        break;
+      }
+      case TokenKind::kConst: {
+        stack.push_back(ConstantInt::get(ty, token.imm, /*isSigned=*/true));
+        break;
+      }
+      case TokenKind::kNot: {
+        stack.back() = builder.CreateNot(stack.back());
+        break;
+      }
+      case TokenKind::kAdd: {
+        stack.back() = builder.CreateAdd(stack.back(), rhs);
+        break;
+      }
+      case TokenKind::kSub: {
+        stack.back() = builder.CreateSub(stack.back(), rhs);
+        break;
+      }
+      case TokenKind::kMul: {
+        stack.back() = builder.CreateMul(stack.back(), rhs);
+        break;
+      }
+      case TokenKind::kAnd: {
+        stack.back() = builder.CreateAnd(stack.back(), rhs);
+        break;
+      }
+      case TokenKind::kOr: {
+        stack.back() = builder.CreateOr(stack.back(), rhs);
+        break;
+      }
+      case TokenKind::kXor: {
+        stack.back() = builder.CreateXor(stack.back(), rhs);
+        break;
+      }
+    }
+  }
+  auto* root = cast<Instruction>(stack.back());
+
+  // Tag the rewrite so that it can be verified later on
+  common::TagRewrite(prev, bin_op, root);
+
+  dbgs() << *bin_op << " -> " << identity.text << "\n";
+
+  root->takeName(bin_op);
+  bin_op->replaceAllUsesWith(root);
+  bin_op->eraseFromParent();
+  return root;
+}
+
+void mba::RunOnModule(Module& module, const Library& library) {
+  // Seed the random number generator once, so that the choices made in a
+  // function don't depend on where the function starts.
+  std::mt19937_64 rng(seed);
+  for (auto& func : module) {
+    if (func.isDeclaration()) continue;
+    common::ScopedEvent event("mba", func);
+    RunOnFunction(func, library, rng);
+  }
+}
+
+unsigned mba::RunOnFunction(Function& func, const Library& library,
+                            std::mt19937_64& rng) {
+  std::uniform_real_distribution<double> dist(0., 1.);
+
+  // Collect the candidates first: substituting invalidates the iterators
+  SmallVector<BinaryOperator*, 32> candidates;
+  for (auto& basic_block : func) {
+    for (auto& inst : basic_block) {
+      auto* bin_op = dyn_cast<BinaryOperator>(&inst);
+      if (bin_op == nullptr ||
+          bin_op->getType()->isIntOrIntVectorTy() == false ||
+          library.count(bin_op->getOpcode()) == 0)
+        continue;
+      candidates.push_back(bin_op);
+    }
+  }
+
+  unsigned num_substituted = 0;
+  for (auto* bin_op : candidates) {
+    // Use `ratio` and `rng` to decide whether to substitute this particular
+    // instruction, then pick one of its identities
+    if (dist(rng) > ratio) continue;
+    const auto& identities = library.find(bin_op->getOpcode())->second;
+    std::uniform_int_distribution<size_t> pick(0, identities.size() - 1);
+    Substitute(bin_op, identities[pick(rng)]);
+    ++num_substituted;
+  }
+
+  if (candidates.empty() == false) {
+    errs() << "MBA '" << func.getName() << "': substituted " << num_substituted
+           << " of " << candidates.size() << " instructions\n";
+  }
+  return num_substituted;
+}
@@ -0,0 +1,75 @@
+#ifndef LLVM_TUTOR_MBA_H_
+#define LLVM_TUTOR_MBA_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSwitch.h"  // StringSwitch
+#include "llvm/IR/Constants.h"  // ConstantInt
+#include "llvm/IR/IRBuilder.h"  // IRBuilder
+#include "llvm/IR/NoFolder.h"   // NoFolder
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"    // parseIRFile
+#include "llvm/Support/CommandLine.h"  // cl::opt
+#include "llvm/Support/Debug.h"        // dbgs
+#include "llvm/Support/SourceMgr.h"    // SMDiagnostic
+
+namespace mba {
+
+// One step of an identity in reverse Polish notation. `kX` and `kY` push the
+// operands of the original operation, `kConst` pushes `imm`, `kNot` replaces
+// the top of the stack, binary operations pop two values and push the result.
+enum class TokenKind : uint8_t {
+  kX,
+  kY,
+  kConst,
+  kNot,
+  kAdd,
+  kSub,
+  kMul,
+  kAnd,
+  kOr,
+  kXor,
+};
+
+struct Token {
+  TokenKind kind;
+  int64_t imm = 0;
+};
+
+// An expression equivalent to `x <opcode> y` for any bit width, e.g.
+// "x y ^ x y & 2 * +" for `x + y`.
+struct Identity {
+  llvm::StringRef text;
+  llvm::SmallVector<Token, 16> tokens;
+};
+
+// Identities of every supported opcode (`Instruction::Add`, ...)
+using Library = llvm::DenseMap<unsigned, std::vector<Identity>>;
+
+// Parses `text` into `identity`. Besides checking the syntax, this makes sure
+// the identity uses both `x` and `y`.
+bool ParseIdentity(llvm::StringRef text, Identity& identity);
+
+// Parses the built-in table of identities (restricted to the opcodes given
+// with -mba-ops), once per run.
+bool BuildLibrary(Library& library);
+
+// Replaces `bin_op` with `identity` applied to its operands and returns the
+// root of the new expression.
+llvm::Instruction* Substitute(llvm::BinaryOperator* bin_op,
+                              const Identity& identity);
+
+void RunOnModule(llvm::Module& module, const Library& library);
+// Returns the number of substituted instructions.
+unsigned RunOnFunction(llvm::Function& func, const Library& library,
+                       std::mt19937_64& rng);
+
+}  // namespace mba
+
+#endif  // LLVM_TUTOR_MBA_H_
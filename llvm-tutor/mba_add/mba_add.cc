@@ -1,105 +1,206 @@
 #include "mba_add.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
+#include "common/mba_metadata.h"
 using namespace llvm;
 
-static constexpr double kRatio = 1.;
+static cl::opt<double> ratio(
+    "mba-ratio", cl::desc("Probability of substituting a given 'add'"),
+    cl::init(1.));
+static cl::opt<uint64_t> seed(
+    "mba-seed", cl::desc("Seed of the generator that picks the 'add's"),
+    cl::init(1234));
+static cl::opt<unsigned> latency_budget(
+    "mba-latency-budget",
+    cl::desc("Maximum estimated latency (in cycles, weighted by loop depth) "
+             "added per function, 0 for no limit"),
+    cl::init(0));
+
+// Every level of loop nesting is assumed to multiply the execution count of an
+// 'add' by this much
+static constexpr unsigned kLoopWeight = 8;
+static constexpr unsigned kMaxLoopDepth = 4;
 
 int main(int argc, char** argv) {
-  LLVMContext context;
-  SMDiagnostic err;
-  auto owner = parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
+  common::Driver driver(argc, argv, "Obfuscates integer additions\n");
+
+  return driver.Run("mba_add", [](Module& module) {
+    RunOnModule(module);
+    return true;
+  });
+}
+
+void RunOnModule(Module& module) {
+  // Seed the random number generator once, so that the 'add's picked in a
+  // basic block don't depend on where the block starts.
+  std::mt19937_64 rng(seed);
+  for (auto& func : module) {
+    if (func.isDeclaration()) continue;
+    common::ScopedEvent event("mba_add", func);
+    RunOnFunction(func, rng);
   }
+}
+
+void RunOnFunction(Function& func, std::mt19937_64& rng) {
+  // Used together with `rng` to decide whether to replace the current
+  // instruction or not.
+  std::uniform_real_distribution<double> dist(0., 1.);
 
-  RunOnModule(*owner);
+  DominatorTree dominator_tree(func);
+  LoopInfo loop_info(dominator_tree);
+
+  // STEP 1: Collect the 'add's picked by `ratio`, together with the latency
+  // their substitution is expected to add
+  std::vector<std::pair<uint64_t, BinaryOperator*>> candidates;
+  unsigned num_adds = 0;
+  for (auto& basic_block : func) {
+    uint64_t weight = 1;
+    for (unsigned depth = std::min(loop_info.getLoopDepth(&basic_block),
+                                   kMaxLoopDepth);
+         depth > 0; --depth)
+      weight *= kLoopWeight;
+
+    for (auto& inst : basic_block) {
+      // Skip instructions other than (scalar or vector) integer add
+      auto* bin_op = dyn_cast<BinaryOperator>(&inst);
+      if (bin_op == nullptr || bin_op->getOpcode() != Instruction::Add ||
+          bin_op->getType()->isIntOrIntVectorTy() == false)
+        continue;
+      ++num_adds;
+
+      // Use `ratio` and `rng` to decide whether to substitude this particular
+      // 'add'
+      if (dist(rng) > ratio) continue;
+
+      candidates.emplace_back(weight * EstimateAddedLatency(bin_op->getType()),
+                              bin_op);
+    }
+  }
 
-  if (verifyModule(*owner, &errs())) {
-    errs() << "Generated module is not correct!\n";
-    return 1;
+  // STEP 2: Spend the budget on the cheapest substitutions first, so that as
+  // many 'add's as possible get substituted. Ties keep the program order.
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [](const std::pair<uint64_t, BinaryOperator*>& lhs,
+                      const std::pair<uint64_t, BinaryOperator*>& rhs) {
+                     return lhs.first < rhs.first;
+                   });
+
+  uint64_t added_latency = 0;
+  unsigned num_substituted = 0;
+  for (auto& candidate : candidates) {
+    if (latency_budget != 0 &&
+        added_latency + candidate.first > latency_budget)
+      break;
+    added_latency += candidate.first;
+    ++num_substituted;
+    SubstituteAdd(candidate.second);
+  }
+
+  if (num_adds != 0) {
+    errs() << "MBA add '" << func.getName() << "': substituted "
+           << num_substituted << " of " << num_adds
+           << " adds, estimated added latency " << added_latency
+           << " cycles\n";
   }
-  std::error_code ec;
-  raw_fd_ostream out(argv[1], ec, sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
 }
 
-void RunOnModule(Module& module) {
-  for (auto& func : module) RunOnFunction(func);
+void SubstituteAdd(BinaryOperator* bin_op) {
+  auto* ty = bin_op->getType();
+  const unsigned bit_width = ty->getScalarSizeInBits();
+
+  // A uniform API for creating instructions and inserting them into basic
+  // blocks
+  IRBuilder<> builder(bin_op);
+  // Every instruction `builder` inserts lands between `prev` and `bin_op`
+  auto* prev = bin_op->getPrevNode();
+
+  // Constants used in building the instruction for substitution. The outer
+  // affine maps `x -> x * m + c` and `x -> x * m^-1 - c * m^-1` cancel each
+  // other out modulo 2^n, which holds for any odd `m`. For 8-bit types these
+  // are the original 39, 23, 151 and 111.
+  APInt mul_val(bit_width, 39), add_val(bit_width, 23);
+  APInt inv_mul_val = GetInverseModPow2(mul_val);
+  APInt inv_add_val = -(add_val * inv_mul_val);
+
+  auto val_2 = ConstantInt::get(ty, 2);
+  auto val_39 = ConstantInt::get(ty, mul_val);
+  auto val_23 = ConstantInt::get(ty, add_val);
+  auto val_151 = ConstantInt::get(ty, inv_mul_val);
+  auto val_111 = ConstantInt::get(ty, inv_add_val);
+
+  // Build an instruction representing `(((a ^ b) + 2 * (a & b)) * 39 + 23) *
+  // 151 + 111`
+  auto* new_inst =
+      // E = e5 + 111
+      BinaryOperator::CreateAdd(
+          // e5 = e4 * 151
+          builder.CreateMul(
+              // e4 = e2 + 23
+              builder.CreateAdd(
+                  // e3 = e2 * 39
+                  builder.CreateMul(
+                      // e2 = e0 + e1
+                      builder.CreateAdd(
+                          // e0 = a ^ b
+                          builder.CreateXor(bin_op->getOperand(0),
+                                            bin_op->getOperand(1)),
+                          // e1 = 2 * (a & b)
+                          builder.CreateMul(
+                              val_2, builder.CreateAnd(bin_op->getOperand(0),
+                                                       bin_op->getOperand(1)))),
+                      val_39),  // e3 = e2 * 39
+                  val_23),      // e4 = e2 + 23
+              val_151),         // e5 = e4 * 151
+          val_111);             // E = e5 + 111
+
+  // Tag the rewrite so that it can be verified later on
+  common::TagRewrite(prev, bin_op, new_inst);
+
+  dbgs() << *bin_op << " -> " << *new_inst << "\n";
+
+  // Replace `(a + b)` (original instructions) with `(((a ^ b) + 2 * (a & b))
+  // * 39 + 23) * 151 + 111` (the new instruction)
+  ReplaceInstWithInst(bin_op, new_inst);
 }
 
-void RunOnFunction(Function& func) {
-  for (auto& basic_block : func) RunOnBasicBlock(basic_block);
+APInt GetInverseModPow2(const APInt& val) {
+  assert(val[0] && "Only odd numbers are invertible modulo 2^n");
+  // Newton's iteration: `inv` is correct in the low 3 bits to start with (as
+  // val * val = 1 (mod 8) for odd values) and every step doubles that
+  APInt inv = val;
+  const APInt two(val.getBitWidth(), 2);
+  while ((val * inv).isOneValue() == false) inv *= two - val * inv;
+  return inv;
 }
 
-void RunOnBasicBlock(BasicBlock& basic_block) {
-  // Get a (rather naive) random number generator that will be used to decide
-  // whether to replace the current instruction or not.
-  std::mt19937_64 rng;
-  rng.seed(1234);
-  std::uniform_real_distribution<double> dist(0., 1.);
+unsigned EstimateMulLatency(Type* ty) {
+  const unsigned bit_width = ty->getScalarSizeInBits();
+  // Scalar multiplications that fit in a register: imul
+  if (ty->isVectorTy() == false) {
+    unsigned num_regs = (bit_width + 63) / 64;
+    return 3 * num_regs * num_regs;
+  }
+  // Vector multiplications: pmullw and pmulld are native, i8 is emulated
+  // with i16 multiplications plus shuffles and i64 (without AVX-512) with
+  // three pmuludq
+  if (bit_width <= 8) return 10;
+  if (bit_width <= 16) return 5;
+  if (bit_width <= 32) return 10;
+  return 15;
+}
 
-  // Loop over all instructions in the block. Replacing instructions requires
-  // iterators, hence a for-range loop wouldn't be suitable
-  for (auto inst = basic_block.begin(); inst != basic_block.end(); ++inst) {
-    // Skip non-binary (e.g. unary or compare) instructions
-    auto* bin_op = dyn_cast<BinaryOperator>(inst);
-    if (bin_op == nullptr) continue;
-
-    // Skip instructions other than add
-    if (bin_op->getOpcode() != Instruction::Add) continue;
-
-    // Skip if the result is not 8-bit wide (this implies that the operands are
-    // also 8-bit wide)
-    if (bin_op->getType()->isIntegerTy() == false ||
-        bin_op->getType()->getIntegerBitWidth() != 8)
-      continue;
-
-    // Use `kRatio` and `rng` to decide whether to substitude this particular
-    // 'add'
-    if (dist(rng) > kRatio) continue;
-
-    // A uniform API for creating instructions and inserting them into basic
-    // blocks
-    IRBuilder<> builder(bin_op);
-
-    // Constants used in building the instruction for substitution
-    auto val_2 = ConstantInt::get(bin_op->getType(), 2);
-    auto val_39 = ConstantInt::get(bin_op->getType(), 39);
-    auto val_23 = ConstantInt::get(bin_op->getType(), 23);
-    auto val_151 = ConstantInt::get(bin_op->getType(), 151);
-    auto val_111 = ConstantInt::get(bin_op->getType(), 111);
-
-    // Build an instruction representing `(((a ^ b) + 2 * (a & b)) * 39 + 23) *
-    // 151 + 111`
-    auto* new_inst =
-        // E = e5 + 111
-        BinaryOperator::CreateAdd(
-            // e5 = e4 * 151
-            builder.CreateMul(
-                // e4 = e2 + 23
-                builder.CreateAdd(
-                    // e3 = e2 * 39
-                    builder.CreateMul(
-                        // e2 = e0 + e1
-                        builder.CreateAdd(
-                            // e0 = a ^ b
-                            builder.CreateXor(bin_op->getOperand(0),
-                                              bin_op->getOperand(1)),
-                            // e1 = 2 * (a & b)
-                            builder.CreateMul(
-                                val_2,
-                                builder.CreateAnd(bin_op->getOperand(0),
-                                                  bin_op->getOperand(1)))),
-                        val_39),  // e3 = e2 * 39
-                    val_23),      // e4 = e2 + 23
-                val_151),         // e5 = e4 * 151
-            val_111);             // E = e5 + 111
-
-    dbgs() << *bin_op << " -> " << *new_inst << "\n";
-
-    // Replace `(a + b)` (original instructions) with `(((a ^ b) + 2 * (a & b))
-    // * 39 + 23) * 151 + 111` (the new instruction)
-    ReplaceInstWithInst(basic_block.getInstList(), inst, new_inst);
+unsigned EstimateAddedLatency(Type* ty) {
+  // Vectors wider than a (256-bit) register get split
+  unsigned num_parts = 1;
+  if (ty->isVectorTy()) {
+    uint64_t size_in_bits = ty->getPrimitiveSizeInBits().getFixedSize();
+    num_parts = std::max<uint64_t>(1, (size_in_bits + 255) / 256);
+  } else {
+    num_parts = (ty->getScalarSizeInBits() + 63) / 64;
   }
+
+  // The critical path of the substitution is `and -> mul -> add -> mul -> add
+  // -> mul -> add`, and it replaces a single 'add'
+  unsigned path_latency = 4 * num_parts + 3 * EstimateMulLatency(ty);
+  return path_latency - num_parts;
 }
@@ -1,10 +1,16 @@
 #ifndef LLVM_TUTOR_MBA_SUB_H_
 #define LLVM_TUTOR_MBA_SUB_H_
 
+#include <algorithm>
 #include <random>
+#include <utility>
+#include <vector>
 
-#include "llvm/IR/Constant.h"   // ConstantDataArray
-#include "llvm/IR/IRBuilder.h"  // IRBuilder
+#include "llvm/ADT/APInt.h"
+#include "llvm/Analysis/LoopInfo.h"  // LoopInfo
+#include "llvm/IR/Constant.h"        // ConstantDataArray
+#include "llvm/IR/Dominators.h"      // DominatorTree
+#include "llvm/IR/IRBuilder.h"       // IRBuilder
 #include "llvm/IR/Verifier.h"
 #include "llvm/IRReader/IRReader.h"                 // parseIRFile
 #include "llvm/Support/CommandLine.h"               // SMDiagnostic
@@ -12,7 +18,16 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"  // ReplaceInstWithInst
 
 void RunOnModule(llvm::Module& module);
-void RunOnFunction(llvm::Function& func);
-void RunOnBasicBlock(llvm::BasicBlock& basic_block);
+void RunOnFunction(llvm::Function& func, std::mt19937_64& rng);
+// Replaces the (scalar or vector) integer 'add' `bin_op` with an equivalent
+// mixed boolean-arithmetic expression.
+void SubstituteAdd(llvm::BinaryOperator* bin_op);
+
+// Returns the inverse of the odd number `val` modulo 2^n (n = bit width).
+llvm::APInt GetInverseModPow2(const llvm::APInt& val);
+// Rough x86 latencies (in cycles) of a multiplication of type `ty` and of the
+// critical path added by `SubstituteAdd` to an 'add' of type `ty`.
+unsigned EstimateMulLatency(llvm::Type* ty);
+unsigned EstimateAddedLatency(llvm::Type* ty);
 
 #endif  // LLVM_TUTOR_MBA_SUB_H_
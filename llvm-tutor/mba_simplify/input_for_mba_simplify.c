@@ -0,0 +1,43 @@
+//=============================================================================
+// FILE:
+//      input_for_mba_simplify.c
+//
+// DESCRIPTION:
+//      Sample input file for the MBASimplify pass. Run the MBAAdd and MBASub
+//      passes on it first.
+//
+// License: MIT
+//=============================================================================
+#include <stdint.h>
+#include <stdlib.h>
+
+int8_t foo(int8_t a, int8_t b, int8_t c, int8_t d) {
+  int8_t e = c + d;
+  int8_t f = a - b;
+
+  return e + f;
+}
+
+int32_t bar(int32_t a, int32_t b) { return ((a | b) + (a & b)) * 3 - b; }
+
+// The rewritten adds feed a mul by a variable, which isn't linear: only the
+// subtree of each operand simplifies
+int32_t baz(int32_t a, int32_t b, int32_t c, int32_t d) {
+  return (a + b) * (c + d);
+}
+
+// Linear, but of more variables than a tree may have
+int32_t qux(int32_t a, int32_t b, int32_t c, int32_t d, int32_t e) {
+  return a + b + c + d + e;
+}
+
+// Constant operands end up in and/or/xor, where they vary per bit
+int32_t quux(int32_t a) { return (a + 1234) - 9; }
+
+int main(int argc, char *argv[]) {
+  int a = atoi(argv[1]), b = atoi(argv[2]), c = atoi(argv[3]),
+      d = atoi(argv[4]);
+
+  return foo(a, b, c, d) + bar(a, b) + baz(a, b, c, d) + qux(a, b, c, d, a) +
+         quux(a);
+}
@@ -0,0 +1,526 @@
+#include "mba_simplify.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+namespace {
+
+// Classification of the sub-expressions of an MBA tree. A bitwise expression is
+// built from variables with and/or/xor (and the constants 0 and -1, i.e. not,
+// while any other constant is taken as a variable of its own); a linear one
+// combines bitwise expressions with add/sub and multiplications by a
+// constant.
+enum class Kind { kConstant, kBitwise, kLinear, kNonLinear };
+
+// Returns the value of an integer constant or of a splat of one
+const APInt* GetConstantValue(const Value* val) {
+  const auto* constant = dyn_cast<Constant>(val);
+  if (constant == nullptr) return nullptr;
+  if (constant->getType()->isVectorTy())
+    constant = constant->getSplatValue();
+  const auto* constant_int = dyn_cast_or_null<ConstantInt>(constant);
+  return constant_int == nullptr ? nullptr : &constant_int->getValue();
+}
+
+bool IsSupportedOpcode(unsigned opcode) {
+  switch (opcode) {
+    case Instruction::Add:
+    case Instruction::Sub:
+    case Instruction::Mul:
+    case Instruction::And:
+    case Instruction::Or:
+    case Instruction::Xor: {
+      return true;
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
+// Returns true if `val` is a node of the tree that contains `user`
+bool IsInternalNode(const Value* val, const Instruction* user) {
+  const auto* bin_op = dyn_cast<BinaryOperator>(val);
+  return bin_op != nullptr && IsSupportedOpcode(bin_op->getOpcode()) &&
+         bin_op->getParent() == user->getParent() && bin_op->hasOneUse();
+}
+
+class Collector {
+ public:
+  explicit Collector(mba_simplify::LinearMba& expr) : expr_(expr) {}
+
+  Kind Visit(Value* val, const Instruction* user);
+
+ private:
+  mba_simplify::LinearMba& expr_;
+  DenseMap<Value*, Kind> kinds_;
+};
+
+Kind Collector::Visit(Value* val, const Instruction* user) {
+  auto iter = kinds_.find(val);
+  if (iter != kinds_.end()) return iter->second;
+
+  Kind kind = Kind::kNonLinear;
+  if (GetConstantValue(val) != nullptr) {
+    kind = Kind::kConstant;
+  } else if (val != expr_.root && IsInternalNode(val, user) == false) {
+    // Anything that isn't part of the tree is one of its variables
+    if (expr_.vars.size() == mba_simplify::kMaxNumVars)
+      return Kind::kNonLinear;
+    expr_.vars.push_back(val);
+    kind = Kind::kBitwise;
+  } else {
+    auto* bin_op = cast<BinaryOperator>(val);
+    Kind lhs = Visit(bin_op->getOperand(0), bin_op);
+    Kind rhs = Visit(bin_op->getOperand(1), bin_op);
+    expr_.nodes.push_back(bin_op);
+
+    // Constants that are the same in every bit are bitwise as they are. Any
+    // other constant differs per bit as a variable does, and the tree is just
+    // as linear in it: it becomes one, unless its complement already is (mba
+    // builds ~C, which gets folded).
+    auto is_bitwise = [this](Kind kind, Value* opnd) {
+      if (kind == Kind::kBitwise) return true;
+      if (kind != Kind::kConstant) return false;
+      const auto* imm = GetConstantValue(opnd);
+      if (imm->isNullValue() || imm->isAllOnesValue()) return true;
+      if (is_contained(expr_.vars, opnd) ||
+          is_contained(expr_.vars, ConstantExpr::getNot(cast<Constant>(opnd))))
+        return true;
+      if (expr_.vars.size() == mba_simplify::kMaxNumVars) return false;
+      expr_.vars.push_back(opnd);
+      return true;
+    };
+
+    switch (bin_op->getOpcode()) {
+      case Instruction::And:
+      case Instruction::Or:
+      case Instruction::Xor: {
+        if (is_bitwise(lhs, bin_op->getOperand(0)) &&
+            is_bitwise(rhs, bin_op->getOperand(1)) &&
+            (lhs != Kind::kConstant || rhs != Kind::kConstant))
+          kind = Kind::kBitwise;
+        break;
+      }
+      case Instruction::Add:
+      case Instruction::Sub: {
+        if (lhs != Kind::kNonLinear && rhs != Kind::kNonLinear)
+          kind = Kind::kLinear;
+        break;
+      }
+      case Instruction::Mul: {
+        if ((lhs == Kind::kConstant && rhs != Kind::kNonLinear) ||
+            (rhs == Kind::kConstant && lhs != Kind::kNonLinear))
+          kind = Kind::kLinear;
+        break;
+      }
+      default: {
+        break;
+      }
+    }
+  }
+
+  kinds_[val] = kind;
+  return kind;
+}
+
+// Counts the instructions needed to compute `val` on top of `vars`
+unsigned CountNewInsts(Value* val, ArrayRef<Value*> vars) {
+  SmallPtrSet<Value*, 16> visited;
+  SmallVector<Value*, 16> worklist = {val};
+  unsigned count = 0;
+  while (worklist.empty() == false) {
+    auto* inst = dyn_cast<Instruction>(worklist.pop_back_val());
+    if (inst == nullptr || is_contained(vars, inst) ||
+        visited.insert(inst).second == false)
+      continue;
+    ++count;
+    worklist.append(inst->op_begin(), inst->op_end());
+  }
+  return count;
+}
+
+// Emits `constant + sum(coeff * term)`, preferring add/sub over mul
+Value* EmitLinearCombination(IRBuilder<>& builder, Type* ty,
+                             ArrayRef<std::pair<APInt, Value*>> terms,
+                             APInt constant) {
+  Value* res = nullptr;
+
+  // Start from a term with coefficient 1 so that no negation is needed
+  SmallVector<std::pair<APInt, Value*>, 8> ordered(terms.begin(), terms.end());
+  std::stable_partition(ordered.begin(), ordered.end(),
+                        [](const std::pair<APInt, Value*>& term) {
+                          return term.first.isOneValue();
+                        });
+
+  for (auto& term : ordered) {
+    const APInt& coeff = term.first;
+    if (coeff.isNullValue()) continue;
+
+    if (coeff.isAllOnesValue()) {
+      if (res == nullptr) {
+        // Fold the constant into the negation: (c - term)
+        res = builder.CreateSub(ConstantInt::get(ty, constant), term.second);
+        constant = 0;
+      } else {
+        res = builder.CreateSub(res, term.second);
+      }
+      continue;
+    }
+
+    Value* scaled = coeff.isOneValue()
+                        ? term.second
+                        : builder.CreateMul(term.second,
+                                            ConstantInt::get(ty, coeff));
+    res = res == nullptr ? scaled : builder.CreateAdd(res, scaled);
+  }
+
+  if (res == nullptr) return ConstantInt::get(ty, constant);
+  if (constant.isNullValue() == false)
+    res = builder.CreateAdd(res, ConstantInt::get(ty, constant));
+  return res;
+}
+
+// Emits the bitwise function of (at most) two variables whose truth table is
+// `table` (bit `u` is the value for x = u & 1, y = u >> 1). Returns null if
+// it can't be done in a single instruction.
+Value* EmitBitwise(IRBuilder<>& builder, ArrayRef<Value*> vars,
+                   unsigned table) {
+  if (vars.size() == 1) return table == 0b10 ? vars[0] : nullptr;
+  switch (table) {
+    case 0b1010: {
+      return vars[0];
+    }
+    case 0b1100: {
+      return vars[1];
+    }
+    case 0b1000: {
+      return builder.CreateAnd(vars[0], vars[1]);
+    }
+    case 0b1110: {
+      return builder.CreateOr(vars[0], vars[1]);
+    }
+    case 0b0110: {
+      return builder.CreateXor(vars[0], vars[1]);
+    }
+    default: {
+      return nullptr;
+    }
+  }
+}
+
+// Folds the operations of constants, e.g. the `xor C, -1` that mba builds for
+// ~C, so that trees only have constants as leaves. Trees are within a block,
+// where operands come first.
+void FoldConstants(Function& func) {
+  for (auto& inst : make_early_inc_range(instructions(func))) {
+    auto* bin_op = dyn_cast<BinaryOperator>(&inst);
+    if (bin_op == nullptr || IsSupportedOpcode(bin_op->getOpcode()) == false ||
+        GetConstantValue(bin_op->getOperand(0)) == nullptr ||
+        GetConstantValue(bin_op->getOperand(1)) == nullptr)
+      continue;
+    bin_op->replaceAllUsesWith(
+        ConstantExpr::get(bin_op->getOpcode(),
+                          cast<Constant>(bin_op->getOperand(0)),
+                          cast<Constant>(bin_op->getOperand(1))));
+    bin_op->eraseFromParent();
+  }
+}
+
+void EraseIfDead(Value* val) {
+  auto* inst = dyn_cast<Instruction>(val);
+  if (inst != nullptr && inst->use_empty())
+    RecursivelyDeleteTriviallyDeadInstructions(inst);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  common::Driver driver(argc, argv,
+                        "Simplifies linear mixed boolean-arithmetic expressions\n");
+
+  return driver.Run("mba_simplify", [](Module& module) {
+    mba_simplify::RunOnModule(module);
+    return true;
+  });
+}
+
+bool mba_simplify::CollectLinearMba(Instruction* root, LinearMba& expr) {
+  auto* bin_op = dyn_cast<BinaryOperator>(root);
+  if (bin_op == nullptr || IsSupportedOpcode(bin_op->getOpcode()) == false ||
+      bin_op->getType()->isIntOrIntVectorTy() == false)
+    return false;
+
+  expr = LinearMba();
+  expr.root = root;
+  Collector collector(expr);
+  auto kind = collector.Visit(root, root);
+  return (kind == Kind::kBitwise || kind == Kind::kLinear) &&
+         expr.vars.empty() == false;
+}
+
+APInt mba_simplify::Evaluate(const LinearMba& expr,
+                             ArrayRef<APInt> var_values) {
+  DenseMap<const Value*, APInt> values;
+  for (unsigned idx = 0; idx < expr.vars.size(); ++idx)
+    values[expr.vars[idx]] = var_values[idx];
+
+  // Constants are variables (or their complement) as operands of and/or/xor
+  // only
+  auto get_value = [&values](Value* val, bool is_bitwise) {
+    const auto* imm = GetConstantValue(val);
+    if (imm == nullptr) return values.lookup(val);
+    if (is_bitwise) {
+      auto iter = values.find(val);
+      if (iter != values.end()) return iter->second;
+      iter = values.find(ConstantExpr::getNot(cast<Constant>(val)));
+      if (iter != values.end()) return ~iter->second;
+    }
+    return *imm;
+  };
+
+  for (const auto* node : expr.nodes) {
+    const bool is_bitwise = node->isBitwiseLogicOp();
+    APInt lhs = get_value(node->getOperand(0), is_bitwise);
+    APInt rhs = get_value(node->getOperand(1), is_bitwise);
+    switch (node->getOpcode()) {
+      case Instruction::Add: {
+        values[node] = lhs + rhs;
+        break;
+      }
+      case Instruction::Sub: {
+        values[node] = lhs - rhs;
+        break;
+      }
+      case Instruction::Mul: {
+        values[node] = lhs * rhs;
+        break;
+      }
+      case Instruction::And: {
+        values[node] = lhs & rhs;
+        break;
+      }
+      case Instruction::Or: {
+        values[node] = lhs | rhs;
+        break;
+      }
+      case Instruction::Xor: {
+        values[node] = lhs ^ rhs;
+        break;
+      }
+      default: {
+        llvm_unreachable("Unsupported MBA opcode");
+      }
+    }
+  }
+
+  return values.lookup(expr.root);
+}
+
+SmallVector<APInt, 1 << mba_simplify::kMaxNumVars>
+mba_simplify::ComputeCoefficients(const LinearMba& expr) {
+  const unsigned num_vars = expr.vars.size();
+  const unsigned bit_width = expr.root->getType()->getScalarSizeInBits();
+
+  // STEP 1: Evaluate the expression with every variable set to 0 or 1. Bit 0
+  // of the result is what the expression computes per bit for this
+  // combination of variable bits, while every other bit sees all variables
+  // set to 0. Since e(u) = F(u) + (2^n - 2) * F(0) for the per-bit function
+  // F, F(u) = e(u) - 2 * e(0).
+  SmallVector<APInt, 1 << kMaxNumVars> coeffs;
+  SmallVector<APInt, kMaxNumVars> var_values(num_vars, APInt(bit_width, 0));
+  for (unsigned u = 0; u < (1U << num_vars); ++u) {
+    for (unsigned idx = 0; idx < num_vars; ++idx)
+      var_values[idx] = APInt(bit_width, (u >> idx) & 1);
+    coeffs.push_back(Evaluate(expr, var_values));
+  }
+  APInt twice_at_zero = coeffs[0] * 2;
+  for (auto& coeff : coeffs) coeff -= twice_at_zero;
+
+  // STEP 2: Move from the truth-table basis to the basis of conjunctions
+  // (Moebius transform): coeffs[S] = sum_{T in S} (-1)^{|S| - |T|} F(T)
+  for (unsigned idx = 0; idx < num_vars; ++idx) {
+    for (unsigned u = 0; u < (1U << num_vars); ++u) {
+      if ((u >> idx) & 1) coeffs[u] -= coeffs[u ^ (1U << idx)];
+    }
+  }
+
+  return coeffs;
+}
+
+bool mba_simplify::Simplify(LinearMba& expr) {
+  auto* root = expr.root;
+  auto* ty = root->getType();
+  const unsigned num_vars = expr.vars.size();
+  auto coeffs = ComputeCoefficients(expr);
+
+  IRBuilder<> builder(root);
+
+  // Candidate 1: the expression in the basis of conjunctions. The variables
+  // that are constants are 0 or 1 in every bit, so they rather give every
+  // conjunction of the others a coefficient per bit: a term per coefficient,
+  // masked to its bits.
+  const unsigned bit_width = ty->getScalarSizeInBits();
+  unsigned constant_vars = 0;
+  for (unsigned idx = 0; idx < num_vars; ++idx) {
+    if (GetConstantValue(expr.vars[idx]) != nullptr) constant_vars |= 1U << idx;
+  }
+  APInt constant = -coeffs[0];
+  SmallVector<std::pair<APInt, Value*>, 1 << kMaxNumVars> terms;
+  for (unsigned set = 0; set < (1U << num_vars); ++set) {
+    if ((set & constant_vars) != 0) continue;
+
+    // Bits of every coefficient of the conjunction of `set`
+    SmallVector<std::pair<APInt, APInt>, 4> masks;
+    for (unsigned bit = 0; bit < bit_width; ++bit) {
+      unsigned ones = 0;
+      for (unsigned idx = 0; idx < num_vars; ++idx) {
+        if (((constant_vars >> idx) & 1) &&
+            (*GetConstantValue(expr.vars[idx]))[bit])
+          ones |= 1U << idx;
+      }
+      APInt coeff(bit_width, 0);
+      for (unsigned subset = ones;; subset = (subset - 1) & ones) {
+        if ((set | subset) != 0) coeff += coeffs[set | subset];
+        if (subset == 0) break;
+      }
+      if (coeff.isNullValue()) continue;
+      auto iter = std::find_if(masks.begin(), masks.end(),
+                               [&coeff](const std::pair<APInt, APInt>& mask) {
+                                 return mask.first == coeff;
+                               });
+      if (iter == masks.end())
+        iter = masks.insert(masks.end(), {coeff, APInt(bit_width, 0)});
+      iter->second.setBit(bit);
+    }
+    if (masks.empty()) continue;
+
+    Value* conjunction = nullptr;
+    for (unsigned idx = 0; idx < num_vars; ++idx) {
+      if (((set >> idx) & 1) == 0) continue;
+      conjunction = conjunction == nullptr
+                        ? expr.vars[idx]
+                        : builder.CreateAnd(conjunction, expr.vars[idx]);
+    }
+    for (const auto& mask : masks) {
+      if (conjunction == nullptr) {
+        constant += mask.first * mask.second;
+      } else if (mask.second.isAllOnesValue()) {
+        terms.emplace_back(mask.first, conjunction);
+      } else {
+        terms.emplace_back(mask.first,
+                           builder.CreateAnd(conjunction,
+                                             ConstantInt::get(ty, mask.second)));
+      }
+    }
+  }
+  Value* best = EmitLinearCombination(builder, ty, terms, constant);
+  unsigned best_cost = CountNewInsts(best, expr.vars);
+
+  // Candidate 2: `c + m * B(x, y)` for a single bitwise operation B. This is
+  // the case when the per-bit function F only takes two values.
+  if (num_vars <= 2) {
+    // Undo the Moebius transform to get back the per-bit values
+    SmallVector<APInt, 4> per_bit(coeffs.begin(), coeffs.end());
+    for (unsigned idx = 0; idx < num_vars; ++idx) {
+      for (unsigned u = 0; u < (1U << num_vars); ++u) {
+        if ((u >> idx) & 1) per_bit[u] += per_bit[u ^ (1U << idx)];
+      }
+    }
+
+    const APInt& low = per_bit[0];
+    const APInt* high = nullptr;
+    unsigned table = 0;
+    bool two_valued = true;
+    for (unsigned u = 0; u < per_bit.size(); ++u) {
+      if (per_bit[u] == low) continue;
+      if (high != nullptr && per_bit[u] != *high) two_valued = false;
+      high = &per_bit[u];
+      table |= 1U << u;
+    }
+
+    if (two_valued && high != nullptr) {
+      Value* bitwise = EmitBitwise(builder, expr.vars, table);
+      if (bitwise != nullptr) {
+        auto* candidate =
+            EmitLinearCombination(builder, ty, {{*high - low, bitwise}}, -low);
+        unsigned cost = CountNewInsts(candidate, expr.vars);
+        if (cost < best_cost) std::swap(best, candidate);
+        best_cost = std::min(best_cost, cost);
+        EraseIfDead(candidate);
+      }
+    }
+  }
+
+  if (best_cost >= expr.nodes.size()) {
+    EraseIfDead(best);
+    return false;
+  }
+
+  dbgs() << *root << " -> " << *best << "\n";
+  root->replaceAllUsesWith(best);
+  // `best` may also be one of the variables or a constant
+  if (best_cost != 0) best->takeName(root);
+  RecursivelyDeleteTriviallyDeadInstructions(root);
+  return true;
+}
+
+// Simplifies the tree rooted at `root` or, if it isn't a linear MBA (e.g. a
+// rewritten add that feeds a mul, or a tree of too many variables), the
+// subtrees of its operands
+static void SimplifyTree(Instruction* root) {
+  mba_simplify::LinearMba expr;
+  if (mba_simplify::CollectLinearMba(root, expr)) {
+    mba_simplify::Simplify(expr);
+    return;
+  }
+  auto* bin_op = dyn_cast<BinaryOperator>(root);
+  if (bin_op == nullptr || IsSupportedOpcode(bin_op->getOpcode()) == false)
+    return;
+  // Taken first: simplifying a subtree replaces the operand. The subtrees
+  // don't share nodes, as these only have one use.
+  Value* lhs = bin_op->getOperand(0);
+  Value* rhs = bin_op->getOperand(1);
+  for (auto* opnd : {lhs, rhs}) {
+    if (IsInternalNode(opnd, bin_op)) SimplifyTree(cast<Instruction>(opnd));
+  }
+}
+
+void mba_simplify::RunOnModule(Module& module) {
+  for (auto& func : module) {
+    if (func.isDeclaration()) continue;
+    common::ScopedEvent event("mba_simplify", func);
+    unsigned num_eliminated = RunOnFunction(func);
+    errs() << "MBA simplify '" << func.getName() << "': " << num_eliminated
+           << " instructions eliminated\n";
+  }
+}
+
+unsigned mba_simplify::RunOnFunction(Function& func) {
+  unsigned num_insts_before = func.getInstructionCount();
+  FoldConstants(func);
+
+  // Collect the roots first: simplifying a tree deletes its internal nodes,
+  // and the variables that cancel out, which may be later roots
+  SmallVector<WeakTrackingVH, 16> roots;
+  for (auto& basic_block : func) {
+    for (auto& inst : basic_block) {
+      if (inst.hasOneUse() &&
+          IsInternalNode(&inst, cast<Instruction>(*inst.user_begin())) &&
+          IsSupportedOpcode(cast<Instruction>(*inst.user_begin())->getOpcode()))
+        continue;
+      roots.push_back(&inst);
+    }
+  }
+
+  for (auto& root : roots) {
+    if (auto* inst = dyn_cast_or_null<Instruction>(root)) SimplifyTree(inst);
+  }
+
+  // Simplifying may also leave some of the variables dead, so count what's
+  // left rather than what was replaced
+  return num_insts_before - func.getInstructionCount();
+}
@@ -0,0 +1,61 @@
+#ifndef LLVM_TUTOR_MBA_SIMPLIFY_H_
+#define LLVM_TUTOR_MBA_SIMPLIFY_H_
+
+#include "llvm/ADT/APInt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"  // ConstantInt
+#include "llvm/IR/IRBuilder.h"  // IRBuilder
+#include "llvm/IR/InstIterator.h"  // instructions()
+#include "llvm/IR/ValueHandle.h"  // WeakTrackingVH
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"    // parseIRFile
+#include "llvm/Support/CommandLine.h"  // SMDiagnostic
+#include "llvm/Support/Debug.h"        // dbgs
+#include "llvm/Transforms/Utils/Local.h"  // RecursivelyDeleteTriviallyDead...
+
+namespace mba_simplify {
+
+// Largest number of variables of an expression that will be simplified. The
+// signature vector has 2^kMaxNumVars entries.
+static constexpr unsigned kMaxNumVars = 4;
+
+// A linear mixed boolean-arithmetic expression, i.e. a linear combination (with
+// constant coefficients) of bitwise functions of `vars`.
+struct LinearMba {
+  llvm::Instruction* root = nullptr;
+  // Every instruction of the expression, operands before users
+  llvm::SmallVector<llvm::Instruction*, 16> nodes;
+  // Inputs of the expression, in the order they were first reached. These
+  // include the constant operands of and/or/xor other than 0 and -1, which
+  // are constants rather than variables as operands of add/sub/mul, and whose
+  // complement is the complement of the variable.
+  llvm::SmallVector<llvm::Value*, kMaxNumVars> vars;
+};
+
+// Collects the expression tree rooted at `root`. Internal nodes are integer
+// add/sub/mul/and/or/xor instructions that are only used within the tree (in
+// the same basic block). Returns false if the tree isn't a linear MBA.
+bool CollectLinearMba(llvm::Instruction* root, LinearMba& expr);
+
+// Evaluates `expr` with `vars[i]` set to `var_values[i]`.
+llvm::APInt Evaluate(const LinearMba& expr,
+                     llvm::ArrayRef<llvm::APInt> var_values);
+
+// Computes the coefficients of `expr` in the basis of conjunctions of its
+// variables (signature vector method): for every subset S of the variables
+// (bit i of the index set <=> variable i in S), `expr` equals
+//   -coeffs[0] + sum_{S != {}} coeffs[S] * AND_{i in S} vars[i]
+llvm::SmallVector<llvm::APInt, 1 << kMaxNumVars> ComputeCoefficients(
+    const LinearMba& expr);
+
+// Replaces `expr` with a cheaper equivalent, if there's one.
+bool Simplify(LinearMba& expr);
+
+void RunOnModule(llvm::Module& module);
+// Returns the number of instructions eliminated from `func`.
+unsigned RunOnFunction(llvm::Function& func);
+
+}  // namespace mba_simplify
+
+#endif  // LLVM_TUTOR_MBA_SIMPLIFY_H_
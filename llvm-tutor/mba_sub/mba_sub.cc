@@ -1,28 +1,22 @@
 #include "mba_sub.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
+#include "common/mba_metadata.h"
 
 int main(int argc, char** argv) {
-  llvm::LLVMContext context;
-  llvm::SMDiagnostic err;
-  auto owner = llvm::parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    llvm::errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
-
-  RunOnModule(*owner);
+  common::Driver driver(argc, argv, "Obfuscates integer subtractions\n");
 
-  if (llvm::verifyModule(*owner, &llvm::errs())) {
-    llvm::errs() << "Generated module is not correct!\n";
-    return 1;
-  }
-  std::error_code ec;
-  llvm::raw_fd_ostream out(argv[1], ec, llvm::sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
+  return driver.Run("mba_sub", [](llvm::Module& module) {
+    RunOnModule(module);
+    return true;
+  });
 }
 
 void RunOnModule(llvm::Module& module) {
-  for (auto& func : module) RunOnFunction(func);
+  for (auto& func : module) {
+    common::ScopedEvent event("mba_sub", func);
+    RunOnFunction(func);
+  }
 }
 
 void RunOnFunction(llvm::Function& func) {
@@ -44,8 +38,11 @@ void RunOnBasicBlock(llvm::BasicBlock& basic_block) {
       continue;
 
     // A uniform API for creating instructions and inserting them into basic
-    // blocks.
-    IRBuilder<> builder(bin_op);
+    // blocks. Constant operands must not be folded (`~C` into a constant),
+    // otherwise the rewrite can't be verified.
+    IRBuilder<NoFolder> builder(bin_op);
+    // Every instruction `builder` inserts lands between `prev` and `bin_op`
+    auto* prev = bin_op->getPrevNode();
 
     // Create an instruction representing (a + ~b) + 1
     Instruction* new_val = BinaryOperator::CreateAdd(
@@ -53,6 +50,9 @@ void RunOnBasicBlock(llvm::BasicBlock& basic_block) {
                           builder.CreateNot(bin_op->getOperand(1))),
         ConstantInt::get(bin_op->getType(), 1));
 
+    // Tag the rewrite so that it can be verified later on
+    common::TagRewrite(prev, bin_op, new_val);
+
     dbgs() << *bin_op << " -> " << *new_val << "\n";
 
     // Replace `(a - b)` (original instructions) with `(a + ~b) + 1` (the new
@@ -3,6 +3,7 @@
 
 #include "llvm/IR/Constant.h"   // ConstantDataArray
 #include "llvm/IR/IRBuilder.h"  // IRBuilder
+#include "llvm/IR/NoFolder.h"   // NoFolder
 #include "llvm/IR/Verifier.h"
 #include "llvm/IRReader/IRReader.h"                 // parseIRFile
 #include "llvm/Support/CommandLine.h"               // SMDiagnostic
@@ -0,0 +1,31 @@
+//=============================================================================
+// FILE:
+//      input_for_mba_verify.c
+//
+// DESCRIPTION:
+//      Sample input file for the MBAVerify tool. Run the MBAAdd and MBASub
+//      passes on it first.
+//
+// License: MIT
+//=============================================================================
+#include <stdint.h>
+#include <stdlib.h>
+
+int8_t foo(int8_t a, int8_t b, int8_t c, int8_t d) {
+  int8_t e = c + d;
+  int8_t f = a - b;
+
+  return e + f;
+}
+
+int32_t bar(int32_t a, int32_t b) { return (a - b) - (b - a); }
+
+// Constant operands of the original operations
+int32_t baz(int32_t a) { return (a - 9) + (7 - a); }
+
+int main(int argc, char *argv[]) {
+  int a = atoi(argv[1]), b = atoi(argv[2]), c = atoi(argv[3]),
+      d = atoi(argv[4]);
+
+  return foo(a, b, c, d) + bar(a, b) + baz(c);
+}
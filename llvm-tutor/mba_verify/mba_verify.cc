@@ -0,0 +1,414 @@
+#include "mba_verify.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
+#include "common/mba_metadata.h"
+
+#include <random>
+#include <type_traits>
+
+using namespace llvm;
+
+static cl::opt<unsigned> exhaustive_bits(
+    "exhaustive-bits",
+    cl::desc("Check every input if the input space is at most this many bits "
+             "(less than 64)"),
+    cl::init(16));
+static cl::opt<uint64_t> num_samples(
+    "samples", cl::desc("Number of random inputs for wider expressions"),
+    cl::init(1 << 16));
+static cl::opt<uint64_t> seed("seed", cl::desc("Seed for the random inputs"),
+                              cl::init(1234));
+
+// Number of inputs evaluated at once. Every operation of an expression is
+// applied to a whole batch in a tight loop, which the compiler vectorizes.
+static constexpr size_t kBatchSize = 4096;
+
+namespace {
+
+template <typename T>
+class BatchEvaluator {
+ public:
+  BatchEvaluator(const mba_verify::Expr& expr, T mask)
+      : expr_(expr), mask_(mask), slots_(expr.ops.size()) {
+    for (auto& slot : slots_) slot.resize(kBatchSize);
+  }
+
+  // Evaluates the expression on `size` inputs and returns the result slot
+  const T* Eval(const T* arg0, const T* arg1, size_t size);
+
+ private:
+  const mba_verify::Expr& expr_;
+  const T mask_;
+  std::vector<std::vector<T>> slots_;
+};
+
+template <typename T>
+const T* BatchEvaluator<T>::Eval(const T* arg0, const T* arg1, size_t size) {
+  using mba_verify::OpKind;
+  // uint8_t and uint16_t would be promoted to int, whose products and shifts
+  // can overflow: compute in at least unsigned, then truncate
+  using Wide = typename std::common_type<T, unsigned>::type;
+  const T mask = mask_;
+  for (size_t idx = 0; idx < expr_.ops.size(); ++idx) {
+    const auto& op = expr_.ops[idx];
+    T* dst = slots_[idx].data();
+    const T* lhs = slots_[op.lhs].data();
+    const T* rhs = slots_[op.rhs].data();
+    switch (op.kind) {
+      case OpKind::kArg: {
+        const T* arg = op.lhs == 0 ? arg0 : arg1;
+        for (size_t i = 0; i < size; ++i) dst[i] = arg[i];
+        break;
+      }
+      case OpKind::kConst: {
+        for (size_t i = 0; i < size; ++i) dst[i] = T(op.imm);
+        break;
+      }
+      case OpKind::kAdd: {
+        for (size_t i = 0; i < size; ++i) dst[i] = T(lhs[i] + rhs[i]) & mask;
+        break;
+      }
+      case OpKind::kSub: {
+        for (size_t i = 0; i < size; ++i) dst[i] = T(lhs[i] - rhs[i]) & mask;
+        break;
+      }
+      case OpKind::kMul: {
+        for (size_t i = 0; i < size; ++i) dst[i] = T(Wide(lhs[i]) * rhs[i]) & mask;
+        break;
+      }
+      case OpKind::kAnd: {
+        for (size_t i = 0; i < size; ++i) dst[i] = lhs[i] & rhs[i];
+        break;
+      }
+      case OpKind::kOr: {
+        for (size_t i = 0; i < size; ++i) dst[i] = lhs[i] | rhs[i];
+        break;
+      }
+      case OpKind::kXor: {
+        for (size_t i = 0; i < size; ++i) dst[i] = lhs[i] ^ rhs[i];
+        break;
+      }
+      case OpKind::kShl: {
+        for (size_t i = 0; i < size; ++i) dst[i] = T(Wide(lhs[i]) << op.imm) & mask;
+        break;
+      }
+      case OpKind::kLShr: {
+        for (size_t i = 0; i < size; ++i) dst[i] = lhs[i] >> op.imm;
+        break;
+      }
+    }
+  }
+  return slots_.back().data();
+}
+
+template <typename T>
+mba_verify::CheckResult CheckImpl(const mba_verify::Expr& rewritten,
+                                  const mba_verify::Expr& reference,
+                                  unsigned exhaustive_bits,
+                                  uint64_t num_samples, uint64_t seed) {
+  mba_verify::CheckResult res;
+  const unsigned bit_width = rewritten.bit_width;
+  const uint64_t mask = bit_width == 64 ? ~0ULL : (1ULL << bit_width) - 1;
+
+  BatchEvaluator<T> eval_rewritten(rewritten, T(mask));
+  BatchEvaluator<T> eval_reference(reference, T(mask));
+  std::vector<T> arg0(kBatchSize), arg1(kBatchSize);
+
+  // Evaluates the batch in `arg0`/`arg1` and records the first mismatch.
+  // Returns false once a counterexample has been found.
+  auto run_batch = [&](size_t size) {
+    const T* lhs = eval_rewritten.Eval(arg0.data(), arg1.data(), size);
+    const T* rhs = eval_reference.Eval(arg0.data(), arg1.data(), size);
+    res.num_inputs += size;
+    // Reduce the whole batch first, only look for the culprit on a mismatch
+    T diff = 0;
+    for (size_t i = 0; i < size; ++i) diff |= lhs[i] ^ rhs[i];
+    if (diff == 0) return true;
+    for (size_t i = 0; i < size; ++i) {
+      if (lhs[i] == rhs[i]) continue;
+      res.equivalent = false;
+      res.counterexample[0] = arg0[i];
+      res.counterexample[1] = arg1[i];
+      break;
+    }
+    return false;
+  };
+
+  const unsigned input_bits = bit_width * rewritten.num_args;
+  if (input_bits <= exhaustive_bits && input_bits < 64) {
+    // Enumerate every input: argument 0 takes the low `bit_width` bits of the
+    // counter, argument 1 the high ones.
+    res.exhaustive = true;
+    const uint64_t num_inputs = 1ULL << input_bits;
+    for (uint64_t base = 0; base < num_inputs; base += kBatchSize) {
+      size_t size = std::min<uint64_t>(kBatchSize, num_inputs - base);
+      for (size_t i = 0; i < size; ++i) {
+        arg0[i] = T((base + i) & mask);
+        arg1[i] = rewritten.num_args == 2 ? T((base + i) >> bit_width) : 0;
+      }
+      if (run_batch(size) == false) break;
+    }
+    return res;
+  }
+
+  // Corner cases first: they are where identities that only hold for some
+  // widths or some ranges usually break.
+  const uint64_t sign_bit = 1ULL << (bit_width - 1);
+  const uint64_t corners[] = {0,        1,        2,           mask,
+                              mask - 1, sign_bit, sign_bit - 1, sign_bit + 1};
+  size_t size = 0;
+  for (auto lhs : corners) {
+    for (auto rhs : corners) {
+      arg0[size] = T(lhs & mask);
+      arg1[size] = T(rhs & mask);
+      ++size;
+    }
+  }
+  if (run_batch(size) == false) return res;
+
+  std::mt19937_64 rng(seed);
+  for (uint64_t done = 0; done < num_samples; done += kBatchSize) {
+    size = std::min<uint64_t>(kBatchSize, num_samples - done);
+    for (size_t i = 0; i < size; ++i) {
+      arg0[i] = T(rng() & mask);
+      arg1[i] = T(rng() & mask);
+    }
+    if (run_batch(size) == false) break;
+  }
+  return res;
+}
+
+// Returns the value of an integer constant or of a splat of one
+bool GetConstantValue(const Value* val, uint64_t& imm) {
+  const auto* constant = dyn_cast<Constant>(val);
+  if (constant == nullptr) return false;
+  if (constant->getType()->isVectorTy())
+    constant = constant->getSplatValue();
+  const auto* constant_int = dyn_cast_or_null<ConstantInt>(constant);
+  if (constant_int == nullptr || constant_int->getBitWidth() > 64)
+    return false;
+  imm = constant_int->getZExtValue();
+  return true;
+}
+
+// Maps the name of a binary opcode to the corresponding operation (`kArg` if
+// the evaluator doesn't support it)
+mba_verify::OpKind GetOpKind(StringRef opcode) {
+  using mba_verify::OpKind;
+  return StringSwitch<OpKind>(opcode)
+      .Case("add", OpKind::kAdd)
+      .Case("sub", OpKind::kSub)
+      .Case("mul", OpKind::kMul)
+      .Case("and", OpKind::kAnd)
+      .Case("or", OpKind::kOr)
+      .Case("xor", OpKind::kXor)
+      .Default(OpKind::kArg);
+}
+
+class ExprLifter {
+ public:
+  explicit ExprLifter(mba_verify::Expr& expr) : expr_(expr) {}
+
+  // Returns false if `val` (or anything below it) can't be evaluated. The root
+  // carries the original opcode rather than the "internal" tag, hence
+  // `is_root`.
+  bool Lift(Value* val, unsigned& slot, bool is_root = false);
+
+ private:
+  unsigned Append(mba_verify::Op op) {
+    expr_.ops.push_back(op);
+    return expr_.ops.size() - 1;
+  }
+
+  mba_verify::Expr& expr_;
+  DenseMap<Value*, unsigned> slots_;
+};
+
+bool ExprLifter::Lift(Value* val, unsigned& slot, bool is_root) {
+  using mba_verify::Op;
+  using mba_verify::OpKind;
+
+  auto iter = slots_.find(val);
+  if (iter != slots_.end()) {
+    slot = iter->second;
+    return true;
+  }
+
+  uint64_t imm = 0;
+  if (GetConstantValue(val, imm)) {
+    slot = Append(Op{OpKind::kConst, 0, 0, imm});
+  } else if (is_root == false && common::IsRewriteNode(val) == false) {
+    // Anything that isn't part of the rewrite is an input of the expression
+    if (expr_.num_args == 2) return false;
+    slot = Append(Op{OpKind::kArg, expr_.num_args++, 0, 0});
+  } else {
+    auto* bin_op = dyn_cast<BinaryOperator>(val);
+    if (bin_op == nullptr) return false;
+
+    unsigned lhs = 0, rhs = 0;
+    switch (bin_op->getOpcode()) {
+      case Instruction::Shl:
+      case Instruction::LShr: {
+        uint64_t amount = 0;
+        if (GetConstantValue(bin_op->getOperand(1), amount) == false ||
+            amount >= expr_.bit_width)
+          return false;
+        if (Lift(bin_op->getOperand(0), lhs) == false) return false;
+        auto kind = bin_op->getOpcode() == Instruction::Shl ? OpKind::kShl
+                                                            : OpKind::kLShr;
+        slot = Append(Op{kind, lhs, 0, amount});
+        break;
+      }
+      case Instruction::Add:
+      case Instruction::Sub:
+      case Instruction::Mul:
+      case Instruction::And:
+      case Instruction::Or:
+      case Instruction::Xor: {
+        if (Lift(bin_op->getOperand(0), lhs) == false ||
+            Lift(bin_op->getOperand(1), rhs) == false)
+          return false;
+        slot = Append(Op{GetOpKind(bin_op->getOpcodeName()), lhs, rhs, 0});
+        break;
+      }
+      default: {
+        return false;
+      }
+    }
+  }
+
+  slots_[val] = slot;
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  common::Driver driver(argc, argv,
+                        "Verifies the rewrites of mba/mba_add/mba_sub\n");
+
+  // Every input is counted in a uint64_t
+  if (exhaustive_bits >= 64) {
+    errs() << "-exhaustive-bits must be less than 64\n";
+    return 1;
+  }
+
+  // The module is only checked, never written back
+  unsigned num_failures = 0;
+  if (driver.Load() == nullptr) return 1;
+  driver.RunPhase("mba_verify", [&](Module& module) {
+    num_failures = mba_verify::RunOnModule(module);
+    return true;
+  });
+  return num_failures == 0 ? 0 : 1;
+}
+
+bool mba_verify::LiftExpr(Instruction* root, Expr& expr) {
+  auto* int_ty = dyn_cast<IntegerType>(root->getType()->getScalarType());
+  if (int_ty == nullptr || int_ty->getBitWidth() > 64) return false;
+
+  expr = Expr();
+  expr.bit_width = int_ty->getBitWidth();
+
+  ExprLifter lifter(expr);
+  for (unsigned idx = 0; idx < 2; ++idx) {
+    auto* operand = common::GetRewrittenOperand(*root, idx);
+    if (operand == nullptr || lifter.Lift(operand, expr.operands[idx]) == false)
+      return false;
+  }
+  unsigned slot = 0;
+  return lifter.Lift(root, slot, /*is_root=*/true) && expr.num_args != 0;
+}
+
+bool mba_verify::BuildReference(StringRef opcode, const Expr& rewritten,
+                                Expr& expr) {
+  OpKind kind = GetOpKind(opcode);
+  if (kind == OpKind::kArg) return false;
+
+  const unsigned lhs_slot = rewritten.operands[0];
+  const unsigned rhs_slot = rewritten.operands[1];
+  const Op& lhs = rewritten.ops[lhs_slot];
+  const Op& rhs = rewritten.ops[rhs_slot];
+  auto is_leaf = [](const Op& op) {
+    return op.kind == OpKind::kArg || op.kind == OpKind::kConst;
+  };
+  if (is_leaf(lhs) == false || is_leaf(rhs) == false) return false;
+  // Every argument of the rewrite must be an operand of the original
+  // operation
+  unsigned num_args = lhs.kind == OpKind::kArg;
+  if (rhs_slot != lhs_slot && rhs.kind == OpKind::kArg) ++num_args;
+  if (num_args != rewritten.num_args) return false;
+
+  expr = Expr();
+  expr.bit_width = rewritten.bit_width;
+  expr.num_args = rewritten.num_args;
+  expr.ops.push_back(lhs);
+  expr.ops.push_back(rhs);
+  expr.ops.push_back(Op{kind, 0, 1, 0});
+  return true;
+}
+
+mba_verify::CheckResult mba_verify::Check(const Expr& rewritten,
+                                          const Expr& reference,
+                                          unsigned exhaustive_bits,
+                                          uint64_t num_samples,
+                                          uint64_t seed) {
+  assert(rewritten.bit_width == reference.bit_width &&
+         rewritten.num_args == reference.num_args && "Mismatched expressions");
+  if (rewritten.bit_width <= 8)
+    return CheckImpl<uint8_t>(rewritten, reference, exhaustive_bits,
+                              num_samples, seed);
+  if (rewritten.bit_width <= 16)
+    return CheckImpl<uint16_t>(rewritten, reference, exhaustive_bits,
+                               num_samples, seed);
+  if (rewritten.bit_width <= 32)
+    return CheckImpl<uint32_t>(rewritten, reference, exhaustive_bits,
+                               num_samples, seed);
+  return CheckImpl<uint64_t>(rewritten, reference, exhaustive_bits,
+                             num_samples, seed);
+}
+
+unsigned mba_verify::RunOnModule(Module& module) {
+  unsigned num_failed = 0;
+  for (auto& func : module) {
+    common::ScopedEvent event("mba_verify", func);
+    num_failed += RunOnFunction(func);
+  }
+  return num_failed;
+}
+
+unsigned mba_verify::RunOnFunction(Function& func) {
+  unsigned num_checked = 0, num_exhaustive = 0, num_failed = 0;
+  unsigned num_unsupported = 0;
+
+  for (auto& inst : instructions(func)) {
+    auto opcode = common::GetRewrittenOpcode(inst);
+    if (opcode.empty()) continue;
+
+    Expr rewritten, reference;
+    if (LiftExpr(&inst, rewritten) == false ||
+        BuildReference(opcode, rewritten, reference) == false) {
+      errs() << "Cannot verify rewrite of '" << opcode << "':" << inst << "\n";
+      ++num_unsupported;
+      continue;
+    }
+
+    auto res = Check(rewritten, reference, exhaustive_bits, num_samples, seed);
+    ++num_checked;
+    if (res.exhaustive) ++num_exhaustive;
+    if (res.equivalent) continue;
+
+    ++num_failed;
+    errs() << "Rewrite of '" << opcode << "' is NOT equivalent:" << inst
+           << "\n  counterexample: arg0 = " << res.counterexample[0]
+           << ", arg1 = " << res.counterexample[1] << "\n";
+  }
+
+  if (num_checked != 0 || num_unsupported != 0) {
+    errs() << "MBA verify '" << func.getName() << "': " << num_checked
+           << " rewrites checked (" << num_exhaustive << " exhaustively), "
+           << num_failed << " failed, " << num_unsupported
+           << " unsupported\n";
+  }
+  return num_failed + num_unsupported;
+}
@@ -0,0 +1,90 @@
+#ifndef LLVM_TUTOR_MBA_VERIFY_H_
+#define LLVM_TUTOR_MBA_VERIFY_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSwitch.h"  // StringSwitch
+#include "llvm/IR/Constants.h"      // ConstantInt
+#include "llvm/IR/InstIterator.h"   // instructions()
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"    // parseIRFile
+#include "llvm/Support/CommandLine.h"  // cl::opt
+#include "llvm/Support/SourceMgr.h"    // SMDiagnostic
+
+namespace mba_verify {
+
+// Operations understood by the evaluator. Binary operations read two earlier
+// slots of the program, shifts read one slot and take the (constant) amount
+// from `imm`.
+enum class OpKind : uint8_t {
+  kArg,
+  kConst,
+  kAdd,
+  kSub,
+  kMul,
+  kAnd,
+  kOr,
+  kXor,
+  kShl,
+  kLShr,
+};
+
+struct Op {
+  OpKind kind;
+  // Slots of the operands (for `kArg`, the number of the argument)
+  unsigned lhs = 0;
+  unsigned rhs = 0;
+  // Value of `kConst`, amount of `kShl` and `kLShr`
+  uint64_t imm = 0;
+};
+
+// A straight-line integer expression over at most two arguments. Operations
+// are stored in topological order, the last one is the result.
+struct Expr {
+  unsigned bit_width = 0;
+  unsigned num_args = 0;
+  std::vector<Op> ops;
+  // Slots of the operands of the rewritten operation, arguments or constants
+  unsigned operands[2] = {0, 0};
+};
+
+struct CheckResult {
+  bool equivalent = true;
+  bool exhaustive = false;
+  uint64_t num_inputs = 0;
+  // First input on which the expressions disagree (valid if !equivalent)
+  uint64_t counterexample[2] = {0, 0};
+};
+
+// Lifts the expression tree rooted at `root`, the root of a rewrite, into
+// `expr`. Internal nodes of the tree are the instructions tagged as such by
+// the rewrite, everything else is a leaf (a constant or an argument). The
+// operands of the rewritten operation, as recorded by the rewrite, come
+// first: the non-constant ones are arguments 0 and 1. Returns false if the
+// tree cannot be evaluated.
+bool LiftExpr(llvm::Instruction* root, Expr& expr);
+
+// Builds `operand0 <opcode> operand1` over the operands of `rewritten`, so
+// that original operands that are constants are taken into account.
+bool BuildReference(llvm::StringRef opcode, const Expr& rewritten,
+                    Expr& expr);
+
+// Evaluates both expressions on every input if the input space has at most
+// `exhaustive_bits` bits, or on corner cases plus `num_samples` random inputs
+// otherwise. `exhaustive_bits` must be less than 64.
+CheckResult Check(const Expr& rewritten, const Expr& reference,
+                  unsigned exhaustive_bits, uint64_t num_samples,
+                  uint64_t seed);
+
+// Returns the number of rewrites that failed verification, plus those that
+// could not be verified (unsupported operations or types).
+unsigned RunOnModule(llvm::Module& module);
+unsigned RunOnFunction(llvm::Function& func);
+
+}  // namespace mba_verify
+
+#endif  // LLVM_TUTOR_MBA_VERIFY_H_
@@ -1,4 +1,6 @@
 #include "merge_bb.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
 
 using namespace llvm;
 
@@ -10,24 +12,12 @@ static int overall_num_of_updated_branch_targets = 0;
 static int GetNumNonDbgInstInBB(BasicBlock* bb);
 
 int main(int argc, char** argv) {
-  LLVMContext context;
-  SMDiagnostic err;
-  auto owner = parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
-
-  merge_bb::RunOnModule(*owner);
+  common::Driver driver(argc, argv, "Merges duplicate basic blocks\n");
 
-  if (verifyModule(*owner, &errs())) {
-    errs() << "Generated module is not correct!\n";
-    return 1;
-  }
-  std::error_code ec;
-  raw_fd_ostream out(argv[1], ec, sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
+  return driver.Run("merge_bb", [](Module& module) {
+    merge_bb::RunOnModule(module);
+    return true;
+  });
 }
 
 bool merge_bb::CanRemoveInst(const Instruction* inst) {
@@ -201,7 +191,10 @@ bool merge_bb::MergeDuplicatedBlock(BasicBlock* bb1,
 }
 
 void merge_bb::RunOnModule(Module& module) {
-  for (auto& func : module) RunOnFunction(func);
+  for (auto& func : module) {
+    common::ScopedEvent event("merge_bb", func);
+    RunOnFunction(func);
+  }
 }
 
 void merge_bb::RunOnFunction(Function& func) {
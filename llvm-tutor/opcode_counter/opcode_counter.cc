@@ -1,29 +1,27 @@
 #include "opcode_counter.h"
+#include "common/analysis_cache.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
+#include "common/results.h"
 
 int main(int argc, char** argv) {
-  llvm::LLVMContext context;
-  llvm::SMDiagnostic err;
-  auto owner = llvm::parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    llvm::outs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
-
-  RunOnModule(*owner);
+  common::Driver driver(argc, argv, "Counts the opcodes of every function\n");
 
-  if (llvm::verifyModule(*owner, &llvm::outs())) {
-    llvm::outs() << "Generated module is not correct!\n";
-    return 1;
-  }
-  std::error_code ec;
-  llvm::raw_fd_ostream out(argv[1], ec, llvm::sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
+  common::AnalysisCache cache("opcode_counter");
+  return driver.RunOnFunctions(
+      "opcode_counter",
+      [&](llvm::Function& function) { AnalyzeFunction(function, cache); });
 }
 
 void RunOnModule(llvm::Module& module) {
+  common::AnalysisCache cache("opcode_counter");
+  for (auto& function : module) AnalyzeFunction(function, cache);
+}
+
+void AnalyzeFunction(llvm::Function& function, common::AnalysisCache& cache) {
   using namespace llvm;
-  for (auto& function : module) {
+  common::ScopedEvent event("opcode_counter", function);
+  auto count_opcodes = [&] {
     StringMap<unsigned> opcode_map;
     for (auto& basic_block : function) {
       for (auto& instruction : basic_block) {
@@ -35,10 +33,27 @@ void RunOnModule(llvm::Module& module) {
         }
       }
     }
-    errs() << "Printing analysis 'OpcodeCounter Pass' for function '"
-           << function.getName() << "':\n";
-    PrintOpcodeCounterResult(errs(), opcode_map);
+    return opcode_map;
+  };
+
+  // Counting is cheaper than looking the function up in `cache`
+  auto& results = common::ResultWriter::Get();
+  if (results.enabled()) {
+    for (auto& opcode : count_opcodes())
+      results.Write({"opcode", function.getName(), -1, -1, opcode.first(),
+                     opcode.second});
+    return;
   }
+
+  errs() << cache.GetOrCompute(function, [&] {
+    StringMap<unsigned> opcode_map = count_opcodes();
+    std::string result;
+    raw_string_ostream out(result);
+    out << "Printing analysis 'OpcodeCounter Pass' for function '"
+        << function.getName() << "':\n";
+    PrintOpcodeCounterResult(out, opcode_map);
+    return out.str();
+  });
 }
 
 void PrintOpcodeCounterResult(llvm::raw_ostream& out_stream,
@@ -5,7 +5,12 @@
 #include "llvm/IRReader/IRReader.h"    // parseIRFile
 #include "llvm/Support/CommandLine.h"  // SMDiagnostic
 
+#include "common/analysis_cache.h"
+
 void RunOnModule(llvm::Module& module);
+// Prints the opcodes of `function`, counted or found in `cache`, or writes
+// them to -results
+void AnalyzeFunction(llvm::Function& function, common::AnalysisCache& cache);
 void PrintOpcodeCounterResult(llvm::raw_ostream& out_stream,
                               const llvm::StringMap<unsigned>& opcode_map);
 
@@ -1,41 +1,92 @@
 #include "riv.h"
+#include "common/analysis_cache.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
+#include "common/results.h"
 using namespace llvm;
 
 static void PrintRivResult(raw_ostream& out_stream,
                            const riv::RivResult& riv_map);
 
 int main(int argc, char** argv) {
-  LLVMContext context;
-  SMDiagnostic err;
-  auto owner = parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
+  common::Driver driver(argc, argv,
+                        "Lists the reachable integer values of every basic block\n");
 
-  riv::RunOnModule(*owner);
+  return driver.Analyze("riv",
+                        [](Module& module) { riv::RunOnModule(module); });
+}
 
-  if (verifyModule(*owner, &errs())) {
-    errs() << "Generated module is not correct!\n";
-    return 1;
+void riv::RunOnModule(Module& module) {
+  common::AnalysisCache cache("riv");
+  auto& results = common::ResultWriter::Get();
+  for (auto& func : module) {
+    common::ScopedEvent event("riv", func);
+    if (results.enabled()) {
+      if (func.isDeclaration() == false) WriteRecords(func, results);
+      continue;
+    }
+    errs() << cache.GetOrCompute(func, [&] {
+      std::string result;
+      raw_string_ostream out(result);
+      RunOnFunction(func, out);
+      return out.str();
+    });
   }
-  std::error_code ec;
-  raw_fd_ostream out(argv[1], ec, sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
 }
 
-void riv::RunOnModule(Module& module) {
-  for (auto& func : module) RunOnFunction(func);
+void riv::RunOnFunction(Function& func, raw_ostream& out) {
+  auto dominator_tree = DominatorTree(func);
+  RivResult res = BuildRiv(func, dominator_tree.getRootNode());
+  PrintRivResult(out, res);
 }
 
-void riv::RunOnFunction(Function& func) {
+void riv::WriteRecords(Function& func, common::ResultWriter& results) {
   auto dominator_tree = DominatorTree(func);
   RivResult res = BuildRiv(func, dominator_tree.getRootNode());
-  PrintRivResult(errs(), res);
+
+  // Values are named by their index in `func` rather than printed
+  DenseMap<const BasicBlock*, int64_t> block_indices;
+  DenseMap<const Value*, int64_t> inst_indices;
+  int64_t num_insts = 0;
+  for (auto& basic_block : func) {
+    int64_t block_index = block_indices.size();
+    block_indices[&basic_block] = block_index;
+    for (auto& inst : basic_block) inst_indices[&inst] = num_insts++;
+  }
+
+  // Arguments by number, then instructions by index, then globals by name, as
+  // the sets of `res` are in no particular order
+  auto get_id = [&](const Value* value) {
+    if (auto* arg = dyn_cast<Argument>(value))
+      return std::make_tuple(0, int64_t(arg->getArgNo()), StringRef());
+    auto it = inst_indices.find(value);
+    if (it != inst_indices.end())
+      return std::make_tuple(1, it->second, StringRef());
+    return std::make_tuple(2, int64_t(-1), value->getName());
+  };
+  std::vector<const Value*> values;
+  for (auto const& key_value : res) {
+    values.assign(key_value.second.begin(), key_value.second.end());
+    llvm::sort(values, [&](const Value* lhs, const Value* rhs) {
+      return get_id(lhs) < get_id(rhs);
+    });
+
+    int64_t block = block_indices.lookup(key_value.first);
+    for (const auto* value : values) {
+      auto id = get_id(value);
+      if (std::get<0>(id) == 0) {
+        results.Write(
+            {"riv", func.getName(), block, -1, "arg", std::get<1>(id)});
+      } else {
+        results.Write({"riv", func.getName(), block, std::get<1>(id),
+                       std::get<2>(id), 0});
+      }
+    }
+  }
 }
 
 riv::RivResult riv::BuildRiv(Function& func, NodeType cfg_root) {
+  common::ScopedEvent event("BuildRiv", func);
   RivResult result_map;
 
   // Initialise a double-ended queue that will be used to traverse all basic
@@ -11,6 +11,8 @@
 #include "llvm/Support/CommandLine.h"               // SMDiagnostic
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"  // ReplaceInstWithInst
 
+#include "common/results.h"
+
 namespace riv {
 
 using RivResult = llvm::MapVector<const llvm::BasicBlock*,
@@ -18,7 +20,10 @@ using RivResult = llvm::MapVector<const llvm::BasicBlock*,
 using NodeType = llvm::DomTreeNodeBase<llvm::BasicBlock>*;
 
 void RunOnModule(llvm::Module& module);
-void RunOnFunction(llvm::Function& func);
+// Prints the RIVs of every basic block of `func` to `out`
+void RunOnFunction(llvm::Function& func, llvm::raw_ostream& out);
+// Writes a record per RIV of every basic block of `func` to `results`
+void WriteRecords(llvm::Function& func, common::ResultWriter& results);
 RivResult BuildRiv(llvm::Function& func, NodeType cfg_root);
 
 }  // namespace riv
@@ -1,54 +1,115 @@
 #include "static_call_counter.h"
+#include "common/analysis_cache.h"
+#include "common/driver.h"
+#include "common/instrumentation.h"
+#include "common/results.h"
 
 static void PrintStaticCallCounterResult(
     llvm::raw_ostream& out_stream, const ResultStaticCallCounter& direct_calls);
 
 int main(int argc, char** argv) {
-  llvm::LLVMContext context;
-  llvm::SMDiagnostic err;
-  auto owner = llvm::parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    llvm::outs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
+  common::Driver driver(argc, argv,
+                        "Counts the direct function calls in the IR\n");
+
+  return driver.Analyze("static_call_counter",
+                        [](llvm::Module& module) { RunOnModule(module); });
+}
 
-  RunOnModule(*owner);
+// Adds the direct calls of `func` to `res`, callees in the order they first
+// appear
+static void CountCalls(llvm::Function& func, ResultStaticCallCounter& res) {
+  using namespace llvm;
+  for (auto& basic_block : func) {
+    for (auto& instruction : basic_block) {
+      // If this is a call instruction then call_base_ptr will be not null.
+      auto* call_base_ptr = dyn_cast<CallBase>(&instruction);
+      if (call_base_ptr == nullptr) continue;
+
+      // if call_base_ptr is a direct function call then direct_invoc_ptr
+      // will be not null.
+      auto direct_invoc_ptr = call_base_ptr->getCalledFunction();
+      if (direct_invoc_ptr == nullptr) continue;
 
-  if (llvm::verifyModule(*owner, &llvm::outs())) {
-    llvm::outs() << "Generated module is not correct!\n";
-    return 1;
+      // We have a direct function call - update the count for the
+      // function being called.
+      auto call_count = res.find(direct_invoc_ptr);
+      if (call_count == res.end())
+        call_count = res.insert(std::make_pair(direct_invoc_ptr, 0)).first;
+      ++call_count->second;
+    }
   }
-  std::error_code ec;
-  llvm::raw_fd_ostream out(argv[1], ec, llvm::sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
 }
 
-void RunOnModule(llvm::Module& module) {
+// Adds the direct calls of every function of `module` to `res`, through
+// `cache`. The calls of a function are cached as "<count> @<callee>" lines, or
+// "<count> #<number>" for unnamed callees, in the order the callees first
+// appear.
+static void CountCachedCalls(llvm::Module& module, common::AnalysisCache& cache,
+                             ResultStaticCallCounter& res) {
   using namespace llvm;
-  ResultStaticCallCounter res;
+  DenseMap<unsigned, Function*> unnamed_funcs;
   for (auto& func : module) {
-    for (auto& basic_block : func) {
-      for (auto& instruction : basic_block) {
-        // If this is a call instruction then call_base_ptr will be not null.
-        auto* call_base_ptr = dyn_cast<CallBase>(&instruction);
-        if (call_base_ptr == nullptr) continue;
-
-        // if call_base_ptr is a direct function call then direct_invoc_ptr will
-        // be not null.
-        auto direct_invoc_ptr = call_base_ptr->getCalledFunction();
-        if (direct_invoc_ptr == nullptr) continue;
+    if (func.hasName() == false)
+      unnamed_funcs[cache.GetUnnamedGlobalNumber(func)] = &func;
+  }
 
-        // We have a direct function call - update the count for the function
-        // being called.
-        auto call_count = res.find(direct_invoc_ptr);
-        if (call_count == res.end())
-          call_count = res.insert(std::make_pair(direct_invoc_ptr, 0)).first;
-        ++call_count->second;
+  for (auto& func : module) {
+    common::ScopedEvent event("static_call_counter", func);
+    auto func_calls = cache.GetOrCompute(func, [&] {
+      ResultStaticCallCounter func_res;
+      CountCalls(func, func_res);
+      std::string result;
+      raw_string_ostream out(result);
+      for (auto& call_count : func_res) {
+        out << call_count.second << " ";
+        if (call_count.first->hasName())
+          out << "@" << call_count.first->getName() << "\n";
+        else
+          out << "#" << cache.GetUnnamedGlobalNumber(*call_count.first)
+              << "\n";
       }
+      return out.str();
+    });
+
+    SmallVector<StringRef, 8> lines;
+    StringRef(func_calls).split(lines, '\n', /*MaxSplit=*/-1,
+                                /*KeepEmpty=*/false);
+    for (auto line : lines) {
+      unsigned count = 0, number = 0;
+      auto fields = line.split(' ');
+      if (fields.first.getAsInteger(10, count)) continue;
+      Function* callee = nullptr;
+      if (fields.second.consume_front("@"))
+        callee = module.getFunction(fields.second);
+      else if (fields.second.consume_front("#") &&
+               fields.second.getAsInteger(10, number) == false)
+        callee = unnamed_funcs.lookup(number);
+      if (callee != nullptr) res[callee] += count;
+    }
+  }
+}
+
+void RunOnModule(llvm::Module& module) {
+  using namespace llvm;
+  common::AnalysisCache cache("static_call_counter");
+  ResultStaticCallCounter res;
+  if (cache.enabled()) {
+    CountCachedCalls(module, cache, res);
+  } else {
+    for (auto& func : module) {
+      common::ScopedEvent event("static_call_counter", func);
+      CountCalls(func, res);
     }
   }
-  PrintStaticCallCounterResult(errs(), res);
+
+  auto& results = common::ResultWriter::Get();
+  if (results.enabled() == false) {
+    PrintStaticCallCounterResult(errs(), res);
+    return;
+  }
+  for (auto& call_count : res)
+    results.Write({"direct_calls", "", -1, -1, call_count.first->getName(),
+                   call_count.second});
 }
 
 static void PrintStaticCallCounterResult(
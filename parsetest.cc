@@ -12,63 +12,74 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 
+#include "llvm/ADT/STLExtras.h"      // make_early_inc_range
+#include "llvm/IR/InstIterator.h"     // instructions
 #include "llvm/Support/CommandLine.h"  // SMDiagnostic
 
+#include "common/driver.h"
+#include "common/function_filter.h"
+
 #include <iostream>
 #include <list>
 #include <string>
 
-void instrument(llvm::Module& M) {
+static llvm::cl::opt<std::string> Filter(
+    "filter", llvm::cl::desc("Only rewrite the functions matching this regex"),
+    llvm::cl::value_desc("regex"));
+static llvm::cl::opt<std::string> FilterList(
+    "filter-list",
+    llvm::cl::desc("Only rewrite the functions listed in this file"),
+    llvm::cl::value_desc("file"));
+
+void instrument(llvm::Function& F) {
     using namespace llvm;
-    Function& F = *M.getFunction("main");
-    for (BasicBlock& BB : F) {  // iterate every basic blocks in the `F` function
-        for (Instruction& Ins : BB) {  // iterate every instruction in the `BB` basic blocks
-            unsigned opcode = Ins.getOpcode();
-            switch (opcode) {
-                case Instruction::Add:
-                case Instruction::Sub: {
-                    Value* operand1 = Ins.getOperand(1);  // get the second operand
+    // one pass over every instruction of `F`, dispatching on the opcode
+    for (Instruction& Ins : make_early_inc_range(instructions(F))) {
+        unsigned opcode = Ins.getOpcode();
+        switch (opcode) {
+            case Instruction::Add:
+            case Instruction::Sub: {
+                Value* operand1 = Ins.getOperand(1);  // get the second operand
 
-                    // notice: `Value` is the basic type in llvm, just like
-                    // `Object` in Java or Python. So before using a `Value`,
-                    // you're better to downcast it.
-                    if (!isa<ConstantInt>(operand1))
-                        continue;
+                // notice: `Value` is the basic type in llvm, just like
+                // `Object` in Java or Python. So before using a `Value`,
+                // you're better to downcast it.
+                if (!isa<ConstantInt>(operand1))
+                    continue;
 
-                    // If you dont know what the `Value` is. You can print it!
-                    // llvm::outs() << "what the value? : " << operand1 << "\n";
+                // If you dont know what the `Value` is. You can print it!
+                // llvm::outs() << "what the value? : " << operand1 << "\n";
 
-                    ConstantInt* constint = cast<ConstantInt>(operand1);
-                    int v = constint->getSExtValue();
-                    ConstantInt* newConstint = ConstantInt::get(constint->getType(), -v);
-                    Ins.setOperand(1, newConstint);  // replace the second operand.
-                    break;
-                }
-                default:
-                    break;
+                // negate in the constant's own width, so that i64 constants
+                // don't get truncated to `int`
+                ConstantInt* constint = cast<ConstantInt>(operand1);
+                ConstantInt* newConstint = ConstantInt::get(constint->getContext(), -constint->getValue());
+                Ins.setOperand(1, newConstint);  // replace the second operand.
+                break;
             }
+            default:
+                break;
         }
     }
 }
 
-
-int main(int argc, char** argv) {
-    llvm::LLVMContext Context;
-    llvm::SMDiagnostic Err;
-    auto Owner = llvm::parseIRFile(argv[1], Err, Context);
-    if (!Owner) {
-        llvm::errs() << "ParseIRFile failed\n" << Err.getMessage() << "\n";
-        return 1;
+void instrument(llvm::Module& M, const common::FunctionFilter& filter) {
+    for (llvm::Function& F : M) {  // iterate every function of the `M` module
+        if (filter.Matches(F))
+            instrument(F);
     }
+}
 
-    instrument(*Owner);
 
-    if (llvm::verifyModule(*Owner, &llvm::errs())) {
-        llvm::errs() << "Generated module is not correct!\n";
+int main(int argc, char** argv) {
+    common::Driver driver(argc, argv,
+                          "Negates the constant operand of add/sub\n");
+    common::FunctionFilter filter;
+    if (!filter.Init(Filter, FilterList))
         return 1;
-    }
-    std::error_code ec;
-    llvm::raw_fd_ostream out(argv[1], ec, llvm::sys::fs::F_None);
-    Owner->print(out, nullptr);
-    return 0;
+
+    return driver.Run("parsetest", [&](llvm::Module& module) {
+        instrument(module, filter);
+        return true;
+    });
 }
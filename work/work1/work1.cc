@@ -5,8 +5,10 @@
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/ADT/STLExtras.h"  // make_early_inc_range
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"  // instructions
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
@@ -17,47 +19,52 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 
-void Instrument(llvm::Module& module);
+#include "common/driver.h"
+#include "common/function_filter.h"
+
+static llvm::cl::opt<std::string> filter(
+    "filter", llvm::cl::desc("Only rewrite the functions matching this regex"),
+    llvm::cl::value_desc("regex"));
+static llvm::cl::opt<std::string> filter_list(
+    "filter-list",
+    llvm::cl::desc("Only rewrite the functions listed in this file"),
+    llvm::cl::value_desc("file"));
+
+void Instrument(llvm::Module& module, const common::FunctionFilter& filter);
+void InstrumentFunction(llvm::Function& function);
 
 int main(int argc, char** argv) {
-  llvm::LLVMContext Context;
-  llvm::SMDiagnostic Err;
-  auto owner = llvm::parseIRFile(argv[1], Err, Context);
-  if (owner == nullptr) {
-    llvm::errs() << "ParseIRFile failed\n" << Err.getMessage() << "\n";
-    return 1;
-  }
+  common::Driver driver(argc, argv, "Turns FAdds into FSubs\n");
+  common::FunctionFilter function_filter;
+  if (function_filter.Init(filter, filter_list) == false) return 1;
 
-  Instrument(*owner);
+  return driver.Run("work1", [&](llvm::Module& module) {
+    Instrument(module, function_filter);
+    return true;
+  });
+}
 
-  if (llvm::verifyModule(*owner, &llvm::errs())) {
-    llvm::errs() << "Generated module is not correct!\n";
-    return 1;
+void Instrument(llvm::Module& module, const common::FunctionFilter& filter) {
+  for (auto& function : module) {
+    if (filter.Matches(function)) InstrumentFunction(function);
   }
-  std::error_code ec;
-  llvm::raw_fd_ostream out(argv[1], ec, llvm::sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
 }
 
-void Instrument(llvm::Module& module) {
+void InstrumentFunction(llvm::Function& function) {
   using namespace llvm;
-  Function* function = module.getFunction("main");
-  for (auto& basic_block : *function) {
-    for (auto instruction_iterator = basic_block.begin();
-         instruction_iterator != basic_block.end(); ++instruction_iterator) {
-      switch (instruction_iterator->getOpcode()) {
-        case Instruction::FAdd: {
-          auto* new_instruction =
-              BinaryOperator::CreateFSub(instruction_iterator->getOperand(0),
-                                         instruction_iterator->getOperand(1));
-          ReplaceInstWithInst(basic_block.getInstList(), instruction_iterator,
-                              new_instruction);
-          break;
-        }
-        default: {
-          break;
-        }
+  // A single pass over the instructions, dispatching on the opcode. Replacing
+  // the current instruction is fine with an early-increment range.
+  for (auto& instruction : make_early_inc_range(instructions(function))) {
+    switch (instruction.getOpcode()) {
+      case Instruction::FAdd: {
+        auto* new_instruction = BinaryOperator::CreateFSub(
+            instruction.getOperand(0), instruction.getOperand(1));
+        new_instruction->copyIRFlags(&instruction);
+        ReplaceInstWithInst(&instruction, new_instruction);
+        break;
+      }
+      default: {
+        break;
       }
     }
   }
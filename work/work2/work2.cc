@@ -15,33 +15,45 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 
+#include "common/driver.h"
+
 using namespace llvm;
 using InstPtrVector = std::vector<Instruction*>;
 
+// How the clamp `res > 100 ? 100 : res` is emitted
+enum class Form {
+  // Split the block, join with a PHI: two more blocks per FAdd
+  kBranch,
+  // fcmp + select in place, which the vectorizers handle
+  kSelect,
+  // llvm.minnum in place. Unlike the others, a NaN sum becomes 100.
+  kMinNum,
+};
+
+static cl::opt<Form> form(
+    "form", cl::desc("Form of the clamp"),
+    cl::values(clEnumValN(Form::kBranch, "branch",
+                          "if-then-else and a PHI (default)"),
+               clEnumValN(Form::kSelect, "select", "fcmp + select"),
+               clEnumValN(Form::kMinNum, "minnum",
+                          "llvm.minnum (NaN sums become 100)")),
+    cl::init(Form::kBranch));
+
 void RunOnModule(Module& module);
 void RunOnFunction(Function& fn);
 InstPtrVector FindInstsToConvert(BasicBlock& bb);
 void ConvertFAdd(Instruction* fadd);
+void ConvertFAddToBranch(Instruction* fadd);
+void ConvertFAddToSelect(Instruction* fadd);
+void ConvertFAddToMinNum(Instruction* fadd);
 
 int main(int argc, char** argv) {
-  llvm::LLVMContext context;
-  llvm::SMDiagnostic err;
-  auto owner = llvm::parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    llvm::errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
-
-  RunOnModule(*owner);
+  common::Driver driver(argc, argv, "Clamps FAdd results to 100\n");
 
-  if (llvm::verifyModule(*owner, &llvm::errs())) {
-    llvm::errs() << "Generated module is not correct!\n";
-    return 1;
-  }
-  std::error_code ec;
-  llvm::raw_fd_ostream out(argv[1], ec, llvm::sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
+  return driver.Run("work2", [](Module& module) {
+    RunOnModule(module);
+    return true;
+  });
 }
 
 void RunOnModule(Module& module) {
@@ -74,6 +86,17 @@ InstPtrVector FindInstsToConvert(BasicBlock& bb) {
 }
 
 void ConvertFAdd(Instruction* fadd) {
+  // A vector condition can't be branched on, vectors always use a select
+  if (form == Form::kMinNum) {
+    ConvertFAddToMinNum(fadd);
+  } else if (form == Form::kSelect || fadd->getType()->isVectorTy()) {
+    ConvertFAddToSelect(fadd);
+  } else {
+    ConvertFAddToBranch(fadd);
+  }
+}
+
+void ConvertFAddToBranch(Instruction* fadd) {
   auto builder = IRBuilder<>(fadd);
   auto* fadd_clone = fadd->clone();
   auto* val_100 = ConstantFP::get(fadd->getType(), 100.);
@@ -88,3 +111,23 @@ void ConvertFAdd(Instruction* fadd) {
   phi->addIncoming(fadd_clone, else_term->getParent());
   ReplaceInstWithInst(fadd, phi);
 }
+
+void ConvertFAddToSelect(Instruction* fadd) {
+  auto builder = IRBuilder<>(fadd);
+  auto* fadd_clone = builder.Insert(fadd->clone());
+  auto* val_100 = ConstantFP::get(fadd->getType(), 100.);
+  auto* condition = builder.CreateFCmpOGT(fadd_clone, val_100);
+  auto* select = SelectInst::Create(condition, val_100, fadd_clone);
+  ReplaceInstWithInst(fadd, select);
+}
+
+void ConvertFAddToMinNum(Instruction* fadd) {
+  auto builder = IRBuilder<>(fadd);
+  auto* fadd_clone = builder.Insert(fadd->clone());
+  auto* val_100 = ConstantFP::get(fadd->getType(), 100.);
+  auto* minnum =
+      builder.CreateBinaryIntrinsic(Intrinsic::minnum, fadd_clone, val_100);
+  fadd->replaceAllUsesWith(minnum);
+  minnum->takeName(fadd);
+  fadd->eraseFromParent();
+}
@@ -8,3 +8,38 @@ double Hook(const double lhs, const double rhs) {
     return res;
   }
 }
+
+// Vector variants of Hook, for the loop vectorizer (see work3 -hook-lib).
+// fmod(res, 100) is computed branch-free as res - 100 * trunc(res / 100),
+// corrected by one step when the quotient was rounded the wrong way. That is
+// exact for 100 < res < 2^53; the (rare) lanes above go through fmod.
+#define DEFINE_VECTOR_HOOK(N)                                                 \
+  typedef double v##N##df __attribute__((vector_size(N * sizeof(double))));  \
+  typedef long long v##N##di                                                  \
+      __attribute__((vector_size(N * sizeof(long long))));                    \
+  v##N##df Hook_v##N(const v##N##df lhs, const v##N##df rhs) {                \
+    const v##N##df hundred = (v##N##df){} + 100.0;                            \
+    v##N##df res = lhs + rhs;                                                 \
+    /* NaNs compare false, infinities take the slow path */                   \
+    v##N##di fast = (res > 100.0) & (res < 0x1p53);                           \
+    v##N##di slow = (res > 100.0) & ~fast;                                    \
+    /* Zero the other lanes, converting them could overflow */               \
+    v##N##df quot = (v##N##df)((v##N##di)(res / 100.0) & fast);               \
+    quot = __builtin_convertvector(__builtin_convertvector(quot, v##N##di),   \
+                                   v##N##df);                                 \
+    v##N##df rem = res - quot * 100.0;                                        \
+    rem += (v##N##df)((rem < 0.0) & (v##N##di)hundred);                       \
+    rem -= (v##N##df)((rem >= 100.0) & (v##N##di)hundred);                    \
+    res = (v##N##df)(((v##N##di)rem & fast) | ((v##N##di)res & ~fast));       \
+    for (int i = 0; i < N; ++i) {                                             \
+      if (slow[i]) res[i] = fmod(res[i], 100.0);                              \
+    }                                                                         \
+    return res;                                                               \
+  }
+
+DEFINE_VECTOR_HOOK(2)
+// Wider vectors are only passed in registers (and match the vector function
+// ABI the tool expects) when the library is built for AVX
+#ifdef __AVX__
+DEFINE_VECTOR_HOOK(4)
+#endif
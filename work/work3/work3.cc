@@ -1,8 +1,12 @@
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Constant.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
@@ -10,58 +14,164 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IRReader/IRReader.h"    // parseIRFile
+#include "llvm/Linker/Linker.h"
 #include "llvm/Support/Casting.h"      // cast
 #include "llvm/Support/CommandLine.h"  // SMDiagnostic
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"  // appendToCompilerUsed
+
+#include "common/driver.h"
 
 using namespace llvm;
 using InstPtrVector = std::vector<Instruction*>;
+// Vector function ABI names of the variants of the hook
+using VariantNames = SmallVector<std::string, 8>;
+
+static cl::opt<std::string> hook_lib(
+    "hook-lib",
+    cl::desc("Bitcode (or IR) file defining Hook, linked into the module so "
+             "that the hook can be inlined and vectorized"),
+    cl::value_desc("file"));
 
-void RunOnModule(Module& module);
-void RunOnFunction(Function& fn);
+static constexpr const char* kHookName = "Hook";
+// Optional vector variants of the hook are named `Hook_v<N>` and take and
+// return <N x double>
+static constexpr const char* kVectorHookPrefix = "Hook_v";
+static constexpr unsigned kMaxVectorWidth = 16;
+
+// Returns false if the hook library couldn't be linked
+bool RunOnModule(Module& module);
+void RunOnFunction(Function& fn, const VariantNames& vector_variants);
+bool LinkHookLibrary(Module& module, StringRef path,
+                     VariantNames& vector_variants);
 InstPtrVector FindFAddsToConvert(BasicBlock& bb);
-void ConvertFAdd(Instruction* fadd);
+// Returns true if `fadd` feeds back into its own operands, through PHIs,
+// other FP operations or a store and load of the same pointer (as at -O0),
+// like the adds of a reduction `s = s + x[i]`
+bool IsRecurrence(Instruction* fadd);
+void ConvertFAdd(Instruction* fadd, const VariantNames& vector_variants);
 
 int main(int argc, char** argv) {
-  LLVMContext context;
-  SMDiagnostic err;
-  auto owner = parseIRFile(argv[1], err, context);
-  if (owner == nullptr) {
-    errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return 1;
-  }
+  common::Driver driver(argc, argv, "Replaces FAdds with calls to Hook\n");
 
-  RunOnModule(*owner);
-
-  if (verifyModule(*owner, &errs())) {
-    errs() << "Generated module is not correct!\n";
-    return 1;
-  }
-  std::error_code ec;
-  raw_fd_ostream out(argv[1], ec, sys::fs::F_None);
-  owner->print(out, nullptr);
-  return 0;
+  return driver.Run("work3", [](Module& module) {
+    return RunOnModule(module);
+  });
 }
 
-void RunOnModule(Module& module) {
+bool RunOnModule(Module& module) {
   auto* double_ty = Type::getDoubleTy(module.getContext());
   auto* hook_ty =
       FunctionType::get(double_ty, {double_ty, double_ty}, /*isVarArgs=*/false);
-  module.getOrInsertFunction("Hook", hook_ty);
+  module.getOrInsertFunction(kHookName, hook_ty);
+
+  // The functions of the hook library must not be instrumented themselves
+  auto fns = std::vector<Function*>();
   for (auto& fn : module) {
     if (fn.isDeclaration()) continue;
-    RunOnFunction(fn);
+    fns.push_back(&fn);
+  }
+
+  auto vector_variants = VariantNames();
+  if (hook_lib.empty() == false &&
+      LinkHookLibrary(module, hook_lib, vector_variants) == false) {
+    errs() << "Linking " << hook_lib << " failed\n";
+    return false;
   }
+  for (auto* fn : fns) RunOnFunction(*fn, vector_variants);
+  return true;
 }
 
-void RunOnFunction(Function& fn) {
+void RunOnFunction(Function& fn, const VariantNames& vector_variants) {
   auto fadds = InstPtrVector();
   for (auto& bb : fn) {
     auto new_fadds = FindFAddsToConvert(bb);
     fadds.insert(fadds.end(), new_fadds.begin(), new_fadds.end());
   }
-  for (auto* fadd : fadds) ConvertFAdd(fadd);
+  if (vector_variants.empty()) {
+    for (auto* fadd : fadds) ConvertFAdd(fadd, vector_variants);
+    return;
+  }
+
+  // Only calls in loops can be vectorized, the others are better inlined
+  auto dominator_tree = DominatorTree(fn);
+  auto loop_info = LoopInfo(dominator_tree);
+  // The loop vectorizer can't widen a call that's part of a recurrence, so
+  // those are better inlined too. Found before any add becomes a call, which
+  // would cut the chains of the others.
+  auto vectorizable = std::vector<bool>();
+  for (auto* fadd : fadds) {
+    vectorizable.push_back(loop_info.getLoopFor(fadd->getParent()) != nullptr &&
+                           IsRecurrence(fadd) == false);
+  }
+  for (size_t i = 0; i < fadds.size(); ++i)
+    ConvertFAdd(fadds[i], vectorizable[i] ? vector_variants : VariantNames());
+}
+
+bool LinkHookLibrary(Module& module, StringRef path,
+                     VariantNames& vector_variants) {
+  SMDiagnostic err;
+  auto lib = parseIRFile(path, err, module.getContext());
+  if (lib == nullptr) {
+    errs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
+    return false;
+  }
+  auto* hook = module.getFunction(kHookName);
+  auto* lib_hook = lib->getFunction(kHookName);
+  if (lib_hook == nullptr || lib_hook->isDeclaration() ||
+      lib_hook->getFunctionType() != hook->getFunctionType()) {
+    errs() << path << " doesn't define double " << kHookName
+           << "(double, double)\n";
+    return false;
+  }
+
+  // Only the needed definitions are linked: declare the vector variants the
+  // library has, so that they are linked as well
+  auto variant_names = std::vector<std::string>();
+  for (unsigned width = 2; width <= kMaxVectorWidth; width *= 2) {
+    auto name = (Twine(kVectorHookPrefix) + Twine(width)).str();
+    auto* variant = lib->getFunction(name);
+    if (variant == nullptr || variant->isDeclaration()) continue;
+    auto* vector_ty = VectorType::get(hook->getReturnType(), width,
+                                       /*Scalable=*/false);
+    auto* variant_ty = FunctionType::get(vector_ty, {vector_ty, vector_ty},
+                                         /*isVarArgs=*/false);
+    if (variant->getFunctionType() != variant_ty) {
+      // e.g. a <4 x double> variant built without AVX takes pointers
+      errs() << "Ignoring " << name << ": expected type " << *variant_ty
+             << "\n";
+      continue;
+    }
+    module.getOrInsertFunction(name, variant_ty);
+    variant_names.push_back(name);
+    // Vector function ABI: unmasked, <width> lanes, two vector parameters
+    vector_variants.push_back((Twine("_ZGV_LLVM_N") + Twine(width) + "vv_" +
+                               kHookName + "(" + name + ")")
+                                  .str());
+  }
+
+  if (Linker::linkModules(module, std::move(lib),
+                          Linker::Flags::LinkOnlyNeeded))
+    return false;
+
+  // The hooks are private to the module now. Whatever kept the library from
+  // being optimized (e.g. -O0) must not keep it from being inlined.
+  hook = module.getFunction(kHookName);
+  hook->setLinkage(GlobalValue::InternalLinkage);
+  hook->removeFnAttr(Attribute::OptimizeNone);
+  hook->removeFnAttr(Attribute::NoInline);
+  hook->addFnAttr(Attribute::InlineHint);
+  auto variants = std::vector<GlobalValue*>();
+  for (const auto& name : variant_names) {
+    auto* variant = module.getFunction(name);
+    variant->setLinkage(GlobalValue::InternalLinkage);
+    variant->removeFnAttr(Attribute::OptimizeNone);
+    variants.push_back(variant);
+  }
+  // Nothing calls the variants until the loop vectorizer does
+  if (variants.empty() == false) appendToCompilerUsed(module, variants);
+  return true;
 }
 
 InstPtrVector FindFAddsToConvert(BasicBlock& bb) {
@@ -69,7 +179,8 @@ InstPtrVector FindFAddsToConvert(BasicBlock& bb) {
   for (auto& inst : bb) {
     switch (inst.getOpcode()) {
       case Instruction::FAdd: {
-        res.push_back(&inst);
+        // Hook only takes doubles
+        if (inst.getType()->isDoubleTy()) res.push_back(&inst);
         break;
       }
       default: {
@@ -80,10 +191,45 @@ InstPtrVector FindFAddsToConvert(BasicBlock& bb) {
   return res;
 }
 
-void ConvertFAdd(Instruction* fadd) {
-  auto builder = IRBuilder<>(fadd);
+bool IsRecurrence(Instruction* fadd) {
+  auto worklist = InstPtrVector{fadd};
+  auto visited = SmallPtrSet<Instruction*, 16>();
+  while (worklist.empty() == false) {
+    auto* inst = worklist.back();
+    worklist.pop_back();
+    for (auto* user : inst->users()) {
+      auto* user_inst = dyn_cast<Instruction>(user);
+      if (user_inst == nullptr) continue;
+      if (user_inst == fadd) return true;
+      if (auto* store = dyn_cast<StoreInst>(user_inst)) {
+        if (store->getValueOperand() != inst) continue;
+        for (auto* ptr_user : store->getPointerOperand()->users()) {
+          auto* load = dyn_cast<LoadInst>(ptr_user);
+          if (load != nullptr && visited.insert(load).second)
+            worklist.push_back(load);
+        }
+        continue;
+      }
+      bool passes_value = isa<PHINode>(user_inst) ||
+                          isa<SelectInst>(user_inst) ||
+                          isa<CastInst>(user_inst) ||
+                          user_inst->getType()->isFPOrFPVectorTy();
+      if (passes_value && visited.insert(user_inst).second)
+        worklist.push_back(user_inst);
+    }
+  }
+  return false;
+}
+
+void ConvertFAdd(Instruction* fadd, const VariantNames& vector_variants) {
   auto* hook_call =
-      builder.CreateCall(fadd->getModule()->getFunction("Hook"),
-                         {fadd->getOperand(0), fadd->getOperand(1)});
+      CallInst::Create(fadd->getModule()->getFunction(kHookName),
+                       {fadd->getOperand(0), fadd->getOperand(1)});
   ReplaceInstWithInst(fadd, hook_call);
+  if (vector_variants.empty() == false) {
+    // Keep the call, so that the loop vectorizer can widen it into a call to
+    // one of the variants
+    hook_call->setIsNoInline();
+    VFABI::setVectorVariantNames(hook_call, vector_variants);
+  }
 }
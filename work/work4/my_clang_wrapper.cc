@@ -1,4 +1,4 @@
-#include <unistd.h>  // access
+#include <unistd.h>  // access, close
 
 #include <cstdio>   // perror
 #include <cstdlib>  // getenv, rand, system
@@ -6,36 +6,179 @@
 #include <string>
 #include <vector>
 
+#include "llvm/ADT/SmallString.h"      // SmallString
+#include "llvm/ADT/StringExtras.h"     // toHex
+#include "llvm/Config/llvm-config.h"   // LLVM_VERSION_STRING
+
 #include "llvm/IR/Constants.h"         // ConstantInt
 #include "llvm/IR/DerivedTypes.h"      // IntegerType, PointerType
 #include "llvm/IR/GlobalValue.h"       // GlobalValue
 #include "llvm/IR/GlobalVariable.h"    // GlobalVariable
 #include "llvm/IR/IRBuilder.h"         // IRBuilder
+#include "llvm/IR/Instructions.h"      // ICmpInst, SwitchInst
 #include "llvm/IR/LLVMContext.h"       // LLVMContext
+#include "llvm/IR/MDBuilder.h"         // MDBuilder
 #include "llvm/IR/Module.h"            // Module
 #include "llvm/IR/Verifier.h"          // verifyModule
 #include "llvm/IRReader/IRReader.h"    // parseIRFile
 #include "llvm/Support/Casting.h"      // cast
+#include "llvm/Support/FileSystem.h"   // createUniqueFile, rename
+#include "llvm/Support/Format.h"       // format
+#include "llvm/Support/MemoryBuffer.h" // MemoryBuffer
+#include "llvm/Support/Path.h"         // filename, replace_extension
+#include "llvm/Support/SHA1.h"         // SHA1
 #include "llvm/Support/SourceMgr.h"    // SMDiagnostic
 #include "llvm/Support/raw_ostream.h"  // raw_fd_ostream
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"  // SplitBlockAndInsertIfThen
+#include "llvm/Transforms/Utils/ModuleUtils.h"  // appendToGlobalCtors
+
+#include "common/driver.h"
 
 static constexpr int kLogMapSize = 16;
-static constexpr int kMapSize = (1 << kLogMapSize);
+// Must match MCW_MAX_MAP_SIZE and MCW_NGRAM_MAX in runtime_lib.h
+static constexpr int kMaxLogMapSize = 20;
+static constexpr int kMaxNgram = 16;
+// Must match MCW_CMP_TABLE_SIZE in runtime_lib.h
+static constexpr int kCmpTableSize = (1 << 12);
+// Part of the key of every cached object: bump it whenever the same options
+// instrument differently
+static constexpr char kCacheVersion[] = "mcw-1";
 
 using namespace llvm;
 
+// How blocks are instrumented, from MCW_MODE
+enum class Mode {
+  // Every block updates the map inline
+  kInline,
+  // The same, but the map pointer is loaded once per function, prev_loc uses
+  // the initial-exec TLS model, and blocks that always run right after their
+  // only predecessor are skipped: the edge into them tells nothing new
+  kFast,
+  // Every block calls __sanitizer_cov_trace_pc_guard with its own guard,
+  // which the runtime turns into an edge
+  kGuard,
+};
+// What happens to an inline counter at 255 hits, from MCW_COUNTERS
+enum class Counters {
+  kWrap,       // goes back to 0, so the edge looks never hit
+  kNeverZero,  // goes to 1
+  kSaturate,   // stays at 255
+};
+struct Options {
+  Mode mode = Mode::kInline;
+  Counters counters = Counters::kWrap;
+  // MCW_NGRAM: index the map with the last `ngram` blocks rather than the
+  // last edge (ngram = 2)
+  unsigned ngram = 2;
+  // MCW_CTX: also index it with a hash of the calling context
+  bool context = false;
+  // MCW_LOG_MAP_SIZE: of the part of the map indexed, by default larger
+  // with the modes above, which spread the hits of a block over more entries
+  unsigned log_map_size = kLogMapSize;
+  // MCW_TRACE_CMPS: record the operands of integer compares, switches and
+  // memcmp/strcmp-like calls in the runtime's tables
+  bool trace_cmps = false;
+  // MCW_SPLIT_CMPS: split wide integer (in)equalities with a constant into
+  // one compare and one block per byte, so every matching byte is new
+  // coverage
+  bool split_cmps = false;
+  // MCW_THREAD_MAPS: give every thread a map of its own, which the runtime
+  // adds to the shared one, rather than have threads fight over the lines
+  // of the shared map.
+  bool thread_maps = false;
+};
+
 int Execute(const int argc, const char** argv);
 bool IsSourceFile(const char* filename);
-bool GenerateIr(const char* filename, const char* output);
+// `flags` are the preprocessor flags of the command line
+bool GenerateIr(const char* filename, const char* output,
+                const std::vector<std::string>& flags = {});
 bool IsIrFile(const char* filename);
-bool Instrument(const char* filename, const char* output);
-void RunOnModule(Module& module);
+// Reads the options from the environment. Returns false (after printing
+// why) if one is invalid.
+bool ReadOptions(Options& options);
+bool Instrument(const char* filename, const char* output,
+                const Options& options);
+void RunOnModule(Module& module, const Options& options);
+// Blocks of `func` to instrument, in order
+std::vector<BasicBlock*> GetBlocksToInstrument(Function& func, Mode mode);
+Value* CreateIncrement(IRBuilder<>& builder, Value* counter, Counters counters);
+// Loads the map of the thread before `insertion_pt`, and calls `thread_area`
+// to allocate it if it's null. The rest of the block moves to a new one.
+Value* CreateThreadMapPtr(Instruction* insertion_pt, GlobalVariable* map_ptr,
+                          FunctionCallee thread_area);
+void TraceCompares(Module& module);
+void SplitCompares(Module& module);
+// Replaces `cmp`, an icmp eq/ne of an i16-i64 and a constant, with a chain of
+// byte compares from the most significant byte
+void SplitCompare(ICmpInst* cmp);
+
+// MCW_CACHE_DIR: a directory of instrumented objects, named after the hash of
+// what they are built from: the preprocessed source (or the input IR), the
+// options, the flags of clang and the version of the wrapper. Builds running
+// in parallel may share it, as objects only enter it whole, by a rename.
+// Every lookup appends "hit" or "miss" to its `stats` file.
+class ObjectCache {
+ public:
+  explicit ObjectCache(std::string dir) : dir_(std::move(dir)) {}
+  // Creates the directory. Returns false (after printing why) on failure.
+  bool Init();
+  std::string GetPath(StringRef key) const {
+    return dir_ + "/" + key.str() + ".o";
+  }
+  // A new file in the directory, for an object to insert
+  bool CreateTempFile(SmallVectorImpl<char>& path) const;
+  // Whether the object of `key` is in the cache, counted as a hit or a miss
+  bool Lookup(StringRef key);
+  // Moves `object`, a file of CreateTempFile, in as the object of `key`
+  bool Insert(StringRef key, StringRef object);
+  // Hits and misses of this run
+  void PrintStats(raw_ostream& out) const;
+  // Hits and misses of every build since the cache was created
+  static int PrintTotals(const char* dir);
+
+ private:
+  void Record(StringRef event);
+
+  std::string dir_;
+  unsigned hits_ = 0;
+  unsigned misses_ = 0;
+};
+// Hash of `contents`, `flags`, `options` and the version of the wrapper
+std::string GetCacheKey(StringRef contents, const std::vector<std::string>& flags,
+                        const Options& options);
+// Compiles the command line through `cache`: every source and IR file
+// becomes its instrumented object, found in the cache or built into it. With
+// -c the objects are copied to the outputs, otherwise they are linked with
+// `mcw_lib_path`.
+int BuildWithCache(int argc, char** argv, const Options& options,
+                   ObjectCache& cache, const char* mcw_lib_path);
+// Whether the command line compiles or links, the only outputs the cache
+// holds
+bool CanCache(int argc, char** argv);
 
 int main(int argc, char** argv) {
-  bool* to_remove = new bool[argc + 1];
-  memset(to_remove, 0, (argc + 1) * sizeof(bool));
-  char** new_argv = new char*[argc + 1];
-  memset(new_argv, 0, (argc + 1) * sizeof(char*));
+  if (argc == 2 && strcmp(argv[1], "--mcw-cache-stats") == 0)
+    return ObjectCache::PrintTotals(getenv("MCW_CACHE_DIR"));
+
+  Options options;
+  if (ReadOptions(options) == false) return 1;
+
+  const char* mcw_lib_path = getenv("MCW_LIB");
+  if (mcw_lib_path == nullptr)
+    mcw_lib_path = "/mnt/d/projects/llvmtutor/work/work4/runtime_lib.o";
+
+  const char* cache_dir = getenv("MCW_CACHE_DIR");
+  if (cache_dir != nullptr && CanCache(argc, argv)) {
+    ObjectCache cache(cache_dir);
+    if (cache.Init() == false) return 1;
+    return BuildWithCache(argc, argv, options, cache, mcw_lib_path);
+  }
+
+  bool* to_remove = new bool[argc + 2];
+  memset(to_remove, 0, (argc + 2) * sizeof(bool));
+  const char** new_argv = new const char*[argc + 2];
+  memset(new_argv, 0, (argc + 2) * sizeof(const char*));
   for (int i = 0; i < argc; ++i) new_argv[i] = argv[i];
   for (int i = 1; i < argc; ++i) {
     if (IsSourceFile(new_argv[i]) == false) continue;
@@ -50,30 +193,33 @@ int main(int argc, char** argv) {
     to_remove[i] = true;
     new_argv[i] = ll_filename;
   }
-  for (int i = 1; i < argc; ++i) {
+  bool ok = true;
+  for (int i = 1; i < argc && ok; ++i) {
     if (IsIrFile(new_argv[i]) == false) continue;
-    Instrument(new_argv[i], new_argv[i]);
+    ok = Instrument(new_argv[i], new_argv[i], options);
+    if (ok == false) errs() << "Cannot instrument " << new_argv[i] << "\n";
   }
 
-  char* mcw_lib_path = getenv("MCW_LIB");
-  if (mcw_lib_path == nullptr)
-    mcw_lib_path = "/mnt/d/projects/llvmtutor/work/work4/runtime_lib.o";
-
-  new_argv[0] = "clang";
-  new_argv[argc++] = mcw_lib_path;
-  Execute(argc, (const char**)new_argv);
+  int status = 1;
+  if (ok) {
+    new_argv[0] = "clang";
+    // The runtime uses pthreads, whether or not the maps are per thread
+    new_argv[argc++] = mcw_lib_path;
+    new_argv[argc++] = "-pthread";
+    status = Execute(argc, new_argv) == 0 ? 0 : 1;
+  }
 
-  char* rm[2];
+  const char* rm[2];
   rm[0] = "rm";
   for (int i = 1; i < argc; ++i) {
     if (to_remove[i]) {
       rm[1] = new_argv[i];
-      Execute(2, (const char**)rm);
+      Execute(2, rm);
     }
   }
 
   delete[] new_argv;
-  return 0;
+  return status;
 }
 
 int Execute(const int argc, const char** argv) {
@@ -98,15 +244,12 @@ bool IsSourceFile(const char* filename) {
          (filename[len - 1] == 'c') && (access(filename, R_OK) == 0);
 }
 
-bool GenerateIr(const char* filename, const char* output) {
-  const char* argv[8] = {nullptr};
-  argv[0] = "clang";
-  argv[1] = "-S";
-  argv[2] = "-emit-llvm";
-  argv[3] = filename;
-  argv[4] = "-o";
-  argv[5] = output;
-  return Execute(6, argv) == 0;
+bool GenerateIr(const char* filename, const char* output,
+                const std::vector<std::string>& flags) {
+  std::vector<const char*> argv = {"clang",  "-S", "-emit-llvm",
+                                   filename, "-o", output};
+  for (const auto& flag : flags) argv.push_back(flag.c_str());
+  return Execute(argv.size(), argv.data()) == 0;
 }
 
 bool IsIrFile(const char* filename) {
@@ -116,74 +259,788 @@ bool IsIrFile(const char* filename) {
          (access(filename, R_OK) == 0);
 }
 
-bool Instrument(const char* filename, const char* output) {
-  LLVMContext context;
-  SMDiagnostic err;
-  auto owner = parseIRFile(filename, err, context);
-  if (owner == nullptr) {
-    outs() << "ParseIRFile failed\n" << err.getMessage() << "\n";
-    return false;
+static bool IsEnabled(const char* name) {
+  const char* value = getenv(name);
+  return value != nullptr && *value != '\0' && strcmp(value, "0") != 0;
+}
+
+bool ReadOptions(Options& options) {
+  if (const char* mode = getenv("MCW_MODE")) {
+    if (strcmp(mode, "inline") == 0) {
+      options.mode = Mode::kInline;
+    } else if (strcmp(mode, "fast") == 0) {
+      options.mode = Mode::kFast;
+    } else if (strcmp(mode, "guard") == 0) {
+      options.mode = Mode::kGuard;
+    } else {
+      errs() << "MCW_MODE must be inline, fast or guard, not " << mode << "\n";
+      return false;
+    }
+  }
+  if (const char* counters = getenv("MCW_COUNTERS")) {
+    if (strcmp(counters, "wrap") == 0) {
+      options.counters = Counters::kWrap;
+    } else if (strcmp(counters, "never-zero") == 0) {
+      options.counters = Counters::kNeverZero;
+    } else if (strcmp(counters, "saturate") == 0) {
+      options.counters = Counters::kSaturate;
+    } else {
+      errs() << "MCW_COUNTERS must be wrap, never-zero or saturate, not "
+             << counters << "\n";
+      return false;
+    }
+  }
+  if (const char* ngram = getenv("MCW_NGRAM")) {
+    options.ngram = atoi(ngram);
+    if (options.ngram < 2 || options.ngram > kMaxNgram) {
+      errs() << "MCW_NGRAM must be between 2 and " << kMaxNgram << "\n";
+      return false;
+    }
   }
-  RunOnModule(*owner);
-  if (verifyModule(*owner, &outs())) {
-    outs() << "Generated module is not correct!\n";
+  options.context = IsEnabled("MCW_CTX");
+  if (options.mode == Mode::kGuard && (options.ngram > 2 || options.context)) {
+    errs() << "MCW_NGRAM and MCW_CTX need MCW_MODE=inline or fast\n";
     return false;
   }
-  std::error_code ec;
-  raw_fd_ostream out(output, ec, sys::fs::F_None);
-  owner->print(out, nullptr);
+  options.log_map_size = kLogMapSize + (options.ngram > 2 ? 2 : 0) +
+                         (options.context ? 2 : 0);
+  if (const char* log_map_size = getenv("MCW_LOG_MAP_SIZE")) {
+    options.log_map_size = atoi(log_map_size);
+    if (options.log_map_size < 8 || options.log_map_size > kMaxLogMapSize) {
+      errs() << "MCW_LOG_MAP_SIZE must be between 8 and " << kMaxLogMapSize
+             << "\n";
+      return false;
+    }
+  }
+
+  options.trace_cmps = IsEnabled("MCW_TRACE_CMPS");
+  options.split_cmps = IsEnabled("MCW_SPLIT_CMPS");
+  options.thread_maps = IsEnabled("MCW_THREAD_MAPS");
   return true;
 }
 
-void RunOnModule(Module& module) {
+bool Instrument(const char* filename, const char* output,
+                const Options& options) {
+  // The command line belongs to clang, so only the driver's helpers are used
+  LLVMContext context;
+  auto owner = common::LoadModule(filename, context);
+  if (owner == nullptr) return false;
+  RunOnModule(*owner, options);
+  return common::VerifyModule(*owner) &&
+         common::WriteModule(*owner, output, /*emit_bc=*/false);
+}
+
+void RunOnModule(Module& module, const Options& options) {
   int inst_blocks = 0;
 
-  auto* int8_ty = IntegerType::getInt8Ty(module.getContext());
+  // Before splitting, which would trace every byte, and before the blocks
+  // are instrumented, as splitting adds blocks
+  if (options.trace_cmps) TraceCompares(module);
+  if (options.split_cmps) SplitCompares(module);
+
   auto* int32_ty = IntegerType::getInt32Ty(module.getContext());
   auto* int8_ptr_ty = PointerType::getInt8PtrTy(module.getContext());
 
+  if (options.mode == Mode::kGuard) {
+    std::vector<BasicBlock*> blocks;
+    for (auto& fn : module) {
+      if (fn.isDeclaration()) continue;
+      auto fn_blocks = GetBlocksToInstrument(fn, options.mode);
+      blocks.insert(blocks.end(), fn_blocks.begin(), fn_blocks.end());
+    }
+    if (blocks.empty()) return;
+
+    // One guard per block, which the runtime numbers at startup
+    auto* guards_ty = ArrayType::get(int32_ty, blocks.size());
+    auto* guards = new GlobalVariable(
+        module, guards_ty, /*isConstant=*/false, GlobalValue::PrivateLinkage,
+        Constant::getNullValue(guards_ty), "__mcw_guards");
+    auto* guard_ptr_ty = PointerType::getUnqual(int32_ty);
+    auto trace = module.getOrInsertFunction(
+        "__sanitizer_cov_trace_pc_guard",
+        FunctionType::get(Type::getVoidTy(module.getContext()), {guard_ptr_ty},
+                          /*isVarArg=*/false));
+    for (auto* bb : blocks) {
+      IRBuilder<> builder(&*bb->getFirstInsertionPt());
+      builder.CreateCall(trace, {builder.CreateConstInBoundsGEP2_32(
+                                    guards_ty, guards, 0, inst_blocks)});
+      ++inst_blocks;
+    }
+
+    auto* init_ty =
+        FunctionType::get(Type::getVoidTy(module.getContext()),
+                          {guard_ptr_ty, guard_ptr_ty}, /*isVarArg=*/false);
+    auto init =
+        module.getOrInsertFunction("__sanitizer_cov_trace_pc_guard_init", init_ty);
+    auto* ctor = Function::Create(
+        FunctionType::get(Type::getVoidTy(module.getContext()),
+                          /*isVarArg=*/false),
+        GlobalValue::InternalLinkage, "__mcw_guards_init", &module);
+    IRBuilder<> builder(BasicBlock::Create(module.getContext(), "entry", ctor));
+    if (options.thread_maps) {
+      builder.CreateCall(module.getOrInsertFunction(
+          "__mcw_use_thread_maps",
+          FunctionType::get(Type::getVoidTy(module.getContext()),
+                            /*isVarArg=*/false)));
+    }
+    builder.CreateCall(
+        init, {builder.CreateConstInBoundsGEP2_32(guards_ty, guards, 0, 0),
+               builder.CreateConstInBoundsGEP2_32(guards_ty, guards, 0,
+                                                  blocks.size())});
+    builder.CreateRetVoid();
+    appendToGlobalCtors(module, ctor, /*Priority=*/0);
+
+    outs() << "Instrumented " << inst_blocks << " locations.\n";
+    return;
+  }
+
+  auto& ctx = module.getContext();
   auto* mcw_map_ptr = new GlobalVariable(
       /*M=*/module, /*Ty=*/int8_ptr_ty,
       /*isConstant=*/false, /*Linkage=*/GlobalValue::ExternalLinkage,
       /*Initializer=*/nullptr, /*Name=*/"__mcw_area_ptr");
+  // The wrapper links executables, which may use the cheaper initial-exec
+  // model for the TLS of the runtime
+  auto tls_model = options.mode == Mode::kFast
+                       ? GlobalVariable::InitialExecTLSModel
+                       : GlobalVariable::GeneralDynamicTLSModel;
   auto* mcw_prev_loc = new GlobalVariable(
       /*M=*/module, /*Ty=*/int32_ty, /*isConstant=*/false,
       /*Linkage=*/GlobalValue::ExternalLinkage,
       /*Initializer=*/nullptr,
       /*Name=*/"__mcw_prev_loc",
       /*InsertBefore=*/nullptr,
-      /*ThreadLocalMode=*/GlobalVariable::GeneralDynamicTLSModel);
+      /*ThreadLocalMode=*/tls_model);
+  // With MCW_THREAD_MAPS, the map of the thread, which is null until
+  // __mcw_thread_area allocates it
+  GlobalVariable* mcw_thread_map_ptr = nullptr;
+  FunctionCallee thread_area;
+  if (options.thread_maps) {
+    mcw_thread_map_ptr = new GlobalVariable(
+        module, int8_ptr_ty, /*isConstant=*/false,
+        GlobalValue::ExternalLinkage, /*Initializer=*/nullptr,
+        "__mcw_thread_area_ptr", /*InsertBefore=*/nullptr, tls_model);
+    thread_area = module.getOrInsertFunction(
+        "__mcw_thread_area", FunctionType::get(int8_ptr_ty, /*isVarArg=*/false));
+  }
+
+  // With MCW_NGRAM, the last ngram - 1 blocks, newest first, are a vector
+  // at the start of __mcw_prev_locs
+  unsigned history_size = options.ngram - 1;
+  auto* history_ty = VectorType::get(int32_ty, history_size, false);
+  Constant* history_ptr = nullptr;
+  Constant* history_shift = nullptr;
+  if (options.ngram > 2) {
+    auto* mcw_prev_locs = new GlobalVariable(
+        module, ArrayType::get(int32_ty, kMaxNgram), /*isConstant=*/false,
+        GlobalValue::ExternalLinkage, /*Initializer=*/nullptr,
+        "__mcw_prev_locs", /*InsertBefore=*/nullptr, tls_model);
+    history_ptr = ConstantExpr::getBitCast(mcw_prev_locs,
+                                           PointerType::getUnqual(history_ty));
+    // Lane 0 gets the new block, from the second operand of the shuffle,
+    // and the others move down one
+    std::vector<uint32_t> mask = {history_size};
+    for (unsigned i = 0; i + 1 < history_size; ++i) mask.push_back(i);
+    history_shift = ConstantDataVector::get(ctx, mask);
+  }
+  GlobalVariable* mcw_prev_ctx = nullptr;
+  if (options.context) {
+    mcw_prev_ctx = new GlobalVariable(
+        module, int32_ty, /*isConstant=*/false, GlobalValue::ExternalLinkage,
+        /*Initializer=*/nullptr, "__mcw_prev_ctx", /*InsertBefore=*/nullptr,
+        tls_model);
+  }
+  unsigned map_size = 1u << options.log_map_size;
 
   for (auto& fn : module) {
     if (fn.isDeclaration()) continue;
-    for (auto& bb : fn) {
-      auto insertion_pt = bb.getFirstInsertionPt();
-      auto builder = IRBuilder<>(&*insertion_pt);
+    // Before the prologue, which may add blocks
+    auto blocks = GetBlocksToInstrument(fn, options.mode);
+    // Set up by the prologue, before the instrumentation of the entry block
+    auto* entry_insertion_pt = &*fn.getEntryBlock().getFirstInsertionPt();
+    // With MCW_MODE=fast or MCW_THREAD_MAPS, the map pointer of the whole
+    // function
+    Value* fn_map_ptr = nullptr;
+    if (mcw_thread_map_ptr != nullptr) {
+      // The rest of the entry block moves to a new one, but the allocas
+      // must stay
+      while (isa<AllocaInst>(entry_insertion_pt))
+        entry_insertion_pt = entry_insertion_pt->getNextNode();
+      fn_map_ptr = CreateThreadMapPtr(entry_insertion_pt, mcw_thread_map_ptr,
+                                      thread_area);
+    }
+    IRBuilder<> prologue(entry_insertion_pt);
+    if (options.mode == Mode::kFast && fn_map_ptr == nullptr)
+      fn_map_ptr = prologue.CreateLoad(mcw_map_ptr);
+    // With MCW_CTX, the context of the whole function: the one of the caller
+    // and the function, restored on the way out
+    Value* fn_ctx = nullptr;
+    if (options.context) {
+      auto* caller_ctx = prologue.CreateLoad(mcw_prev_ctx);
+      fn_ctx = prologue.CreateXor(caller_ctx, rand() % map_size);
+      prologue.CreateStore(fn_ctx, mcw_prev_ctx);
+      for (auto& bb : fn) {
+        Instruction* exit = bb.getTerminator();
+        if (isa<ReturnInst>(exit) == false && isa<ResumeInst>(exit) == false)
+          continue;
+        // Nothing can go between a musttail call and the return
+        if (auto* must_tail_call = bb.getTerminatingMustTailCall())
+          exit = must_tail_call;
+        new StoreInst(caller_ctx, mcw_prev_ctx, exit);
+      }
+    }
+
+    for (auto* bb : blocks) {
+      auto* insertion_pt = bb == &fn.getEntryBlock()
+                               ? entry_insertion_pt
+                               : &*bb->getFirstInsertionPt();
+      auto builder = IRBuilder<>(insertion_pt);
 
       // Make up `cur_loc`
-      int cur_loc_real = rand() % kMapSize;
+      int cur_loc_real = rand() % map_size;
       auto* cur_loc = ConstantInt::get(int32_ty, cur_loc_real);
 
-      // Load `prev_loc`
-      auto* prev_loc = builder.CreateLoad(mcw_prev_loc);
+      // Load `prev_loc`, or the XOR of the history
+      Value* prev_loc = nullptr;
+      Value* history = nullptr;
+      if (history_ptr != nullptr) {
+        history = builder.CreateAlignedLoad(history_ty, history_ptr,
+                                            MaybeAlign(4));
+        prev_loc = builder.CreateXorReduce(history);
+      } else {
+        prev_loc = builder.CreateLoad(mcw_prev_loc);
+      }
+      auto* index = builder.CreateXor(prev_loc, cur_loc);
+      if (fn_ctx != nullptr) index = builder.CreateXor(index, fn_ctx);
 
       // Load SHM pointer
-      auto* map_ptr = builder.CreateLoad(mcw_map_ptr);
-      auto* map_ptr_idx =
-          builder.CreateGEP(map_ptr, builder.CreateXor(prev_loc, cur_loc));
+      auto* map_ptr =
+          fn_map_ptr != nullptr ? fn_map_ptr : builder.CreateLoad(mcw_map_ptr);
+      auto* map_ptr_idx = builder.CreateGEP(map_ptr, index);
 
       // update bitmap
       auto* counter = builder.CreateLoad(map_ptr_idx);
-      auto* increase = builder.CreateAdd(counter, ConstantInt::get(int8_ty, 1));
-      builder.CreateStore(increase, map_ptr_idx);
+      builder.CreateStore(CreateIncrement(builder, counter, options.counters),
+                          map_ptr_idx);
 
-      // Set `prev_loc` to `cur_loc >> 1`
-      builder.CreateStore(ConstantInt::get(int32_ty, cur_loc_real >> 1),
-                          mcw_prev_loc);
+      // Set `prev_loc` to `cur_loc >> 1`, or push it to the history
+      auto* next_loc = ConstantInt::get(int32_ty, cur_loc_real >> 1);
+      if (history != nullptr) {
+        std::vector<Constant*> next_locs_init(history_size, next_loc);
+        auto* next_locs = ConstantVector::get(next_locs_init);
+        builder.CreateAlignedStore(
+            builder.CreateShuffleVector(history, next_locs, history_shift),
+            history_ptr, MaybeAlign(4));
+      } else {
+        builder.CreateStore(next_loc, mcw_prev_loc);
+      }
 
       ++inst_blocks;
     }
   }
 
+  // The runtime's map holds the largest size; tell it how much is used
+  if (options.log_map_size != kLogMapSize) {
+    auto set_map_size = module.getOrInsertFunction(
+        "__mcw_set_map_size",
+        FunctionType::get(Type::getVoidTy(ctx), {int32_ty},
+                          /*isVarArg=*/false));
+    auto* ctor = Function::Create(
+        FunctionType::get(Type::getVoidTy(ctx), /*isVarArg=*/false),
+        GlobalValue::InternalLinkage, "__mcw_map_size_init", &module);
+    IRBuilder<> builder(BasicBlock::Create(ctx, "entry", ctor));
+    builder.CreateCall(set_map_size, {builder.getInt32(map_size)});
+    builder.CreateRetVoid();
+    appendToGlobalCtors(module, ctor, /*Priority=*/0);
+  }
+
   outs() << "Instrumented " << inst_blocks << " locations.\n";
 }
+
+std::vector<BasicBlock*> GetBlocksToInstrument(Function& func, Mode mode) {
+  std::vector<BasicBlock*> blocks;
+  for (auto& bb : func) {
+    // A block whose only predecessor always branches to it runs exactly when
+    // the predecessor does, so recording that edge adds nothing
+    auto* pred = bb.getSinglePredecessor();
+    if (mode == Mode::kFast && pred != nullptr &&
+        pred->getSingleSuccessor() == &bb)
+      continue;
+    blocks.push_back(&bb);
+  }
+  return blocks;
+}
+
+Value* CreateIncrement(IRBuilder<>& builder, Value* counter,
+                       Counters counters) {
+  auto* increase = builder.CreateAdd(counter, builder.getInt8(1));
+  switch (counters) {
+    case Counters::kWrap:
+      return increase;
+    case Counters::kNeverZero:
+      // 255 + 1 wraps to 0, and the carry brings it to 1
+      return builder.CreateAdd(
+          increase, builder.CreateZExt(builder.CreateIsNull(increase),
+                                       builder.getInt8Ty()));
+    case Counters::kSaturate:
+      return builder.CreateSelect(
+          builder.CreateICmpEQ(counter, builder.getInt8(255)), counter,
+          increase);
+  }
+  return increase;
+}
+
+Value* CreateThreadMapPtr(Instruction* insertion_pt, GlobalVariable* map_ptr,
+                          FunctionCallee thread_area) {
+  auto* int8_ptr_ty = Type::getInt8PtrTy(insertion_pt->getContext());
+  IRBuilder<> builder(insertion_pt);
+  auto* map = builder.CreateLoad(int8_ptr_ty, map_ptr);
+  auto* head = map->getParent();
+  // Only the first block of a thread allocates
+  auto* weights = MDBuilder(insertion_pt->getContext())
+                      .createBranchWeights(1, (1 << 20) - 1);
+  auto* then_term =
+      SplitBlockAndInsertIfThen(builder.CreateIsNull(map), insertion_pt,
+                                /*Unreachable=*/false, weights);
+  auto* new_map = IRBuilder<>(then_term).CreateCall(thread_area);
+  auto* phi = PHINode::Create(int8_ptr_ty, 2, "mcw_thread_map", insertion_pt);
+  phi->addIncoming(map, head);
+  phi->addIncoming(new_map, then_term->getParent());
+  return phi;
+}
+
+void TraceCompares(Module& module) {
+  auto& ctx = module.getContext();
+  auto* void_ty = Type::getVoidTy(ctx);
+  auto* int32_ty = Type::getInt32Ty(ctx);
+  auto* int64_ty = Type::getInt64Ty(ctx);
+  auto* int8_ptr_ty = Type::getInt8PtrTy(ctx);
+  auto trace_cmp = module.getOrInsertFunction(
+      "__mcw_trace_cmp",
+      FunctionType::get(void_ty, {int32_ty, int32_ty, int64_ty, int64_ty},
+                        /*isVarArg=*/false));
+  auto trace_switch = module.getOrInsertFunction(
+      "__mcw_trace_switch",
+      FunctionType::get(void_ty,
+                        {int32_ty, int32_ty, int64_ty,
+                         PointerType::getUnqual(int64_ty), int32_ty},
+                        /*isVarArg=*/false));
+  auto* bytes_ty = FunctionType::get(
+      void_ty, {int32_ty, int8_ptr_ty, int8_ptr_ty, int64_ty},
+      /*isVarArg=*/false);
+  auto trace_memcmp = module.getOrInsertFunction("__mcw_trace_memcmp", bytes_ty);
+  auto trace_strcmp = module.getOrInsertFunction("__mcw_trace_strcmp", bytes_ty);
+
+  int num_traced = 0;
+  for (auto& fn : module) {
+    if (fn.isDeclaration()) continue;
+    for (auto& bb : fn) {
+      for (auto& inst : bb) {
+        // Like `cur_loc`, where the operands go in the tables
+        IRBuilder<> builder(&inst);
+        auto get_site = [&]() {
+          return builder.getInt32(rand() % kCmpTableSize);
+        };
+
+        if (auto* cmp = dyn_cast<ICmpInst>(&inst)) {
+          auto* int_ty = dyn_cast<IntegerType>(cmp->getOperand(0)->getType());
+          if (int_ty == nullptr || int_ty->getBitWidth() < 8 ||
+              int_ty->getBitWidth() > 64)
+            continue;
+          builder.CreateCall(
+              trace_cmp,
+              {get_site(), builder.getInt32(int_ty->getBitWidth() / 8),
+               builder.CreateZExt(cmp->getOperand(0), int64_ty),
+               builder.CreateZExt(cmp->getOperand(1), int64_ty)});
+          ++num_traced;
+        } else if (auto* sw = dyn_cast<SwitchInst>(&inst)) {
+          auto* int_ty = cast<IntegerType>(sw->getCondition()->getType());
+          if (sw->getNumCases() == 0 || int_ty->getBitWidth() > 64) continue;
+          std::vector<uint64_t> cases;
+          for (auto& case_it : sw->cases())
+            cases.push_back(case_it.getCaseValue()->getZExtValue());
+          auto* cases_init = ConstantDataArray::get(ctx, cases);
+          auto* cases_var = new GlobalVariable(
+              module, cases_init->getType(), /*isConstant=*/true,
+              GlobalValue::PrivateLinkage, cases_init, "__mcw_switch_cases");
+          builder.CreateCall(
+              trace_switch,
+              {get_site(), builder.getInt32((int_ty->getBitWidth() + 7) / 8),
+               builder.CreateZExt(sw->getCondition(), int64_ty),
+               builder.CreateConstInBoundsGEP2_32(cases_init->getType(),
+                                                  cases_var, 0, 0),
+               builder.getInt32(cases.size())});
+          ++num_traced;
+        } else if (auto* call = dyn_cast<CallInst>(&inst)) {
+          auto* callee = call->getCalledFunction();
+          if (callee == nullptr) continue;
+          StringRef name = callee->getName();
+          bool is_memcmp = name == "memcmp" || name == "bcmp";
+          bool is_strcmp = name == "strcmp" || name == "strcasecmp";
+          bool is_strncmp = name == "strncmp" || name == "strncasecmp";
+          if (is_memcmp == false && is_strcmp == false && is_strncmp == false)
+            continue;
+          if (call->arg_size() < (is_strcmp ? 2u : 3u)) continue;
+          Value* max_len = is_strcmp
+                               ? builder.getInt64(UINT64_MAX)
+                               : builder.CreateZExtOrTrunc(
+                                     call->getArgOperand(2), int64_ty);
+          builder.CreateCall(
+              is_memcmp ? trace_memcmp : trace_strcmp,
+              {get_site(),
+               builder.CreatePointerCast(call->getArgOperand(0), int8_ptr_ty),
+               builder.CreatePointerCast(call->getArgOperand(1), int8_ptr_ty),
+               max_len});
+          ++num_traced;
+        }
+      }
+    }
+  }
+
+  outs() << "Traced " << num_traced << " comparisons.\n";
+}
+
+void SplitCompares(Module& module) {
+  std::vector<ICmpInst*> cmps;
+  for (auto& fn : module) {
+    if (fn.isDeclaration()) continue;
+    for (auto& bb : fn) {
+      for (auto& inst : bb) {
+        auto* cmp = dyn_cast<ICmpInst>(&inst);
+        if (cmp == nullptr || cmp->isEquality() == false) continue;
+        // The constant goes second
+        if (isa<ConstantInt>(cmp->getOperand(0))) cmp->swapOperands();
+        auto* int_ty = dyn_cast<IntegerType>(cmp->getOperand(0)->getType());
+        if (int_ty == nullptr || int_ty->getBitWidth() % 8 != 0 ||
+            int_ty->getBitWidth() < 16 || int_ty->getBitWidth() > 64 ||
+            isa<ConstantInt>(cmp->getOperand(1)) == false ||
+            isa<Constant>(cmp->getOperand(0)))
+          continue;
+        cmps.push_back(cmp);
+      }
+    }
+  }
+  for (auto* cmp : cmps) SplitCompare(cmp);
+
+  outs() << "Split " << cmps.size() << " comparisons.\n";
+}
+
+void SplitCompare(ICmpInst* cmp) {
+  auto& ctx = cmp->getContext();
+  auto* value = cmp->getOperand(0);
+  const auto& constant = cast<ConstantInt>(cmp->getOperand(1))->getValue();
+  unsigned num_bytes = value->getType()->getIntegerBitWidth() / 8;
+
+  // bb: ... br byte 0 -> byte 1 -> ... -> end, where a mismatch goes
+  // straight to end
+  auto* bb = cmp->getParent();
+  auto* end = bb->splitBasicBlock(cmp->getIterator(), "mcw.split.end");
+  bb->getTerminator()->eraseFromParent();
+  IRBuilder<> builder(bb);
+  auto* equal = PHINode::Create(builder.getInt1Ty(), num_bytes, "mcw.split.eq",
+                                &end->front());
+  for (unsigned i = 0; i < num_bytes; ++i) {
+    unsigned shift = 8 * (num_bytes - 1 - i);
+    auto* byte = builder.CreateTrunc(builder.CreateLShr(value, shift),
+                                     builder.getInt8Ty());
+    auto* byte_equal = builder.CreateICmpEQ(
+        byte, builder.getInt8(constant.lshr(shift).trunc(8).getZExtValue()));
+    if (i + 1 == num_bytes) {
+      builder.CreateBr(end);
+      equal->addIncoming(byte_equal, builder.GetInsertBlock());
+      break;
+    }
+    auto* next = BasicBlock::Create(ctx, "mcw.split", bb->getParent(), end);
+    builder.CreateCondBr(byte_equal, next, end);
+    equal->addIncoming(builder.getFalse(), builder.GetInsertBlock());
+    builder.SetInsertPoint(next);
+  }
+
+  Value* result = equal;
+  if (cmp->getPredicate() == CmpInst::ICMP_NE) {
+    builder.SetInsertPoint(cmp);
+    result = builder.CreateNot(equal);
+  }
+  result->takeName(cmp);
+  cmp->replaceAllUsesWith(result);
+  cmp->eraseFromParent();
+}
+
+bool ObjectCache::Init() {
+  if (std::error_code ec = sys::fs::create_directories(dir_)) {
+    errs() << "Cannot create " << dir_ << ": " << ec.message() << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool ObjectCache::CreateTempFile(SmallVectorImpl<char>& path) const {
+  int fd;
+  if (std::error_code ec =
+          sys::fs::createUniqueFile(dir_ + "/tmp-%%%%%%%%.o", fd, path)) {
+    errs() << "Cannot create a file in " << dir_ << ": " << ec.message()
+           << "\n";
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+bool ObjectCache::Lookup(StringRef key) {
+  bool hit = sys::fs::exists(GetPath(key));
+  ++(hit ? hits_ : misses_);
+  Record(hit ? "hit" : "miss");
+  return hit;
+}
+
+bool ObjectCache::Insert(StringRef key, StringRef object) {
+  // Another build may have inserted the same object meanwhile, which the
+  // rename replaces atomically
+  if (std::error_code ec = sys::fs::rename(object, GetPath(key))) {
+    errs() << "Cannot insert " << object << " in the cache: " << ec.message()
+           << "\n";
+    return false;
+  }
+  return true;
+}
+
+void ObjectCache::Record(StringRef event) {
+  // One short write in append mode, which concurrent builds don't interleave
+  std::error_code ec;
+  raw_fd_ostream stats(dir_ + "/stats", ec, sys::fs::OF_Append);
+  if (ec) return;  // the statistics are best effort
+  stats << event << "\n";
+}
+
+void ObjectCache::PrintStats(raw_ostream& out) const {
+  out << "mcw cache: " << hits_ << " hits, " << misses_ << " misses\n";
+}
+
+int ObjectCache::PrintTotals(const char* dir) {
+  if (dir == nullptr) {
+    errs() << "MCW_CACHE_DIR is not set\n";
+    return 1;
+  }
+  unsigned hits = 0;
+  unsigned misses = 0;
+  if (auto stats = MemoryBuffer::getFile(Twine(dir) + "/stats")) {
+    SmallVector<StringRef, 0> lines;
+    (*stats)->getBuffer().split(lines, '\n', /*MaxSplit=*/-1,
+                                /*KeepEmpty=*/false);
+    for (auto line : lines) {
+      hits += line == "hit";
+      misses += line == "miss";
+    }
+  }
+  unsigned num_objects = 0;
+  uint64_t size = 0;
+  std::error_code ec;
+  for (sys::fs::directory_iterator it(dir, ec), end; it != end && !ec;
+       it.increment(ec)) {
+    auto name = sys::path::filename(it->path());
+    if (name.endswith(".o") == false || name.startswith("tmp-")) continue;
+    ++num_objects;
+    if (auto status = it->status()) size += status->getSize();
+  }
+  outs() << "hits:    " << hits << "\n";
+  outs() << "misses:  " << misses << "\n";
+  if (hits + misses != 0)
+    outs() << "hit rate: " << format("%.1f%%", 100.0 * hits / (hits + misses))
+           << "\n";
+  outs() << "objects: " << num_objects << " (" << size << " bytes)\n";
+  return 0;
+}
+
+std::string GetCacheKey(StringRef contents,
+                        const std::vector<std::string>& flags,
+                        const Options& options) {
+  std::string options_str;
+  raw_string_ostream(options_str)
+      << static_cast<int>(options.mode) << ' '
+      << static_cast<int>(options.counters) << ' ' << options.ngram << ' '
+      << options.context << ' ' << options.log_map_size << ' '
+      << options.trace_cmps << ' ' << options.split_cmps << ' '
+      << options.thread_maps;
+
+  SHA1 hasher;
+  // Every field ends with a NUL, so that no two lists of fields hash the
+  // same text
+  auto add = [&hasher](StringRef field) {
+    hasher.update(field);
+    hasher.update(StringRef("", 1));
+  };
+  add(kCacheVersion);
+  add(LLVM_VERSION_STRING);
+  add(options_str);
+  for (const auto& flag : flags) add(flag);
+  add(contents);
+  return toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+bool CanCache(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-E") == 0 || strcmp(argv[i], "-S") == 0 ||
+        strcmp(argv[i], "-emit-llvm") == 0 || strcmp(argv[i], "-M") == 0 ||
+        strcmp(argv[i], "-MM") == 0)
+      return false;
+  }
+  return true;
+}
+
+// Options of clang whose value is the next argument
+static bool TakesValue(StringRef flag) {
+  return flag == "-I" || flag == "-D" || flag == "-U" || flag == "-include" ||
+         flag == "-imacros" || flag == "-isystem" || flag == "-iquote" ||
+         flag == "-idirafter" || flag == "-isysroot" || flag == "-x" ||
+         flag == "-MF" || flag == "-MT" || flag == "-MQ" ||
+         flag == "-Xclang" || flag == "-mllvm" || flag == "-target";
+}
+
+// Options of clang that change the preprocessed text, given joined
+// ("-Idir") or with their value as the next argument ("-I dir")
+static bool IsPreprocessorFlag(StringRef flag) {
+  return flag.startswith("-I") || flag.startswith("-D") ||
+         flag.startswith("-U") || flag == "-include" || flag == "-imacros" ||
+         flag.startswith("-isystem") || flag.startswith("-iquote") ||
+         flag.startswith("-idirafter") || flag.startswith("-isysroot") ||
+         flag.startswith("--sysroot") || flag.startswith("-std=") ||
+         flag == "-nostdinc" || flag == "-undef";
+}
+
+// Hashes `filename` into `key`: its text preprocessed with `cpp_flags` for a
+// C file, so that changes to its headers are seen, and its IR otherwise
+static bool GetInputKey(const char* filename,
+                        const std::vector<std::string>& flags,
+                        const std::vector<std::string>& cpp_flags,
+                        const Options& options, std::string& key) {
+  SmallString<128> preprocessed;
+  if (IsSourceFile(filename)) {
+    if (std::error_code ec =
+            sys::fs::createTemporaryFile("mcw", "i", preprocessed)) {
+      errs() << "Cannot create a temporary file: " << ec.message() << "\n";
+      return false;
+    }
+    std::vector<const char*> argv = {"clang", "-E"};
+    for (const auto& flag : cpp_flags) argv.push_back(flag.c_str());
+    argv.insert(argv.end(), {filename, "-o", preprocessed.c_str()});
+    if (Execute(argv.size(), argv.data()) != 0) {
+      sys::fs::remove(preprocessed);
+      return false;
+    }
+  }
+  auto contents = MemoryBuffer::getFile(
+      preprocessed.empty() ? StringRef(filename) : preprocessed.str());
+  if (preprocessed.empty() == false) sys::fs::remove(preprocessed);
+  if (!contents) {
+    errs() << "Cannot read " << filename << ": "
+           << contents.getError().message() << "\n";
+    return false;
+  }
+  key = GetCacheKey((*contents)->getBuffer(), flags, options);
+  return true;
+}
+
+// Instruments `filename` and compiles it into `cache` as the object of `key`
+static bool BuildObject(const char* filename, StringRef key,
+                        const std::vector<std::string>& flags,
+                        const std::vector<std::string>& cpp_flags,
+                        const Options& options, ObjectCache& cache) {
+  SmallString<128> ir;
+  if (std::error_code ec = sys::fs::createTemporaryFile("mcw", "ll", ir)) {
+    errs() << "Cannot create a temporary file: " << ec.message() << "\n";
+    return false;
+  }
+  // Block and compare site IDs come from rand(): seeded with the key, an
+  // input always gets the same object, whichever inputs came before it
+  unsigned seed = 0;
+  key.substr(0, 8).getAsInteger(16, seed);
+  srand(seed);
+
+  SmallString<128> object;
+  bool ok = (IsSourceFile(filename) == false ||
+             GenerateIr(filename, ir.c_str(), cpp_flags)) &&
+            Instrument(IsSourceFile(filename) ? ir.c_str() : filename,
+                       ir.c_str(), options) &&
+            cache.CreateTempFile(object);
+  if (ok) {
+    std::vector<const char*> argv = {"clang", "-c"};
+    for (const auto& flag : flags) argv.push_back(flag.c_str());
+    // Whatever -x the flags end with, the input is IR
+    argv.insert(argv.end(), {"-x", "ir", ir.c_str(), "-o", object.c_str()});
+    ok = Execute(argv.size(), argv.data()) == 0 && cache.Insert(key, object);
+    if (ok == false) sys::fs::remove(object);
+  }
+  sys::fs::remove(ir);
+  return ok;
+}
+
+int BuildWithCache(int argc, char** argv, const Options& options,
+                   ObjectCache& cache, const char* mcw_lib_path) {
+  // The inputs to instrument, the output, and the flags, which every object
+  // is compiled with too, each followed by its value if it takes one. The
+  // preprocessor flags are also the ones the sources are preprocessed with.
+  std::vector<int> inputs;
+  const char* output = nullptr;
+  bool compile_only = false;
+  std::vector<std::string> flags;
+  std::vector<std::string> cpp_flags;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-c") == 0) {
+      compile_only = true;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (IsSourceFile(argv[i]) || IsIrFile(argv[i])) {
+      inputs.push_back(i);
+    } else if (argv[i][0] == '-') {
+      bool cpp_flag = IsPreprocessorFlag(argv[i]);
+      flags.push_back(argv[i]);
+      if (cpp_flag) cpp_flags.push_back(argv[i]);
+      if (TakesValue(argv[i]) && i + 1 < argc) {
+        flags.push_back(argv[++i]);
+        if (cpp_flag) cpp_flags.push_back(argv[i]);
+      }
+    }
+  }
+  if (compile_only && output != nullptr && inputs.size() > 1) {
+    errs() << "-o with -c takes a single input\n";
+    return 1;
+  }
+
+  std::vector<std::string> objects;
+  for (int i : inputs) {
+    std::string key;
+    if (GetInputKey(argv[i], flags, cpp_flags, options, key) == false)
+      return 1;
+    if (cache.Lookup(key) == false &&
+        BuildObject(argv[i], key, flags, cpp_flags, options, cache) == false)
+      return 1;
+    objects.push_back(cache.GetPath(key));
+  }
+  cache.PrintStats(errs());
+
+  if (compile_only && objects.empty() == false) {
+    for (size_t j = 0; j < inputs.size(); ++j) {
+      SmallString<128> object_output;
+      if (output != nullptr) {
+        object_output = output;
+      } else {
+        object_output = sys::path::filename(argv[inputs[j]]);
+        sys::path::replace_extension(object_output, "o");
+      }
+      if (std::error_code ec = sys::fs::copy_file(objects[j], object_output)) {
+        errs() << "Cannot write " << object_output << ": " << ec.message()
+               << "\n";
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  std::vector<const char*> new_argv(argv, argv + argc);
+  new_argv[0] = "clang";
+  for (size_t j = 0; j < inputs.size(); ++j)
+    new_argv[inputs[j]] = objects[j].c_str();
+  new_argv.push_back(mcw_lib_path);
+  new_argv.push_back("-pthread");
+  return Execute(new_argv.size(), new_argv.data()) == 0 ? 0 : 1;
+}
@@ -1,4 +1,536 @@
-char __mcw_area_initial[1 << 16];
+#include "runtime_lib.h"
+
+#include <pthread.h>  // pthread_key_create, pthread_once
+#include <stdlib.h>   // calloc
+#include <string.h>   // memcpy, memset
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define MCW_X86_64 1
+#endif
+
+char __mcw_area_initial[MCW_MAX_MAP_SIZE];
 char* __mcw_area_ptr = __mcw_area_initial;
+uint32_t __mcw_map_size = MCW_MAP_SIZE;
 
 __thread unsigned __mcw_prev_loc;
+// The history of MCW_NGRAM, newest first, and the context of MCW_CTX
+__thread uint32_t __mcw_prev_locs[MCW_NGRAM_MAX];
+__thread uint32_t __mcw_prev_ctx;
+__thread char* __mcw_thread_area_ptr;
+// Whether the callbacks use the map of their thread
+static int use_thread_maps;
+
+static void clear_thread_maps(void);
+
+void __mcw_set_map_size(uint32_t size) {
+  if (size > __mcw_map_size && size <= MCW_MAX_MAP_SIZE) __mcw_map_size = size;
+}
+
+void __mcw_reset(void) {
+  memset(__mcw_area_ptr, 0, __mcw_map_size);
+  clear_thread_maps();
+  __mcw_prev_loc = 0;
+  memset(__mcw_prev_locs, 0, sizeof(__mcw_prev_locs));
+  __mcw_prev_ctx = 0;
+}
+
+void __sanitizer_cov_trace_pc_guard_init(uint32_t* start, uint32_t* stop) {
+  static uint32_t num_guards;
+  // Already numbered, e.g. by a module constructor that ran twice
+  if (start == stop || *start != 0) return;
+  for (uint32_t* guard = start; guard < stop; ++guard) {
+    // Spread the IDs over the map, as the XOR of two of them indexes it. 0
+    // would disable the guard.
+    uint32_t id = (++num_guards * 2654435761u) % MCW_MAP_SIZE;
+    *guard = id != 0 ? id : 1;
+  }
+}
+
+void __sanitizer_cov_trace_pc_guard(uint32_t* guard) {
+  uint32_t cur_loc = *guard;
+  if (cur_loc == 0) return;
+  char* map = __mcw_area_ptr;
+  if (use_thread_maps) {
+    map = __mcw_thread_area_ptr != NULL ? __mcw_thread_area_ptr
+                                        : __mcw_thread_area();
+  }
+  uint8_t* counter = (uint8_t*)map + (cur_loc ^ __mcw_prev_loc);
+  *counter += 1;
+  *counter += *counter == 0;
+  __mcw_prev_loc = cur_loc >> 1;
+}
+
+mcw_cmp_entry __mcw_cmp_table[MCW_CMP_TABLE_SIZE];
+mcw_rtn_entry __mcw_rtn_table[MCW_CMP_TABLE_SIZE];
+
+void __mcw_trace_cmp(uint32_t site, uint32_t size, uint64_t arg1,
+                     uint64_t arg2) {
+  mcw_cmp_entry* entry = &__mcw_cmp_table[site % MCW_CMP_TABLE_SIZE];
+  uint32_t slot = entry->hits++ % MCW_CMP_HISTORY;
+  entry->size = size;
+  entry->args[slot][0] = arg1;
+  entry->args[slot][1] = arg2;
+}
+
+void __mcw_trace_switch(uint32_t site, uint32_t size, uint64_t value,
+                        const uint64_t* cases, uint32_t num_cases) {
+  // The cases of a switch take consecutive entries
+  for (uint32_t i = 0; i < num_cases; ++i)
+    __mcw_trace_cmp(site + i, size, value, cases[i]);
+}
+
+static void trace_bytes(uint32_t site, const uint8_t* s1, const uint8_t* s2,
+                        uint64_t len, int stop_at_nul) {
+  mcw_rtn_entry* entry = &__mcw_rtn_table[site % MCW_CMP_TABLE_SIZE];
+  uint32_t slot = entry->hits++ % MCW_CMP_HISTORY;
+  uint32_t size = 0;
+  while (size < MCW_RTN_SIZE && size < len) {
+    uint8_t c1 = s1[size], c2 = s2[size];
+    entry->args[slot][0][size] = c1;
+    entry->args[slot][1][size] = c2;
+    ++size;
+    // The NUL of either string ends the compare, and nothing past it may be
+    // read
+    if (stop_at_nul && (c1 == 0 || c2 == 0)) break;
+  }
+  entry->size[slot] = size;
+}
+
+void __mcw_trace_memcmp(uint32_t site, const uint8_t* s1, const uint8_t* s2,
+                        uint64_t len) {
+  trace_bytes(site, s1, s2, len, 0);
+}
+
+void __mcw_trace_strcmp(uint32_t site, const uint8_t* s1, const uint8_t* s2,
+                        uint64_t len) {
+  trace_bytes(site, s1, s2, len, 1);
+}
+
+#define MCW_LINE_SIZE 64
+
+// The byte-wise part of __mcw_has_new_bits, for the rare lines that do hit
+// something new
+static int update_virgin_line(uint8_t* virgin, const uint8_t* map) {
+  int ret = 0;
+  for (int i = 0; i < MCW_LINE_SIZE; ++i) {
+    if ((map[i] & virgin[i]) == 0) continue;
+    ret = virgin[i] == 0xff ? 2 : (ret > 1 ? ret : 1);
+    virgin[i] &= ~map[i];
+  }
+  return ret;
+}
+
+#ifdef MCW_X86_64
+
+// The buckets of 16 hit counts. The thresholds only grow, and so do the
+// buckets, so every bucket a count reaches overrides the previous one.
+static __m128i classify_sse2(__m128i counts) {
+#define MCW_GE(k) \
+  _mm_cmpeq_epi8(_mm_max_epu8(counts, _mm_set1_epi8((char)(k))), counts)
+#define MCW_BUCKET(k, bucket) \
+  _mm_and_si128(MCW_GE(k), _mm_set1_epi8((char)(bucket)))
+  // 0, 1 and 2 stay
+  __m128i buckets = _mm_andnot_si128(MCW_GE(3), counts);
+  buckets = _mm_max_epu8(buckets, MCW_BUCKET(3, 4));
+  buckets = _mm_max_epu8(buckets, MCW_BUCKET(4, 8));
+  buckets = _mm_max_epu8(buckets, MCW_BUCKET(8, 16));
+  buckets = _mm_max_epu8(buckets, MCW_BUCKET(16, 32));
+  buckets = _mm_max_epu8(buckets, MCW_BUCKET(32, 64));
+  return _mm_max_epu8(buckets, MCW_BUCKET(128, 128));
+#undef MCW_BUCKET
+#undef MCW_GE
+}
+
+// A line is four 128-bit vectors
+static int line_is_zero_sse2(const uint8_t* line) {
+  __m128i any =
+      _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i*)line),
+                                _mm_loadu_si128((const __m128i*)line + 1)),
+                   _mm_or_si128(_mm_loadu_si128((const __m128i*)line + 2),
+                                _mm_loadu_si128((const __m128i*)line + 3)));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) == 0xffff;
+}
+
+static void classify_counts_sse2(uint8_t* map, size_t size) {
+  for (size_t i = 0; i < size; i += MCW_LINE_SIZE) {
+    if (line_is_zero_sse2(map + i)) continue;
+    for (int j = 0; j < 4; ++j) {
+      __m128i* ptr = (__m128i*)(map + i) + j;
+      _mm_storeu_si128(ptr, classify_sse2(_mm_loadu_si128(ptr)));
+    }
+  }
+}
+
+static int has_new_bits_sse2(uint8_t* virgin, const uint8_t* map,
+                             size_t size) {
+  int ret = 0;
+  for (size_t i = 0; i < size; i += MCW_LINE_SIZE) {
+    if (line_is_zero_sse2(map + i)) continue;
+    __m128i hit = _mm_setzero_si128();
+    for (int j = 0; j < 4; ++j) {
+      hit = _mm_or_si128(
+          hit, _mm_and_si128(
+                   _mm_loadu_si128((const __m128i*)(map + i) + j),
+                   _mm_loadu_si128((const __m128i*)(virgin + i) + j)));
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(hit, _mm_setzero_si128())) == 0xffff)
+      continue;
+    int line_ret = update_virgin_line(virgin + i, map + i);
+    if (line_ret > ret) ret = line_ret;
+  }
+  return ret;
+}
+
+static size_t export_sparse_sse2(const uint8_t* map, size_t size,
+                                 uint32_t* indices, uint8_t* counts,
+                                 size_t capacity) {
+  size_t num = 0;
+  for (size_t i = 0; i < size; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(map + i));
+    unsigned nonzero =
+        ~_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_setzero_si128())) &
+        0xffff;
+    for (; nonzero != 0; nonzero &= nonzero - 1) {
+      size_t index = i + __builtin_ctz(nonzero);
+      if (num < capacity) {
+        if (indices != NULL) indices[num] = index;
+        if (counts != NULL) counts[num] = map[index];
+      }
+      ++num;
+    }
+  }
+  return num;
+}
+
+// Adds the lines of `src` with a hit to `dst`, and clears them
+static void merge_map_sse2(uint8_t* dst, uint8_t* src, size_t size) {
+  for (size_t i = 0; i < size; i += MCW_LINE_SIZE) {
+    if (line_is_zero_sse2(src + i)) continue;
+    for (int j = 0; j < 4; ++j) {
+      __m128i* dst_ptr = (__m128i*)(dst + i) + j;
+      __m128i* src_ptr = (__m128i*)(src + i) + j;
+      _mm_storeu_si128(dst_ptr, _mm_adds_epu8(_mm_loadu_si128(dst_ptr),
+                                              _mm_loadu_si128(src_ptr)));
+      _mm_storeu_si128(src_ptr, _mm_setzero_si128());
+    }
+  }
+}
+
+// The same with 256-bit vectors: a line is two of them
+
+__attribute__((target("avx2"))) static __m256i classify_avx2(__m256i counts) {
+#define MCW_GE(k) \
+  _mm256_cmpeq_epi8(_mm256_max_epu8(counts, _mm256_set1_epi8((char)(k))), \
+                    counts)
+#define MCW_BUCKET(k, bucket) \
+  _mm256_and_si256(MCW_GE(k), _mm256_set1_epi8((char)(bucket)))
+  __m256i buckets = _mm256_andnot_si256(MCW_GE(3), counts);
+  buckets = _mm256_max_epu8(buckets, MCW_BUCKET(3, 4));
+  buckets = _mm256_max_epu8(buckets, MCW_BUCKET(4, 8));
+  buckets = _mm256_max_epu8(buckets, MCW_BUCKET(8, 16));
+  buckets = _mm256_max_epu8(buckets, MCW_BUCKET(16, 32));
+  buckets = _mm256_max_epu8(buckets, MCW_BUCKET(32, 64));
+  return _mm256_max_epu8(buckets, MCW_BUCKET(128, 128));
+#undef MCW_BUCKET
+#undef MCW_GE
+}
+
+__attribute__((target("avx2"))) static int line_is_zero_avx2(
+    const uint8_t* line) {
+  __m256i any = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)line),
+                                _mm256_loadu_si256((const __m256i*)line + 1));
+  return _mm256_testz_si256(any, any);
+}
+
+__attribute__((target("avx2"))) static void classify_counts_avx2(
+    uint8_t* map, size_t size) {
+  for (size_t i = 0; i < size; i += MCW_LINE_SIZE) {
+    if (line_is_zero_avx2(map + i)) continue;
+    for (int j = 0; j < 2; ++j) {
+      __m256i* ptr = (__m256i*)(map + i) + j;
+      _mm256_storeu_si256(ptr, classify_avx2(_mm256_loadu_si256(ptr)));
+    }
+  }
+}
+
+__attribute__((target("avx2"))) static int has_new_bits_avx2(
+    uint8_t* virgin, const uint8_t* map, size_t size) {
+  int ret = 0;
+  for (size_t i = 0; i < size; i += MCW_LINE_SIZE) {
+    if (line_is_zero_avx2(map + i)) continue;
+    __m256i hit = _mm256_or_si256(
+        _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(map + i)),
+                         _mm256_loadu_si256((const __m256i*)(virgin + i))),
+        _mm256_and_si256(
+            _mm256_loadu_si256((const __m256i*)(map + i) + 1),
+            _mm256_loadu_si256((const __m256i*)(virgin + i) + 1)));
+    if (_mm256_testz_si256(hit, hit)) continue;
+    int line_ret = update_virgin_line(virgin + i, map + i);
+    if (line_ret > ret) ret = line_ret;
+  }
+  return ret;
+}
+
+__attribute__((target("avx2"))) static size_t export_sparse_avx2(
+    const uint8_t* map, size_t size, uint32_t* indices, uint8_t* counts,
+    size_t capacity) {
+  size_t num = 0;
+  for (size_t i = 0; i < size; i += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i*)(map + i));
+    unsigned nonzero = ~(unsigned)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(chunk, _mm256_setzero_si256()));
+    for (; nonzero != 0; nonzero &= nonzero - 1) {
+      size_t index = i + __builtin_ctz(nonzero);
+      if (num < capacity) {
+        if (indices != NULL) indices[num] = index;
+        if (counts != NULL) counts[num] = map[index];
+      }
+      ++num;
+    }
+  }
+  return num;
+}
+
+__attribute__((target("avx2"))) static void merge_map_avx2(uint8_t* dst,
+                                                           uint8_t* src,
+                                                           size_t size) {
+  for (size_t i = 0; i < size; i += MCW_LINE_SIZE) {
+    if (line_is_zero_avx2(src + i)) continue;
+    for (int j = 0; j < 2; ++j) {
+      __m256i* dst_ptr = (__m256i*)(dst + i) + j;
+      __m256i* src_ptr = (__m256i*)(src + i) + j;
+      _mm256_storeu_si256(dst_ptr,
+                          _mm256_adds_epu8(_mm256_loadu_si256(dst_ptr),
+                                           _mm256_loadu_si256(src_ptr)));
+      _mm256_storeu_si256(src_ptr, _mm256_setzero_si256());
+    }
+  }
+}
+
+static int has_avx2(void) {
+  static int cached = -1;
+  if (cached < 0) {
+    __builtin_cpu_init();
+    cached = __builtin_cpu_supports("avx2") != 0;
+  }
+  return cached;
+}
+
+#else
+
+// The bucket of every hit count
+static const uint8_t count_class[256] = {
+    [0] = 0,           [1] = 1,           [2] = 2,
+    [3] = 4,           [4 ... 7] = 8,     [8 ... 15] = 16,
+    [16 ... 31] = 32,  [32 ... 127] = 64, [128 ... 255] = 128,
+};
+
+static int line_is_zero(const uint8_t* line) {
+  uint64_t any = 0;
+  for (int i = 0; i < MCW_LINE_SIZE; i += 8) {
+    uint64_t word;
+    memcpy(&word, line + i, 8);
+    any |= word;
+  }
+  return any == 0;
+}
+
+static size_t export_line(const uint8_t* line, size_t index, size_t num,
+                          uint32_t* indices, uint8_t* counts,
+                          size_t capacity) {
+  for (int i = 0; i < MCW_LINE_SIZE; ++i) {
+    if (line[i] == 0) continue;
+    if (num < capacity) {
+      if (indices != NULL) indices[num] = index + i;
+      if (counts != NULL) counts[num] = line[i];
+    }
+    ++num;
+  }
+  return num;
+}
+
+static void classify_counts_scalar(uint8_t* map, size_t size) {
+  for (size_t i = 0; i < size; i += MCW_LINE_SIZE) {
+    if (line_is_zero(map + i)) continue;
+    for (int j = 0; j < MCW_LINE_SIZE; ++j) map[i + j] = count_class[map[i + j]];
+  }
+}
+
+static int has_new_bits_scalar(uint8_t* virgin, const uint8_t* map,
+                               size_t size) {
+  int ret = 0;
+  for (size_t i = 0; i < size; i += MCW_LINE_SIZE) {
+    if (line_is_zero(map + i)) continue;
+    int line_ret = update_virgin_line(virgin + i, map + i);
+    if (line_ret > ret) ret = line_ret;
+  }
+  return ret;
+}
+
+static size_t export_sparse_scalar(const uint8_t* map, size_t size,
+                                   uint32_t* indices, uint8_t* counts,
+                                   size_t capacity) {
+  size_t num = 0;
+  for (size_t i = 0; i < size; i += MCW_LINE_SIZE) {
+    if (line_is_zero(map + i)) continue;
+    num = export_line(map + i, i, num, indices, counts, capacity);
+  }
+  return num;
+}
+
+static void merge_map_scalar(uint8_t* dst, uint8_t* src, size_t size) {
+  for (size_t i = 0; i < size; i += MCW_LINE_SIZE) {
+    if (line_is_zero(src + i)) continue;
+    for (int j = 0; j < MCW_LINE_SIZE; ++j) {
+      unsigned sum = dst[i + j] + src[i + j];
+      dst[i + j] = sum < 255 ? sum : 255;
+    }
+    memset(src + i, 0, MCW_LINE_SIZE);
+  }
+}
+
+#endif  // MCW_X86_64
+
+void __mcw_classify_counts(uint8_t* map, size_t size) {
+#ifdef MCW_X86_64
+  if (has_avx2())
+    classify_counts_avx2(map, size);
+  else
+    classify_counts_sse2(map, size);
+#else
+  classify_counts_scalar(map, size);
+#endif
+}
+
+int __mcw_has_new_bits(uint8_t* virgin, const uint8_t* map, size_t size) {
+#ifdef MCW_X86_64
+  return has_avx2() ? has_new_bits_avx2(virgin, map, size)
+                    : has_new_bits_sse2(virgin, map, size);
+#else
+  return has_new_bits_scalar(virgin, map, size);
+#endif
+}
+
+size_t __mcw_export_sparse(const uint8_t* map, size_t size, uint32_t* indices,
+                           uint8_t* counts, size_t capacity) {
+#ifdef MCW_X86_64
+  return has_avx2() ? export_sparse_avx2(map, size, indices, counts, capacity)
+                    : export_sparse_sse2(map, size, indices, counts, capacity);
+#else
+  return export_sparse_scalar(map, size, indices, counts, capacity);
+#endif
+}
+
+static void merge_map(uint8_t* dst, uint8_t* src, size_t size) {
+#ifdef MCW_X86_64
+  if (has_avx2())
+    merge_map_avx2(dst, src, size);
+  else
+    merge_map_sse2(dst, src, size);
+#else
+  merge_map_scalar(dst, src, size);
+#endif
+}
+
+// Every map ever allocated: none is freed, so the registry is a list that
+// only grows, at its head, with a compare-and-swap, and is walked without
+// locks
+typedef struct mcw_thread_map {
+  uint8_t* area;
+  struct mcw_thread_map* next;
+  // Whether a thread has it, set with a compare-and-swap
+  int in_use;
+} mcw_thread_map;
+
+static mcw_thread_map* thread_maps;
+// Of the map of every thread, to merge it when the thread exits
+static pthread_key_t thread_map_key;
+static pthread_once_t thread_map_key_once = PTHREAD_ONCE_INIT;
+// Merges are rare, and one at a time, so that two don't add to the same
+// counter of __mcw_area_ptr
+static char merging;
+
+static void lock_merges(void) {
+  while (__atomic_test_and_set(&merging, __ATOMIC_ACQUIRE)) continue;
+}
+
+static void unlock_merges(void) { __atomic_clear(&merging, __ATOMIC_RELEASE); }
+
+static void merge_thread_map(mcw_thread_map* map) {
+  lock_merges();
+  merge_map((uint8_t*)__mcw_area_ptr, map->area, __mcw_map_size);
+  unlock_merges();
+}
+
+static void release_thread_map(void* ptr) {
+  mcw_thread_map* map = ptr;
+  merge_thread_map(map);
+  // A block running after this (in the destructor of other TLS) gets a map
+  // again
+  __mcw_thread_area_ptr = NULL;
+  __atomic_store_n(&map->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_thread_map_key(void) {
+  pthread_key_create(&thread_map_key, release_thread_map);
+}
+
+char* __mcw_thread_area(void) {
+  pthread_once(&thread_map_key_once, create_thread_map_key);
+
+  // The map of an exited thread, merged and cleared already, or a new one
+  mcw_thread_map* map = NULL;
+  for (mcw_thread_map* it = __atomic_load_n(&thread_maps, __ATOMIC_ACQUIRE);
+       it != NULL && map == NULL; it = it->next) {
+    int unused = 0;
+    if (__atomic_compare_exchange_n(&it->in_use, &unused, 1, /*weak=*/0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      map = it;
+  }
+  if (map == NULL) {
+    map = calloc(1, sizeof(*map));
+    // Of the largest size, in pages that stay unallocated until hit
+    if (map != NULL) map->area = calloc(1, MCW_MAX_MAP_SIZE);
+    if (map == NULL || map->area == NULL) {
+      // This thread shares the map then
+      free(map);
+      __mcw_thread_area_ptr = __mcw_area_ptr;
+      return __mcw_thread_area_ptr;
+    }
+    map->in_use = 1;
+    map->next = __atomic_load_n(&thread_maps, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&thread_maps, &map->next, map,
+                                        /*weak=*/1, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED))
+      continue;
+  }
+
+  pthread_setspecific(thread_map_key, map);
+  __mcw_thread_area_ptr = (char*)map->area;
+  return __mcw_thread_area_ptr;
+}
+
+void __mcw_use_thread_maps(void) { use_thread_maps = 1; }
+
+void __mcw_merge_thread_maps(void) {
+  lock_merges();
+  for (mcw_thread_map* it = __atomic_load_n(&thread_maps, __ATOMIC_ACQUIRE);
+       it != NULL; it = it->next) {
+    // The others were merged when their thread exited
+    if (__atomic_load_n(&it->in_use, __ATOMIC_ACQUIRE))
+      merge_map((uint8_t*)__mcw_area_ptr, it->area, __mcw_map_size);
+  }
+  unlock_merges();
+}
+
+static void clear_thread_maps(void) {
+  for (mcw_thread_map* it = __atomic_load_n(&thread_maps, __ATOMIC_ACQUIRE);
+       it != NULL; it = it->next)
+    memset(it->area, 0, __mcw_map_size);
+}
+
+// The threads still running, the main one included, don't exit on their own
+__attribute__((destructor)) static void merge_thread_maps_at_exit(void) {
+  __mcw_merge_thread_maps();
+}
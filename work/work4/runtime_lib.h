@@ -0,0 +1,120 @@
+#ifndef WORK4_RUNTIME_LIB_H_
+#define WORK4_RUNTIME_LIB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MCW_MAP_SIZE (1 << 16)
+// my_clang_wrapper indexes more of the map with MCW_NGRAM, MCW_CTX or
+// MCW_LOG_MAP_SIZE
+#define MCW_MAX_MAP_SIZE (1 << 20)
+// The longest history of MCW_NGRAM
+#define MCW_NGRAM_MAX 16
+
+// The coverage map: one 8-bit hit counter per edge, updated by the code
+// my_clang_wrapper instruments. Only the first __mcw_map_size bytes are
+// used, MCW_MAP_SIZE unless an instrumented module asks for more.
+extern char __mcw_area_initial[MCW_MAX_MAP_SIZE];
+extern char* __mcw_area_ptr;
+extern uint32_t __mcw_map_size;
+// Called by the constructors of the modules using more of the map
+void __mcw_set_map_size(uint32_t size);
+// Clears the used part of the map (and of the maps of every thread), and the
+// blocks and context the next block of this thread would record an edge
+// from, before a run in process
+void __mcw_reset(void);
+
+// Per-thread maps, which my_clang_wrapper uses with MCW_THREAD_MAPS so that
+// threads don't share the lines of hot counters. A thread's map is allocated
+// by the first block it runs, and added (saturating at 255) to the map at
+// __mcw_area_ptr when the thread exits, when the process exits and on
+// __mcw_merge_thread_maps. The map of an exited thread goes to the next new
+// thread.
+//
+// The map of this thread, or NULL before its first block
+extern __thread char* __mcw_thread_area_ptr;
+// Allocates the map of this thread and returns it
+char* __mcw_thread_area(void);
+// Called by the constructors of modules instrumented with MCW_THREAD_MAPS,
+// for the callbacks of the runtime to use the maps too
+void __mcw_use_thread_maps(void);
+// Adds the maps of every thread to the map at __mcw_area_ptr and clears them.
+// Hits of threads running meanwhile may be lost.
+void __mcw_merge_thread_maps(void);
+
+// Edge coverage through SanitizerCoverage's trace-pc-guard callbacks, which
+// my_clang_wrapper emits with MCW_MODE=guard (and clang with
+// -fsanitize-coverage=trace-pc-guard). init gives every guard of a module
+// the ID of its block; the callback records the edge from the previous block
+// to the block of `guard` with a counter that never wraps to 0.
+void __sanitizer_cov_trace_pc_guard_init(uint32_t* start, uint32_t* stop);
+void __sanitizer_cov_trace_pc_guard(uint32_t* guard);
+
+// The operands of the compares traced with MCW_TRACE_CMPS. Every compare
+// site has an entry of each table (sites may share one), which keeps the
+// operands of its last MCW_CMP_HISTORY runs, at [hits % MCW_CMP_HISTORY].
+#define MCW_CMP_TABLE_SIZE (1 << 12)
+#define MCW_CMP_HISTORY 4
+// Bytes kept of the operands of memcmp, strcmp and the like
+#define MCW_RTN_SIZE 32
+
+typedef struct {
+  uint32_t hits;
+  // Of the operands, in bytes
+  uint32_t size;
+  uint64_t args[MCW_CMP_HISTORY][2];
+} mcw_cmp_entry;
+
+typedef struct {
+  uint32_t hits;
+  // Bytes compared, at most MCW_RTN_SIZE
+  uint32_t size[MCW_CMP_HISTORY];
+  uint8_t args[MCW_CMP_HISTORY][2][MCW_RTN_SIZE];
+} mcw_rtn_entry;
+
+extern mcw_cmp_entry __mcw_cmp_table[MCW_CMP_TABLE_SIZE];
+extern mcw_rtn_entry __mcw_rtn_table[MCW_CMP_TABLE_SIZE];
+
+// Integer compares, and switches, as one compare of `value` per case
+void __mcw_trace_cmp(uint32_t site, uint32_t size, uint64_t arg1,
+                     uint64_t arg2);
+void __mcw_trace_switch(uint32_t site, uint32_t size, uint64_t value,
+                        const uint64_t* cases, uint32_t num_cases);
+// memcmp and bcmp compare `len` bytes; strcmp (where `len` is UINT64_MAX),
+// strncmp and their case-insensitive versions stop at the first NUL too.
+void __mcw_trace_memcmp(uint32_t site, const uint8_t* s1, const uint8_t* s2,
+                        uint64_t len);
+void __mcw_trace_strcmp(uint32_t site, const uint8_t* s1, const uint8_t* s2,
+                        uint64_t len);
+
+// Coverage analysis. `size` is a multiple of 64, and 64-byte lines without a
+// single hit are skipped, so the cost follows the coverage of the run rather
+// than the size of the map. AVX2 is used where the CPU has it, SSE2 elsewhere
+// on x86-64.
+
+// Replaces every hit count of `map` with its bucket: 0, 1, 2, 3 -> 4,
+// 4-7 -> 8, 8-15 -> 16, 16-31 -> 32, 32-127 -> 64 and 128+ -> 128, so that
+// runs differing by a few iterations of a loop look the same.
+void __mcw_classify_counts(uint8_t* map, size_t size);
+
+// Compares the classified `map` of a run with `virgin`, the buckets no run
+// has hit so far (all bits set at first), and clears the buckets hit from
+// `virgin`. Returns 2 if the run hit an edge no run has, 1 if it only hit a
+// new bucket of a known edge, and 0 if it found nothing new.
+int __mcw_has_new_bits(uint8_t* virgin, const uint8_t* map, size_t size);
+
+// Writes the index and the value of the non-zero entries of `map`, in order,
+// to `indices` and `counts` (which may be NULL), up to `capacity` of them.
+// Returns the number of non-zero entries, which may exceed `capacity`.
+size_t __mcw_export_sparse(const uint8_t* map, size_t size, uint32_t* indices,
+                           uint8_t* counts, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // WORK4_RUNTIME_LIB_H_
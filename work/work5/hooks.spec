@@ -0,0 +1,10 @@
+# <opcode> <hook>
+# Every hook is called once per basic block (and batch) with the operands of
+# the instructions of its opcode: void hook(const uint64_t *slots,
+# uint64_t count), see lib.c.
+fadd  HookFAdd
+fmul  HookFMul
+fdiv  HookFDiv
+load  HookLoad
+store HookStore
+icmp  HookICmp
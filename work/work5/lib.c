@@ -0,0 +1,73 @@
+// lib.c
+// Sample hooks for hooks.spec. Every hook gets the operands of a batch of
+// instructions, `count` records of one 64-bit slot per operand (see
+// work5.cc), and only observes them.
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+struct Stats {
+  const char *name;
+  uint64_t num_calls;
+  uint64_t num_insts;
+};
+
+static struct Stats fadd_stats = {"fadd"}, fmul_stats = {"fmul"},
+                    fdiv_stats = {"fdiv"}, load_stats = {"load"},
+                    store_stats = {"store"}, icmp_stats = {"icmp"};
+static double fdiv_min_abs_divisor = 1.0 / 0.0;
+
+static void Count(struct Stats *stats, uint64_t count) {
+  ++stats->num_calls;
+  stats->num_insts += count;
+}
+
+// Only double operations are decoded here: float and half come zero-extended
+// from their own bits
+static double AsDouble(uint64_t slot) {
+  double res;
+  memcpy(&res, &slot, sizeof(res));
+  return res;
+}
+
+void HookFAdd(const uint64_t *slots, uint64_t count) {
+  Count(&fadd_stats, count);
+}
+
+void HookFMul(const uint64_t *slots, uint64_t count) {
+  Count(&fmul_stats, count);
+}
+
+// Records: dividend, divisor
+void HookFDiv(const uint64_t *slots, uint64_t count) {
+  Count(&fdiv_stats, count);
+  for (uint64_t i = 0; i < count; ++i) {
+    double divisor = AsDouble(slots[2 * i + 1]);
+    if (divisor < 0) divisor = -divisor;
+    if (divisor < fdiv_min_abs_divisor) fdiv_min_abs_divisor = divisor;
+  }
+}
+
+void HookLoad(const uint64_t *slots, uint64_t count) {
+  Count(&load_stats, count);
+}
+
+void HookStore(const uint64_t *slots, uint64_t count) {
+  Count(&store_stats, count);
+}
+
+void HookICmp(const uint64_t *slots, uint64_t count) {
+  Count(&icmp_stats, count);
+}
+
+__attribute__((destructor)) static void PrintStats(void) {
+  const struct Stats *all[] = {&fadd_stats, &fmul_stats, &fdiv_stats,
+                               &load_stats, &store_stats, &icmp_stats};
+  for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); ++i) {
+    if (all[i]->num_insts == 0) continue;
+    fprintf(stderr, "[hooks] %-5s %10" PRIu64 " instructions in %10" PRIu64
+            " calls\n", all[i]->name, all[i]->num_insts, all[i]->num_calls);
+  }
+  if (fdiv_stats.num_insts != 0)
+    fprintf(stderr, "[hooks] smallest |divisor| %g\n", fdiv_min_abs_divisor);
+}
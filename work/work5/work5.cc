@@ -0,0 +1,307 @@
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"    // parseIRFile
+#include "llvm/Support/Casting.h"      // cast
+#include "llvm/Support/CommandLine.h"  // SMDiagnostic
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "common/driver.h"
+
+using namespace llvm;
+using InstPtrVector = std::vector<Instruction*>;
+
+// An opcode and the function observing its instructions. Every hook is
+// called as `void hook(const uint64_t* slots, uint64_t count)` with `count`
+// records of `arity` slots, one slot per operand: integers (up to 64 bits)
+// are zero-extended, pointers converted, half/float/double bitcast and
+// zero-extended. Hooks observe, they can't change anything.
+struct HookSpec {
+  unsigned opcode = 0;
+  std::string name;
+  unsigned arity = 0;
+  FunctionCallee callee;
+};
+
+static cl::opt<std::string> spec_filename(
+    "spec", cl::desc("Hook spec: one '<opcode> <hook>' per line"),
+    cl::value_desc("file"), cl::Required);
+static cl::opt<unsigned> max_batch_slots(
+    "max-batch-slots",
+    cl::desc("Size of the per-function buffer, in 64-bit slots. Blocks with "
+             "more operands call their hooks more than once."),
+    cl::init(128));
+
+bool ParseSpec(StringRef path, std::vector<HookSpec>& specs);
+unsigned GetArity(unsigned opcode);
+Value* CreateSlotValue(IRBuilder<>& builder, Value* val);
+bool IsHookable(const Instruction& inst);
+// Returns true if `inst` is a call that may not come back: one that doesn't
+// return (exit, abort, longjmp...) or may throw
+bool MayNotReturn(const Instruction& inst);
+void RunOnModule(Module& module, std::vector<HookSpec>& specs);
+void RunOnFunction(Function& fn, const std::vector<HookSpec>& specs);
+void RunOnBasicBlock(BasicBlock& bb, const InstPtrVector& insts,
+                     const std::vector<HookSpec>& specs,
+                     const std::vector<int>& spec_of_opcode,
+                     AllocaInst* buffer);
+
+int main(int argc, char** argv) {
+  common::Driver driver(argc, argv, "Batches operands of opcodes to hooks\n");
+
+  auto specs = std::vector<HookSpec>();
+  if (ParseSpec(spec_filename, specs) == false) return 1;
+  for (const auto& spec : specs) {
+    if (spec.arity > max_batch_slots) {
+      errs() << "-max-batch-slots must be at least " << spec.arity << "\n";
+      return 1;
+    }
+  }
+
+  return driver.Run("work5", [&](Module& module) {
+    RunOnModule(module, specs);
+    return true;
+  });
+}
+
+bool ParseSpec(StringRef path, std::vector<HookSpec>& specs) {
+  auto buffer = MemoryBuffer::getFile(path);
+  if (std::error_code ec = buffer.getError()) {
+    errs() << "Cannot read " << path << ": " << ec.message() << "\n";
+    return false;
+  }
+
+  auto opcodes = StringMap<unsigned>();
+  for (unsigned opcode = Instruction::TermOpsBegin;
+       opcode < Instruction::OtherOpsEnd; ++opcode)
+    opcodes[Instruction::getOpcodeName(opcode)] = opcode;
+
+  auto lines = SmallVector<StringRef, 16>();
+  (*buffer)->getBuffer().split(lines, '\n');
+  for (unsigned line_no = 0; line_no < lines.size(); ++line_no) {
+    // Everything after '#' is a comment
+    auto line = lines[line_no].split('#').first.trim();
+    if (line.empty()) continue;
+
+    auto fields = SmallVector<StringRef, 2>();
+    line.split(fields, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+    auto iter = fields.size() == 2 ? opcodes.find(fields[0]) : opcodes.end();
+    if (iter == opcodes.end() || GetArity(iter->second) == 0) {
+      errs() << path << ":" << line_no + 1 << ": expected '<opcode> <hook>' "
+             << "with a supported opcode\n";
+      return false;
+    }
+
+    for (const auto& spec : specs) {
+      if (spec.opcode == iter->second || spec.name == fields[1]) {
+        errs() << path << ":" << line_no + 1
+               << ": opcodes and hooks can only appear once\n";
+        return false;
+      }
+    }
+    auto spec = HookSpec();
+    spec.opcode = iter->second;
+    spec.name = fields[1].str();
+    spec.arity = GetArity(spec.opcode);
+    specs.push_back(spec);
+  }
+  return true;
+}
+
+// Returns the number of operands of the instructions of `opcode`, or 0 if
+// it isn't fixed (calls, phis, getelementptr...) or there's nothing to
+// observe (terminators).
+unsigned GetArity(unsigned opcode) {
+  if (Instruction::isBinaryOp(opcode)) return 2;
+  if (Instruction::isUnaryOp(opcode) || Instruction::isCast(opcode)) return 1;
+  switch (opcode) {
+    case Instruction::ICmp:
+    case Instruction::FCmp:
+    case Instruction::Store: {
+      return 2;
+    }
+    case Instruction::Load: {
+      return 1;
+    }
+    case Instruction::Select: {
+      return 3;
+    }
+    default: {
+      return 0;
+    }
+  }
+}
+
+// Returns `val` as a 64-bit slot, see `HookSpec`. Types that don't fit (e.g.
+// vectors, i128 or x86_fp80) must have been filtered out by `IsHookable`.
+Value* CreateSlotValue(IRBuilder<>& builder, Value* val) {
+  auto* i64_ty = builder.getInt64Ty();
+  auto* ty = val->getType();
+  if (ty->isPointerTy()) return builder.CreatePtrToInt(val, i64_ty);
+  if (ty->isFloatingPointTy()) {
+    val = builder.CreateBitCast(
+        val, builder.getIntNTy(ty->getPrimitiveSizeInBits()));
+  }
+  return builder.CreateZExtOrBitCast(val, i64_ty);
+}
+
+bool IsHookable(const Instruction& inst) {
+  for (const auto* operand : inst.operand_values()) {
+    auto* ty = operand->getType();
+    bool fits = ty->isPointerTy() ||
+                (ty->isIntegerTy() && ty->getIntegerBitWidth() <= 64) ||
+                ty->isHalfTy() || ty->isFloatTy() || ty->isDoubleTy();
+    if (fits == false) return false;
+  }
+  return true;
+}
+
+bool MayNotReturn(const Instruction& inst) {
+  const auto* call = dyn_cast<CallBase>(&inst);
+  return call != nullptr &&
+         (call->doesNotReturn() || call->doesNotThrow() == false);
+}
+
+void RunOnModule(Module& module, std::vector<HookSpec>& specs) {
+  auto& ctx = module.getContext();
+  auto* hook_ty = FunctionType::get(
+      Type::getVoidTy(ctx),
+      {Type::getInt64PtrTy(ctx), Type::getInt64Ty(ctx)}, /*isVarArgs=*/false);
+  for (auto& spec : specs)
+    spec.callee = module.getOrInsertFunction(spec.name, hook_ty);
+
+  for (auto& fn : module) {
+    if (fn.isDeclaration()) continue;
+    // The hooks themselves may be part of the module
+    bool is_hook = false;
+    for (const auto& spec : specs) is_hook |= fn.getName() == spec.name;
+    if (is_hook) continue;
+    RunOnFunction(fn, specs);
+  }
+}
+
+void RunOnFunction(Function& fn, const std::vector<HookSpec>& specs) {
+  auto spec_of_opcode = std::vector<int>(Instruction::OtherOpsEnd, -1);
+  for (unsigned idx = 0; idx < specs.size(); ++idx)
+    spec_of_opcode[specs[idx].opcode] = idx;
+
+  // Collect everything first: instrumenting adds instructions (and the
+  // buffer's size depends on the busiest block)
+  auto blocks = std::vector<std::pair<BasicBlock*, InstPtrVector>>();
+  unsigned num_slots = 0;
+  for (auto& bb : fn) {
+    auto insts = InstPtrVector();
+    unsigned block_slots = 0;
+    // Nothing can go between a musttail call and the return
+    auto* must_tail_call = bb.getTerminatingMustTailCall();
+    for (auto& inst : bb) {
+      if (&inst == must_tail_call) break;
+      int spec = spec_of_opcode[inst.getOpcode()];
+      if (spec < 0 || IsHookable(inst) == false) continue;
+      insts.push_back(&inst);
+      block_slots += specs[spec].arity;
+    }
+    if (insts.empty()) continue;
+    num_slots = std::max(num_slots, block_slots);
+    blocks.emplace_back(&bb, std::move(insts));
+  }
+  if (blocks.empty()) return;
+
+  // A single buffer per function, reused by every block
+  auto builder = IRBuilder<>(&*fn.getEntryBlock().getFirstInsertionPt());
+  auto* buffer = builder.CreateAlloca(
+      ArrayType::get(builder.getInt64Ty(),
+                     std::min<unsigned>(num_slots, max_batch_slots)),
+      nullptr, "hook_slots");
+  for (auto& block : blocks)
+    RunOnBasicBlock(*block.first, block.second, specs, spec_of_opcode, buffer);
+}
+
+void RunOnBasicBlock(BasicBlock& bb, const InstPtrVector& insts,
+                     const std::vector<HookSpec>& specs,
+                     const std::vector<int>& spec_of_opcode,
+                     AllocaInst* buffer) {
+  const unsigned capacity =
+      cast<ArrayType>(buffer->getAllocatedType())->getNumElements();
+  Instruction* block_end = bb.getTerminatingMustTailCall();
+  if (block_end == nullptr) block_end = bb.getTerminator();
+
+  // Batches are passed before a call that may not return too, or what they
+  // recorded would be lost. Found before the hooks, which are such calls, are
+  // added.
+  auto barriers = InstPtrVector();
+  auto order = DenseMap<const Instruction*, unsigned>();
+  unsigned num_insts = 0;
+  for (auto& inst : bb) {
+    if (&inst == block_end) break;
+    order[&inst] = num_insts++;
+    if (MayNotReturn(inst)) barriers.push_back(&inst);
+  }
+  size_t next_barrier = 0;
+
+  // Split the block's instructions into batches that fit in the buffer. Every
+  // hook gets a contiguous region of the buffer in a batch.
+  for (size_t begin = 0; begin < insts.size();) {
+    while (next_barrier < barriers.size() &&
+           order[barriers[next_barrier]] < order[insts[begin]])
+      ++next_barrier;
+    // A hooked call that may not return is recorded before it, and the batch
+    // passed right after that
+    Instruction* barrier =
+        next_barrier < barriers.size() ? barriers[next_barrier] : nullptr;
+
+    auto counts = std::vector<unsigned>(specs.size(), 0);
+    unsigned used = 0;
+    size_t end = begin;
+    for (; end < insts.size(); ++end) {
+      if (barrier != nullptr && order[insts[end]] > order[barrier]) break;
+      unsigned spec = spec_of_opcode[insts[end]->getOpcode()];
+      if (used + specs[spec].arity > capacity) break;
+      used += specs[spec].arity;
+      ++counts[spec];
+    }
+    auto offsets = std::vector<unsigned>(specs.size(), 0);
+    for (unsigned idx = 1; idx < specs.size(); ++idx)
+      offsets[idx] = offsets[idx - 1] + counts[idx - 1] * specs[idx - 1].arity;
+
+    // Record the operands right before every instruction...
+    auto next = offsets;
+    for (size_t idx = begin; idx < end; ++idx) {
+      auto* inst = insts[idx];
+      auto builder = IRBuilder<>(inst);
+      unsigned spec = spec_of_opcode[inst->getOpcode()];
+      for (auto* operand : inst->operand_values()) {
+        auto* slot = builder.CreateConstInBoundsGEP2_32(
+            buffer->getAllocatedType(), buffer, 0, next[spec]++);
+        builder.CreateStore(CreateSlotValue(builder, operand), slot);
+      }
+    }
+
+    // ... and pass them before the next batch, a call that may not return,
+    // or at the end of the block
+    Instruction* flush_pt = end < insts.size() ? insts[end] : block_end;
+    if (barrier != nullptr &&
+        (end == insts.size() || order[insts[end]] > order[barrier]))
+      flush_pt = barrier;
+    auto builder = IRBuilder<>(flush_pt);
+    for (unsigned spec = 0; spec < specs.size(); ++spec) {
+      if (counts[spec] == 0) continue;
+      auto* slots = builder.CreateConstInBoundsGEP2_32(
+          buffer->getAllocatedType(), buffer, 0, offsets[spec]);
+      builder.CreateCall(specs[spec].callee,
+                         {slots, builder.getInt64(counts[spec])});
+    }
+    begin = end;
+  }
+}